@@ -0,0 +1,424 @@
+//
+// Index used by findAccount() for account arrays produced by the loaders: a direct table when
+// the account numbers are dense, an open-addressing hash table otherwise.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "account_index.h"
+#include "snapshot.h"
+
+static struct AccountIndex registry[MAX_INDEXED_TABLES];
+// Taken to build an index on its first lookup and to add to a dirty list; lookups of a built
+// index and accounts that are already dirty take no lock.
+static pthread_mutex_t buildLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t dirtyLock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct AccountIndex* registryEntry(const struct BankAccount *accounts) {
+    for (int i = 0; i < MAX_INDEXED_TABLES; i++) {
+        if (registry[i].accounts == accounts && accounts != NULL) {
+            return &registry[i];
+        }
+    }
+    return NULL;
+}
+
+// Fibonacci hashing: the top bits of key * 2^32/phi spread sequential account numbers evenly.
+static uint32_t slotFor(const struct AccountIndex *index, int accountNumber) {
+    return ((uint32_t)accountNumber * 2654435769u) >> index->shift;
+}
+
+// Insert unless the key is already present; like the linear scan, the first account with a number wins.
+static void insertSlot(struct AccountIndex *index, int accountNumber, int position) {
+    uint32_t slot = slotFor(index, accountNumber);
+    while (index->slots[slot].position >= 0) {
+        if (index->slots[slot].accountNumber == accountNumber) {
+            return;
+        }
+        slot = (slot + 1) & index->slotMask;
+    }
+    index->slots[slot].accountNumber = accountNumber;
+    index->slots[slot].position = position;
+}
+
+// Hash table with room for at least `records` keys at a load factor of at most 1/2.
+static bool buildHash(struct AccountIndex *index, int records) {
+    int bits = 4;
+    while ((1L << bits) < 2L * records) {
+        bits++;
+    }
+    struct IndexSlot *slots = malloc(sizeof(struct IndexSlot) << bits);
+    if (slots == NULL) {
+        return false;
+    }
+    memset(slots, 0xff, sizeof(struct IndexSlot) << bits);  // position == -1 everywhere
+    free(index->slots);
+    free(index->direct);
+    index->direct = NULL;
+    index->slots = slots;
+    index->slotMask = (1u << bits) - 1;
+    index->shift = 32 - bits;
+    index->strategy = INDEX_HASH;
+    for (int i = 0; i < index->count; i++) {
+        insertSlot(index, index->accounts[i].accountNumber, i);
+    }
+    return true;
+}
+
+// Direct table of `size` slots starting at account number `base`.
+static bool buildDirect(struct AccountIndex *index, int base, uint32_t size) {
+    int *direct = malloc(size * sizeof(int));
+    if (direct == NULL) {
+        return false;
+    }
+    memset(direct, 0xff, size * sizeof(int));  // -1 everywhere
+    free(index->slots);
+    free(index->direct);
+    index->slots = NULL;
+    index->direct = direct;
+    index->directBase = base;
+    index->directSize = size;
+    index->strategy = INDEX_DIRECT;
+    // Walk backwards so the first account with a duplicate number ends up in the table.
+    for (int i = index->count - 1; i >= 0; i--) {
+        direct[(uint32_t)(index->accounts[i].accountNumber - base)] = i;
+    }
+    return true;
+}
+
+// Pick the strategy: a direct table when the numbers are dense, the hash table otherwise.
+static bool buildIndex(struct AccountIndex *index) {
+    index->built = false;
+    if (index->count > 0) {
+        index->minNumber = index->maxNumber = index->accounts[0].accountNumber;
+        for (int i = 1; i < index->count; i++) {
+            int number = index->accounts[i].accountNumber;
+            if (number < index->minNumber) index->minNumber = number;
+            if (number > index->maxNumber) index->maxNumber = number;
+        }
+        long long range = (long long)index->maxNumber - index->minNumber + 1;
+        if (range <= (long long)DIRECT_INDEX_MAX_SPREAD * index->count && range <= INT32_MAX &&
+            buildDirect(index, index->minNumber, (uint32_t)range)) {
+            index->built = true;
+            return true;
+        }
+    }
+    index->built = buildHash(index, index->count);
+    return index->built;
+}
+
+// Free everything an entry owns except the account array, leaving a free registry entry.
+static void clearEntry(struct AccountIndex *index) {
+    free(index->slots);
+    free(index->direct);
+    free(index->dirty);
+    free((void *)index->dirtyBits);
+    free(index->snapshotFile);
+    memset(index, 0, sizeof(*index));
+}
+
+static void printIndexInfo(const struct AccountIndex *index) {
+    if (index->strategy == INDEX_DIRECT) {
+        printf("Account lookup: direct table for account numbers %d..%d (%u slots, %.1f KB)\n",
+               index->directBase, index->directBase + (int)index->directSize - 1, index->directSize,
+               index->directSize * sizeof(int) / 1024.0);
+    } else {
+        printf("Account lookup: hash index over %d accounts (%u slots, %.1f KB)\n",
+               index->count, index->slotMask + 1, (index->slotMask + 1) * sizeof(struct IndexSlot) / 1024.0);
+    }
+}
+
+bool registerAccounts(struct BankAccount *accounts, int count, int capacity) {
+    if (accounts == NULL) {
+        return false;
+    }
+    struct AccountIndex *index = registryEntry(accounts);
+    for (int i = 0; index == NULL && i < MAX_INDEXED_TABLES; i++) {
+        if (registry[i].accounts == NULL) {
+            index = &registry[i];
+        }
+    }
+    if (index == NULL) {
+        printf("Error: %d account tables are loaded already; lookups in another one scan it, and it is "
+               "always saved in full.\n", MAX_INDEXED_TABLES);
+        return false;
+    }
+    clearEntry(index);
+    index->accounts = accounts;
+    index->count = count;
+    index->capacity = capacity;
+    if (capacity == 0) {
+        index->mapping = accounts;
+        index->mappingCount = count;
+    }
+    // Allocated up front, so that markAccountDirty() can test a bit without taking a lock.
+    index->dirtyBits = calloc((size_t)count / 8 + 1, 1);
+    index->dirtyBitsCapacity = index->dirtyBits != NULL ? count : 0;
+    return true;
+}
+
+void releaseAccounts(struct BankAccount *accounts) {
+    struct AccountIndex *index = registryEntry(accounts);
+    if (index == NULL) {
+        free(accounts);
+        return;
+    }
+    if (index->mapping != NULL) {
+        closeAccountsSnapshot(index->mapping, index->mappingCount);
+    }
+    if (index->capacity > 0) {
+        free(accounts);
+    }
+    clearEntry(index);
+}
+
+struct AccountIndex* accountIndexFor(struct BankAccount *accounts, int count) {
+    struct AccountIndex *index = registryEntry(accounts);
+    if (index == NULL || index->count != count) {
+        return NULL;
+    }
+    // Built lazily so that opening a snapshot stays O(1).
+    if (!index->built) {
+        pthread_mutex_lock(&buildLock);
+        bool built = index->built || buildIndex(index);
+        if (built && index->announce) {
+            index->announce = false;
+            printIndexInfo(index);
+        }
+        pthread_mutex_unlock(&buildLock);
+        if (!built) {
+            return NULL;
+        }
+    }
+    return index;
+}
+
+int accountIndexLookup(const struct AccountIndex *index, int accountNumber) {
+    if (index->strategy == INDEX_DIRECT) {
+        // One bounds check (negative offsets wrap around to large values) and one load.
+        uint32_t offset = (uint32_t)accountNumber - (uint32_t)index->directBase;
+        return offset < index->directSize ? index->direct[offset] : -1;
+    }
+    uint32_t slot = slotFor(index, accountNumber);
+    while (index->slots[slot].position >= 0) {
+        if (index->slots[slot].accountNumber == accountNumber) {
+            return index->slots[slot].position;
+        }
+        slot = (slot + 1) & index->slotMask;
+    }
+    return -1;
+}
+
+bool buildPrivateAccountIndex(struct AccountIndex *index, struct BankAccount *accounts, int count) {
+    memset(index, 0, sizeof(*index));
+    index->accounts = accounts;
+    index->count = count;
+    if (!buildIndex(index)) {
+        clearEntry(index);
+        return false;
+    }
+    return true;
+}
+
+void freePrivateAccountIndex(struct AccountIndex *index) {
+    clearEntry(index);
+}
+
+// Put a newly appended account into a built index, growing or switching the table when needed.
+static void addToIndex(struct AccountIndex *index, int accountNumber, int position) {
+    int low = accountNumber < index->minNumber ? accountNumber : index->minNumber;
+    int high = accountNumber > index->maxNumber ? accountNumber : index->maxNumber;
+    if (position == 0) {
+        low = high = accountNumber;
+    }
+    index->minNumber = low;
+    index->maxNumber = high;
+    if (index->strategy == INDEX_DIRECT) {
+        uint32_t offset = (uint32_t)accountNumber - (uint32_t)index->directBase;
+        if (offset < index->directSize) {
+            if (index->direct[offset] < 0) {
+                index->direct[offset] = position;
+            }
+            return;
+        }
+        // Outside the table: stay direct while the numbers are still dense, doubling the table so
+        // that appending increasing numbers costs O(1) amortised; switch to hashing otherwise.
+        long long range = (long long)high - low + 1;
+        if (range <= (long long)DIRECT_INDEX_MAX_SPREAD * index->count && range <= INT32_MAX) {
+            long long size = 2LL * index->directSize > range ? 2LL * index->directSize : range;
+            if (size <= (long long)DIRECT_INDEX_MAX_SPREAD * index->count &&
+                (long long)low + size - 1 <= INT32_MAX && buildDirect(index, low, (uint32_t)size)) {
+                return;
+            }
+            if (buildDirect(index, low, (uint32_t)range)) {
+                return;
+            }
+        }
+        index->built = buildHash(index, index->count);
+        return;
+    }
+    // Keep the load factor at or below 1/2.
+    if (2L * index->count > (long)index->slotMask + 1) {
+        index->built = buildHash(index, index->count);
+    } else {
+        insertSlot(index, accountNumber, position);
+    }
+}
+
+void printAccountIndexInfo(struct BankAccount *accounts, int count) {
+    struct AccountIndex *index = registryEntry(accounts);
+    if (index == NULL || index->count != count) {
+        printf("Account lookup: linear scan over %d accounts\n", count);
+    } else if (index->built) {
+        printIndexInfo(index);
+    } else {
+        // Building it here would cost the O(1) open of a snapshot; the first lookup prints it.
+        index->announce = true;
+    }
+}
+
+struct BankAccount* addAccount(struct BankAccount **accounts, int *count, const struct BankAccount *account) {
+    struct AccountIndex *index = registryEntry(*accounts);
+    if (index == NULL || index->count != *count) {
+        // Not a loader-managed array: just grow it.
+        struct BankAccount *grown = realloc(*accounts, (*count + 1) * sizeof(struct BankAccount));
+        if (grown == NULL) {
+            return NULL;
+        }
+        *accounts = grown;
+        grown[*count] = *account;
+        return &grown[(*count)++];
+    }
+    if (*count == index->capacity || index->capacity == 0) {
+        int capacity = *count < 8 ? 16 : 2 * *count;
+        struct BankAccount *grown;
+        if (index->capacity > 0) {
+            grown = realloc(*accounts, capacity * sizeof(struct BankAccount));
+        } else {
+            // A mapped snapshot can not grow in place; move the records to the heap.
+            grown = malloc(capacity * sizeof(struct BankAccount));
+            if (grown != NULL) {
+                memcpy(grown, *accounts, *count * sizeof(struct BankAccount));
+            }
+        }
+        if (grown == NULL) {
+            return NULL;
+        }
+        index->accounts = grown;
+        index->capacity = capacity;
+        *accounts = grown;
+    }
+    (*accounts)[*count] = *account;
+    index->count = ++(*count);
+    if (index->built) {
+        addToIndex(index, account->accountNumber, index->count - 1);
+    }
+    // A new account has never been saved.
+    markAccountDirty(&(*accounts)[*count - 1]);
+    return &(*accounts)[*count - 1];
+}
+
+void markAccountDirty(const struct BankAccount *account) {
+    struct AccountIndex *index = NULL;
+    for (int i = 0; i < MAX_INDEXED_TABLES && index == NULL; i++) {
+        if (registry[i].accounts != NULL && account >= registry[i].accounts &&
+            account < registry[i].accounts + registry[i].count) {
+            index = &registry[i];
+        }
+    }
+    if (index == NULL) {
+        return;  // Not a registered array: it is always saved in full.
+    }
+    int position = (int)(account - index->accounts);
+    uint8_t bit = (uint8_t)(1u << (position % 8));
+    // Already listed: the common case for an account in use.
+    if (position < index->dirtyBitsCapacity &&
+        (atomic_load_explicit(&index->dirtyBits[position / 8], memory_order_relaxed) & bit)) {
+        return;
+    }
+    pthread_mutex_lock(&dirtyLock);
+    if (position >= index->dirtyBitsCapacity) {
+        int capacity = index->count > 2 * index->dirtyBitsCapacity ? index->count : 2 * index->dirtyBitsCapacity;
+        size_t oldBytes = index->dirtyBits ? (size_t)index->dirtyBitsCapacity / 8 + 1 : 0;
+        size_t newBytes = (size_t)capacity / 8 + 1;
+        _Atomic uint8_t *bits = realloc((void *)index->dirtyBits, newBytes);
+        if (bits == NULL) {
+            pthread_mutex_unlock(&dirtyLock);
+            return;
+        }
+        memset((void *)(bits + oldBytes), 0, newBytes - oldBytes);
+        index->dirtyBits = bits;
+        index->dirtyBitsCapacity = capacity;
+    }
+    if (index->dirtyBits[position / 8] & bit) {
+        pthread_mutex_unlock(&dirtyLock);
+        return;
+    }
+    if (index->dirtyCount == index->dirtyCapacity) {
+        int capacity = index->dirtyCapacity ? 2 * index->dirtyCapacity : 16;
+        int *grown = realloc(index->dirty, capacity * sizeof(int));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&dirtyLock);
+            return;
+        }
+        index->dirty = grown;
+        index->dirtyCapacity = capacity;
+    }
+    // Other threads may test or set the other bits of this byte at the same time.
+    atomic_fetch_or(&index->dirtyBits[position / 8], bit);
+    index->dirty[index->dirtyCount++] = position;
+    pthread_mutex_unlock(&dirtyLock);
+}
+
+const int* dirtyAccounts(const struct BankAccount *accounts, int *dirtyCount) {
+    struct AccountIndex *index = registryEntry(accounts);
+    *dirtyCount = index ? index->dirtyCount : 0;
+    return index ? index->dirty : NULL;
+}
+
+int* takeDirtyAccounts(const struct BankAccount *accounts, int *dirtyCount) {
+    *dirtyCount = 0;
+    struct AccountIndex *index = registryEntry(accounts);
+    if (index == NULL) {
+        return NULL;
+    }
+    // Only the listed positions have bits set, so clearing stays proportional to the changes.
+    // Both happen under the lock, so a mark made from here on starts the new list.
+    pthread_mutex_lock(&dirtyLock);
+    int *dirty = index->dirty;
+    *dirtyCount = index->dirtyCount;
+    for (int i = 0; i < index->dirtyCount; i++) {
+        index->dirtyBits[index->dirty[i] / 8] = 0;
+    }
+    index->dirty = NULL;
+    index->dirtyCount = 0;
+    index->dirtyCapacity = 0;
+    pthread_mutex_unlock(&dirtyLock);
+    return dirty;
+}
+
+void restoreDirtyAccounts(const struct BankAccount *accounts, int *dirty, int dirtyCount) {
+    for (int i = 0; i < dirtyCount; i++) {
+        markAccountDirty(&accounts[dirty[i]]);
+    }
+    free(dirty);
+}
+
+void clearDirtyAccounts(const struct BankAccount *accounts) {
+    int dirtyCount;
+    free(takeDirtyAccounts(accounts, &dirtyCount));
+}
+
+const char* accountsSnapshotFile(const struct BankAccount *accounts) {
+    struct AccountIndex *index = registryEntry(accounts);
+    return index ? index->snapshotFile : NULL;
+}
+
+void setAccountsSnapshotFile(const struct BankAccount *accounts, const char *filename) {
+    struct AccountIndex *index = registryEntry(accounts);
+    if (index != NULL) {
+        free(index->snapshotFile);
+        index->snapshotFile = filename ? strdup(filename) : NULL;
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef PROGRAMMING_ASSIGNMENT_ACCOUNT_INDEX_H
+#define PROGRAMMING_ASSIGNMENT_ACCOUNT_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "algorithm.h"
+
+// How many account arrays can be indexed at the same time; further arrays use linear search.
+#define MAX_INDEXED_TABLES 16
+
+// One slot of the open-addressing table: the key is stored next to the position so that
+// probing never has to touch the account array.
+struct IndexSlot {
+    int accountNumber;
+    int position;           // -1 for an empty slot
+};
+
+// A direct table is used when the account numbers span at most this many slots per account.
+// At 4 bytes per direct slot vs 16-32 bytes per account in the hash table, it is never bigger.
+#define DIRECT_INDEX_MAX_SPREAD 4
+
+enum IndexStrategy {
+    INDEX_HASH,     // Open-addressing hash table
+    INDEX_DIRECT    // direct[accountNumber - directBase] holds the position
+};
+
+// Index from accountNumber to position, kept for every array handed out by a loader.
+struct AccountIndex {
+    struct BankAccount *accounts;   // Array the index belongs to; NULL for a free registry entry
+    int count;
+    int capacity;                   // Allocated records if the array came from malloc, 0 if it is mapped
+    struct BankAccount *mapping;    // Snapshot mapping the array came from, released with it
+    int mappingCount;
+    _Atomic bool built;             // The table is built on the first lookup
+    bool announce;                  // Print the strategy once the table is built
+    enum IndexStrategy strategy;
+    int minNumber;                  // Range of account numbers in the array
+    int maxNumber;
+    // INDEX_HASH
+    struct IndexSlot *slots;
+    uint32_t slotMask;
+    int shift;
+    // INDEX_DIRECT
+    int *direct;                    // -1 for numbers without an account
+    int directBase;
+    uint32_t directSize;
+    // Positions changed since the last save, in the order they were first changed
+    int *dirty;
+    int dirtyCount;
+    int dirtyCapacity;
+    _Atomic uint8_t *dirtyBits;     // One bit per position, so each position is listed once
+    int dirtyBitsCapacity;          // Positions covered by dirtyBits
+    char *snapshotFile;             // Snapshot whose records match this array position by position
+};
+
+// Called by the loaders: remember accounts so that findAccount() can use a hash index for it.
+// capacity is the number of records malloc'd for the array, or 0 for a mapped snapshot.
+// Returns false (with an error if all MAX_INDEXED_TABLES entries are taken) if accounts is not
+// registered. findAccount() then scans it, its changes are not tracked, and releaseAccounts()
+// just free()s it, so a mapped snapshot must not be left unregistered.
+bool registerAccounts(struct BankAccount *accounts, int count, int capacity);
+// Drop the index of accounts and free (or unmap) the array itself.
+void releaseAccounts(struct BankAccount *accounts);
+// Index of a registered array (building it if needed), or NULL if accounts/count is not registered.
+struct AccountIndex* accountIndexFor(struct BankAccount *accounts, int count);
+// Position of accountNumber in the indexed array, or -1.
+int accountIndexLookup(const struct AccountIndex *index, int accountNumber);
+// Build an index over an array that is not registered and owned by the caller (e.g. a shard of
+// the sharded engine): findAccount() and markAccountDirty() do not know it, and it takes no
+// registry entry. Returns false if it can not be allocated.
+bool buildPrivateAccountIndex(struct AccountIndex *index, struct BankAccount *accounts, int count);
+void freePrivateAccountIndex(struct AccountIndex *index);
+// Print which lookup strategy accounts uses and what it costs; used by the front-ends at startup.
+// A table that is not built yet is not built for this: it is described when the first lookup builds it.
+void printAccountIndexInfo(struct BankAccount *accounts, int count);
+// Record that account (an element of a registered array) has changed and must be saved.
+// Safe to call from several threads at once (see account_lock.h); registering, adding and
+// releasing accounts is not.
+void markAccountDirty(const struct BankAccount *account);
+// Positions changed since the last save; *dirtyCount is 0 for an unregistered array. The list
+// belongs to accounts and grows with markAccountDirty(): a save uses takeDirtyAccounts() instead.
+const int* dirtyAccounts(const struct BankAccount *accounts, int *dirtyCount);
+// Take the list of changed positions away from accounts (the caller frees it; NULL if empty) and
+// start a new one, all under the lock markAccountDirty() takes: an account changed while the
+// caller saves is listed again, for the next save. If the save fails, hand the list back with
+// restoreDirtyAccounts(), which marks its positions again and frees it.
+int* takeDirtyAccounts(const struct BankAccount *accounts, int *dirtyCount);
+void restoreDirtyAccounts(const struct BankAccount *accounts, int *dirty, int dirtyCount);
+void clearDirtyAccounts(const struct BankAccount *accounts);
+// Snapshot file that accounts was loaded from or last written to in full (NULL if none).
+const char* accountsSnapshotFile(const struct BankAccount *accounts);
+void setAccountsSnapshotFile(const struct BankAccount *accounts, const char *filename);
+// Append a copy of account to *accounts (which may move) and add it to the index.
+struct BankAccount* addAccount(struct BankAccount **accounts, int *count, const struct BankAccount *account);
+
+#endif // PROGRAMMING_ASSIGNMENT_ACCOUNT_INDEX_H
@@ -0,0 +1,64 @@
+//
+// Striped per-account locks for the thread-safe engine mode.
+//
+#include <stdint.h>
+#include <stdalign.h>
+#include <pthread.h>
+#include "account_lock.h"
+
+// One stripe per cache line, so that threads locking neighbouring stripes do not share a line.
+struct LockStripe {
+    alignas(64) pthread_mutex_t mutex;
+};
+
+static struct LockStripe stripes[ACCOUNT_LOCK_STRIPES];
+static bool lockingEnabled;
+static bool atomicBalances;
+static bool stripesInitialized;
+
+void setAccountLocking(bool enabled) {
+    if (enabled && !stripesInitialized) {
+        for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) {
+            pthread_mutex_init(&stripes[i].mutex, NULL);
+        }
+        stripesInitialized = true;
+    }
+    lockingEnabled = enabled;
+}
+
+bool accountLockingEnabled() {
+    return lockingEnabled;
+}
+
+void setAtomicBalances(bool enabled) {
+    atomicBalances = enabled;
+}
+
+bool atomicBalancesEnabled() {
+    return atomicBalances;
+}
+
+int accountLockStripe(int accountNumber) {
+    // Fibonacci hashing: consecutive card numbers land on different stripes.
+    return (int)(((uint32_t)accountNumber * 2654435761u) >> (32 - ACCOUNT_LOCK_STRIPE_BITS));
+}
+
+void lockAccountStripe(int stripe) {
+    if (lockingEnabled) {
+        pthread_mutex_lock(&stripes[stripe].mutex);
+    }
+}
+
+void unlockAccountStripe(int stripe) {
+    if (lockingEnabled) {
+        pthread_mutex_unlock(&stripes[stripe].mutex);
+    }
+}
+
+void lockAccount(const struct BankAccount *account) {
+    lockAccountStripe(accountLockStripe(account->accountNumber));
+}
+
+void unlockAccount(const struct BankAccount *account) {
+    unlockAccountStripe(accountLockStripe(account->accountNumber));
+}
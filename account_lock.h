@@ -0,0 +1,38 @@
+#ifndef PROGRAMMING_ASSIGNMENT_ACCOUNT_LOCK_H
+#define PROGRAMMING_ASSIGNMENT_ACCOUNT_LOCK_H
+
+#include <stdbool.h>
+#include "algorithm.h"
+
+// Thread-safe engine mode. With account locking enabled, every operation of algorithm.h holds the
+// lock of its account while it reads or changes it (and while the change is journaled), so any
+// number of threads can serve sessions at once. Locks come from a fixed table of stripes picked by
+// account number: two cards only contend when their numbers hash to the same stripe.
+// Without it (the default) the engine assumes one caller at a time and takes no locks.
+//
+// With atomic balances enabled as well, withdrawals, deposits and balance inquiries take no account
+// lock: the balance is changed with a compare-and-swap loop that enforces the insufficient-funds
+// rule (see debitAccount()). Deposits are added by the journal once they are recorded (see
+// journalCredits()), so a failed one never has to be taken back from a balance someone may have
+// withdrawn from meanwhile. PIN changes and blocking still use the account locks.
+
+// Stripes in the lock table.
+#define ACCOUNT_LOCK_STRIPE_BITS 12
+#define ACCOUNT_LOCK_STRIPES (1 << ACCOUNT_LOCK_STRIPE_BITS)
+
+// Turn locking on or off. Only while no operation is running.
+void setAccountLocking(bool enabled);
+bool accountLockingEnabled();
+// Turn atomic balances on or off. Only while no operation is running.
+void setAtomicBalances(bool enabled);
+bool atomicBalancesEnabled();
+// Lock or unlock the stripe of account; no-ops while locking is off.
+void lockAccount(const struct BankAccount *account);
+void unlockAccount(const struct BankAccount *account);
+// The stripe of an account number, for callers that lock several accounts: they must take the
+// stripes in increasing order (and each one once) so that they can not deadlock.
+int accountLockStripe(int accountNumber);
+void lockAccountStripe(int stripe);
+void unlockAccountStripe(int stripe);
+
+#endif // PROGRAMMING_ASSIGNMENT_ACCOUNT_LOCK_H
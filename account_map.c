@@ -0,0 +1,115 @@
+//
+// Zero-copy loading of accounts.csv through mmap.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "account_map.h"
+
+struct AccountMap* mapAccountsFromCSV(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open %s\n", filename);
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        printf("Error: Could not map %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)info.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping keeps the file alive.
+    if (data == MAP_FAILED) {
+        printf("Error: Could not map %s\n", filename);
+        return NULL;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    struct CsvLoadState state;
+    csvLoadStateInitViews(&state, filename, data);
+    size_t offset = 0;
+    while (offset < size) {
+        size_t window = size - offset < CSV_BLOCK_SIZE ? size - offset : CSV_BLOCK_SIZE;
+        bool final = (offset + window == size);
+        size_t consumed = csvParseBlock(&state, data + offset, window, final);
+        if (consumed == 0) {
+            // A single line longer than the window: hand it to the parser on its own.
+            const char *newline = memchr(data + offset, '\n', size - offset);
+            size_t lineLength = newline ? (size_t)(newline - (data + offset)) + 1 : size - offset;
+            consumed = csvParseBlock(&state, data + offset, lineLength, true);
+        }
+        // Parsed pages are only needed again for the names; give them back until then so
+        // a multi-GB file does not stay resident.
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t start = offset / page * page;
+        size_t end = (offset + consumed) / page * page;
+        if (end > start) {
+            madvise((void *)(data + start), end - start, MADV_DONTNEED);
+        }
+        offset += consumed;
+    }
+    madvise((void *)data, size, MADV_RANDOM);
+
+    struct AccountMap *map = malloc(sizeof(struct AccountMap));
+    map->data = data;
+    map->size = size;
+    map->views = state.views;
+    map->count = state.count;
+    // calloc'd pages stay untouched (and unbacked) until a record is actually modified.
+    map->modified = calloc(state.count > 0 ? state.count : 1, sizeof(struct BankAccount *));
+    return map;
+}
+
+void unmapAccounts(struct AccountMap *map) {
+    if (map == NULL) {
+        return;
+    }
+    for (int i = 0; i < map->count; i++) {
+        free(map->modified[i]);
+    }
+    free(map->modified);
+    free(map->views);
+    munmap((void *)map->data, map->size);
+    free(map);
+}
+
+int accountMapFind(const struct AccountMap *map, int accountNumber) {
+    for (int i = 0; i < map->count; i++) {
+        if (map->views[i].accountNumber == accountNumber) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void accountMapRead(const struct AccountMap *map, int i, struct BankAccount *account) {
+    if (map->modified[i] != NULL) {
+        *account = *map->modified[i];
+        return;
+    }
+    const struct AccountView *view = &map->views[i];
+    account->accountNumber = view->accountNumber;
+    memcpy(account->accountHolder, map->data + view->nameOffset, view->nameLength);
+    account->accountHolder[view->nameLength] = '\0';
+    account->balance = view->balance;
+    account->pinCode = view->pinCode;
+    account->blocked = view->blocked;
+}
+
+struct BankAccount* accountMapModify(struct AccountMap *map, int i) {
+    if (map->modified[i] == NULL) {
+        struct BankAccount *account = malloc(sizeof(struct BankAccount));
+        if (account == NULL) {
+            return NULL;
+        }
+        accountMapRead(map, i, account);
+        map->modified[i] = account;
+    }
+    return map->modified[i];
+}
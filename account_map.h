@@ -0,0 +1,30 @@
+#ifndef PROGRAMMING_ASSIGNMENT_ACCOUNT_MAP_H
+#define PROGRAMMING_ASSIGNMENT_ACCOUNT_MAP_H
+
+#include <stddef.h>
+#include "algorithm.h"
+#include "csv_parser.h"
+
+// accounts.csv mapped read-only into memory and parsed in place.
+// Holder names stay in the mapping as (offset, length) views; a record is copied into a
+// struct BankAccount only the first time it is handed out for modification.
+struct AccountMap {
+    const char *data;                 // The mapped file
+    size_t size;
+    struct AccountView *views;        // One per account, in file order
+    struct BankAccount **modified;    // NULL until the record has been handed out by accountMapModify
+    int count;
+};
+
+// Map and parse filename. Returns NULL if the file can not be opened or mapped.
+struct AccountMap* mapAccountsFromCSV(const char *filename);
+void unmapAccounts(struct AccountMap *map);
+
+// Index of the account with the given number, or -1.
+int accountMapFind(const struct AccountMap *map, int accountNumber);
+// Copy the current state of record i into *account.
+void accountMapRead(const struct AccountMap *map, int i, struct BankAccount *account);
+// Writable record i, materialised from the mapping on first use. Pass it to withdraw(), deposit(), ...
+struct BankAccount* accountMapModify(struct AccountMap *map, int i);
+
+#endif // PROGRAMMING_ASSIGNMENT_ACCOUNT_MAP_H
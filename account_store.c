@@ -0,0 +1,288 @@
+//
+// Hot/cold split account table: parallel arrays for the fields operations touch, an arena for names.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "account_store.h"
+
+#define HOLDER_MAX (sizeof(((struct BankAccount *)0)->accountHolder) - 1)
+
+// Fibonacci hashing, as in account_index.c.
+static uint32_t slotFor(const struct AccountStore *store, int accountNumber) {
+    return ((uint32_t)accountNumber * 2654435769u) >> store->shift;
+}
+
+static void insertSlot(struct AccountStore *store, int accountNumber, int position) {
+    uint32_t slot = slotFor(store, accountNumber);
+    while (store->slots[slot].position >= 0) {
+        if (store->slots[slot].accountNumber == accountNumber) {
+            return;
+        }
+        slot = (slot + 1) & store->slotMask;
+    }
+    store->slots[slot].accountNumber = accountNumber;
+    store->slots[slot].position = position;
+}
+
+// Rebuild the index with room for at least `records` keys at a load factor of at most 1/2.
+static bool buildSlots(struct AccountStore *store, int records) {
+    int bits = 4;
+    while ((1L << bits) < 2L * records) {
+        bits++;
+    }
+    struct IndexSlot *slots = malloc(sizeof(struct IndexSlot) << bits);
+    if (slots == NULL) {
+        return false;
+    }
+    memset(slots, 0xff, sizeof(struct IndexSlot) << bits);  // position == -1 everywhere
+    free(store->slots);
+    store->slots = slots;
+    store->slotMask = (1u << bits) - 1;
+    store->shift = 32 - bits;
+    for (int i = 0; i < store->count; i++) {
+        insertSlot(store, store->numbers[i], i);
+    }
+    return true;
+}
+
+// Make room for `records` accounts in every hot array.
+static bool reserveAccounts(struct AccountStore *store, int records) {
+    if (records <= store->capacity) {
+        return true;
+    }
+    int capacity = store->capacity > 0 ? store->capacity : 16;
+    while (capacity < records) {
+        capacity *= 2;
+    }
+    int *numbers = realloc(store->numbers, capacity * sizeof(int));
+    if (numbers != NULL) store->numbers = numbers;
+    Money *balances = realloc(store->balances, capacity * sizeof(Money));
+    if (balances != NULL) store->balances = balances;
+    int *pins = realloc(store->pins, capacity * sizeof(int));
+    if (pins != NULL) store->pins = pins;
+    uint8_t *blocked = realloc(store->blocked, capacity);
+    if (blocked != NULL) store->blocked = blocked;
+    uint32_t *offsets = realloc(store->nameOffsets, capacity * sizeof(uint32_t));
+    if (offsets != NULL) store->nameOffsets = offsets;
+    if (numbers == NULL || balances == NULL || pins == NULL || blocked == NULL || offsets == NULL) {
+        return false;
+    }
+    store->capacity = capacity;
+    return true;
+}
+
+// Copy holder (at most HOLDER_MAX bytes of it) to the end of the arena; returns its offset or -1.
+static long appendName(struct AccountStore *store, const char *holder) {
+    size_t length = strnlen(holder, HOLDER_MAX);
+    if (store->namesSize + length + 1 > store->namesCapacity) {
+        size_t capacity = store->namesCapacity > 0 ? store->namesCapacity : 1024;
+        while (capacity < store->namesSize + length + 1) {
+            capacity *= 2;
+        }
+        if (capacity > UINT32_MAX) {
+            return -1;
+        }
+        char *names = realloc(store->names, capacity);
+        if (names == NULL) {
+            return -1;
+        }
+        store->names = names;
+        store->namesCapacity = capacity;
+    }
+    long offset = (long)store->namesSize;
+    memcpy(store->names + offset, holder, length);
+    store->names[offset + length] = '\0';
+    store->namesSize += length + 1;
+    return offset;
+}
+
+struct AccountStore* createAccountStore(const struct BankAccount *accounts, int count) {
+    struct AccountStore *store = calloc(1, sizeof(struct AccountStore));
+    if (store == NULL) {
+        return NULL;
+    }
+    if (!reserveAccounts(store, count > 0 ? count : 1) || !buildSlots(store, count)) {
+        freeAccountStore(store);
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        if (storeAddAccount(store, &accounts[i]) < 0) {
+            freeAccountStore(store);
+            return NULL;
+        }
+    }
+    return store;
+}
+
+bool refreshAccountStore(struct AccountStore *store, const struct BankAccount *accounts, int count) {
+    if (count < store->count) {
+        // Accounts were removed from the array: start over.
+        store->count = 0;
+        store->namesSize = 0;
+        if (!buildSlots(store, count)) {
+            return false;
+        }
+    }
+    bool renumbered = false;
+    for (int i = 0; i < store->count; i++) {
+        const struct BankAccount *account = &accounts[i];
+        if (store->numbers[i] != account->accountNumber) {
+            store->numbers[i] = account->accountNumber;
+            renumbered = true;
+        }
+        store->balances[i] = accountBalance(account);
+        store->pins[i] = account->pinCode;
+        store->blocked[i] = account->blocked ? 1 : 0;
+        if (strncmp(storeHolder(store, i), account->accountHolder, HOLDER_MAX) != 0 &&
+            !storeSetHolder(store, i, account->accountHolder)) {
+            return false;
+        }
+    }
+    if (renumbered && !buildSlots(store, store->count)) {
+        return false;
+    }
+    for (int i = store->count; i < count; i++) {
+        if (storeAddAccount(store, &accounts[i]) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void freeAccountStore(struct AccountStore *store) {
+    if (store == NULL) {
+        return;
+    }
+    free(store->numbers);
+    free(store->balances);
+    free(store->pins);
+    free(store->blocked);
+    free(store->nameOffsets);
+    free(store->names);
+    free(store->slots);
+    free(store);
+}
+
+int storeAddAccount(struct AccountStore *store, const struct BankAccount *account) {
+    int position = store->count;
+    if (!reserveAccounts(store, position + 1)) {
+        return -1;
+    }
+    // Grow the index before it passes a load factor of 1/2.
+    if (2L * (position + 1) > (long)store->slotMask + 1 && !buildSlots(store, 2 * (position + 1))) {
+        return -1;
+    }
+    long offset = appendName(store, account->accountHolder);
+    if (offset < 0) {
+        return -1;
+    }
+    store->numbers[position] = account->accountNumber;
+    store->balances[position] = accountBalance(account);
+    store->pins[position] = account->pinCode;
+    store->blocked[position] = account->blocked ? 1 : 0;
+    store->nameOffsets[position] = (uint32_t)offset;
+    store->count++;
+    insertSlot(store, account->accountNumber, position);
+    return position;
+}
+
+int storeFindAccount(const struct AccountStore *store, int accountNumber) {
+    uint32_t slot = slotFor(store, accountNumber);
+    while (store->slots[slot].position >= 0) {
+        if (store->slots[slot].accountNumber == accountNumber) {
+            return store->slots[slot].position;
+        }
+        slot = (slot + 1) & store->slotMask;
+    }
+    return -1;
+}
+
+int storeAccountNumber(const struct AccountStore *store, int position) {
+    return store->numbers[position];
+}
+
+Money storeBalance(const struct AccountStore *store, int position) {
+    return store->balances[position];
+}
+
+void storeSetBalance(struct AccountStore *store, int position, Money balance) {
+    store->balances[position] = balance;
+}
+
+int storePin(const struct AccountStore *store, int position) {
+    return store->pins[position];
+}
+
+void storeSetPin(struct AccountStore *store, int position, int pinCode) {
+    store->pins[position] = pinCode;
+}
+
+bool storeBlocked(const struct AccountStore *store, int position) {
+    return store->blocked[position] != 0;
+}
+
+void storeSetBlocked(struct AccountStore *store, int position, bool blocked) {
+    store->blocked[position] = blocked ? 1 : 0;
+}
+
+const char* storeHolder(const struct AccountStore *store, int position) {
+    return store->names + store->nameOffsets[position];
+}
+
+bool storeSetHolder(struct AccountStore *store, int position, const char *holder) {
+    char *current = store->names + store->nameOffsets[position];
+    size_t length = strnlen(holder, HOLDER_MAX);
+    // A name that fits where the old one was is written in place.
+    if (length <= strlen(current)) {
+        memcpy(current, holder, length);
+        current[length] = '\0';
+        return true;
+    }
+    long offset = appendName(store, holder);
+    if (offset < 0) {
+        return false;
+    }
+    store->nameOffsets[position] = (uint32_t)offset;
+    return true;
+}
+
+void storeGetAccount(const struct AccountStore *store, int position, struct BankAccount *account) {
+    memset(account, 0, sizeof(*account));
+    account->accountNumber = store->numbers[position];
+    strcpy(account->accountHolder, storeHolder(store, position));
+    account->balance = store->balances[position];
+    account->pinCode = store->pins[position];
+    account->blocked = store->blocked[position] != 0;
+}
+
+bool storePutAccount(struct AccountStore *store, int position, const struct BankAccount *account) {
+    if (strncmp(storeHolder(store, position), account->accountHolder, HOLDER_MAX) != 0 &&
+        !storeSetHolder(store, position, account->accountHolder)) {
+        return false;
+    }
+    // The index is keyed by number, so a renumbered account is found under its new number.
+    if (store->numbers[position] != account->accountNumber) {
+        store->numbers[position] = account->accountNumber;
+        if (!buildSlots(store, store->count)) {
+            return false;
+        }
+    }
+    store->balances[position] = account->balance;
+    store->pins[position] = account->pinCode;
+    store->blocked[position] = account->blocked ? 1 : 0;
+    return true;
+}
+
+struct BankAccount* storeToAccounts(const struct AccountStore *store, int *count) {
+    struct BankAccount *accounts = malloc((store->count > 0 ? store->count : 1) * sizeof(struct BankAccount));
+    if (accounts == NULL) {
+        *count = 0;
+        return NULL;
+    }
+    for (int i = 0; i < store->count; i++) {
+        storeGetAccount(store, i, &accounts[i]);
+    }
+    *count = store->count;
+    return accounts;
+}
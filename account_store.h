@@ -0,0 +1,71 @@
+#ifndef PROGRAMMING_ASSIGNMENT_ACCOUNT_STORE_H
+#define PROGRAMMING_ASSIGNMENT_ACCOUNT_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "algorithm.h"
+#include "account_index.h"
+
+// A copy of the account table for reporting (see report.h), laid out by how often the fields are
+// read. struct BankAccount is 72 bytes, 50 of them the holder name that only receipts and the
+// front ends read. Here the fields a report scans live in dense parallel arrays (a cache line holds
+// 8 balances or 16 account numbers), and the names sit in a separate arena that scans never touch.
+//
+// The engine's own layout is unchanged: withdrawals, deposits, lookups, the journal, snapshots and
+// the front ends all work on the struct BankAccount array, and nothing writes a store back into it. Build one from the live accounts with
+// createAccountStore() and bring it up to date with refreshAccountStore() before each report.
+// The setters only change the copy.
+struct AccountStore {
+    int count;
+    int capacity;                   // Records the hot arrays have room for
+    // Hot: position i of every array belongs to the same account
+    int *numbers;
+    Money *balances;                // Minor units (pence)
+    int *pins;
+    uint8_t *blocked;               // 0 or 1
+    // Cold: NUL-terminated names one after another; account i's starts at names + nameOffsets[i]
+    uint32_t *nameOffsets;
+    char *names;
+    size_t namesSize;
+    size_t namesCapacity;
+    // Open-addressing index from account number to position (same scheme as account_index.c)
+    struct IndexSlot *slots;
+    uint32_t slotMask;
+    int shift;
+};
+
+// Copy accounts[count] into a new store; NULL if out of memory. Balances are read with
+// accountBalance(), so this can run alongside sessions in atomic balance mode (each balance is
+// then as of when it was read, not all of them as of one instant).
+struct AccountStore* createAccountStore(const struct BankAccount *accounts, int count);
+// Copy accounts[count] over a store made from the same array: every field of the accounts it has,
+// then the accounts appended to the array since. The index is only rebuilt if numbers changed, and
+// the arena only grows for names that changed. Returns false if out of memory (the store is then
+// partly refreshed; free it or refresh it again).
+bool refreshAccountStore(struct AccountStore *store, const struct BankAccount *accounts, int count);
+void freeAccountStore(struct AccountStore *store);
+// Append a copy of account; returns its position, or -1 if out of memory.
+int storeAddAccount(struct AccountStore *store, const struct BankAccount *account);
+// Position of accountNumber in the store, or -1. Like findAccount(), the first account with a number wins.
+int storeFindAccount(const struct AccountStore *store, int accountNumber);
+
+// Field accessors by position.
+int storeAccountNumber(const struct AccountStore *store, int position);
+Money storeBalance(const struct AccountStore *store, int position);
+void storeSetBalance(struct AccountStore *store, int position, Money balance);
+int storePin(const struct AccountStore *store, int position);
+void storeSetPin(struct AccountStore *store, int position, int pinCode);
+bool storeBlocked(const struct AccountStore *store, int position);
+void storeSetBlocked(struct AccountStore *store, int position, bool blocked);
+const char* storeHolder(const struct AccountStore *store, int position);
+// Replace the holder name (truncated like accountHolder); the old name's bytes stay in the arena
+// until the store is freed. Returns false if out of memory.
+bool storeSetHolder(struct AccountStore *store, int position, const char *holder);
+
+// For code written against struct BankAccount: copy position out to *account, or write it back.
+void storeGetAccount(const struct AccountStore *store, int position, struct BankAccount *account);
+bool storePutAccount(struct AccountStore *store, int position, const struct BankAccount *account);
+// A malloc'd struct BankAccount array with every account of the store, in store order.
+struct BankAccount* storeToAccounts(const struct AccountStore *store, int *count);
+
+#endif // PROGRAMMING_ASSIGNMENT_ACCOUNT_STORE_H
@@ -6,85 +6,291 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>  // For date/time
+#include "algorithm.h"
+#include "csv_parser.h"
+#include "account_index.h"
+#include "account_lock.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "transaction_log.h"
 
+bool checkPin(struct BankAccount *account, int enteredPin) {
+    lockAccount(account);
+    bool matches = enteredPin == account->pinCode;
+    unlockAccount(account);
+    return matches;
+}
 
-struct BankAccount {
-    int accountNumber;
-    char accountHolder[50];
-    double balance;
-    int pinCode;
-    bool blocked;
-};
+bool checkBlocked(struct BankAccount *account) {
+    lockAccount(account);
+    bool blocked = account->blocked;
+    unlockAccount(account);
+    return blocked;
+}
 
-bool checkPin(struct BankAccount *account, int enteredPin) {
-    if (enteredPin == account->pinCode) {
-        return true;
+// Retain the card after too many wrong PINs.
+void blockAccount(struct BankAccount *account) {
+    lockAccount(account);
+    account->blocked = true;
+    journalAccount(account);
+    markAccountDirty(account);
+    unlockAccount(account);
+}
+
+// Write prefix followed by balance ("£1,234.60") into message, without going through printf.
+static void balanceMessage(char *message, size_t size, const char *prefix, Money balance) {
+    if (message == NULL || size == 0) {
+        return;
     }
-    return false;
+    size_t length = strnlen(prefix, size - 1);
+    memcpy(message, prefix, length);
+    formatMoneyDisplay(balance, message + length, size - length);
 }
 
-bool checkBlocked(struct BankAccount *account) {
-    return account->blocked;
+// Copy text into message, if one is wanted, truncating it to size.
+static void copyMessage(const char *text, char *message, size_t size) {
+    if (message == NULL || size == 0) {
+        return;
+    }
+    size_t length = strnlen(text, size - 1);
+    memcpy(message, text, length);
+    message[length] = '\0';
+}
+
+// Put the text of status into message and return status.
+static enum OperationStatus report(enum OperationStatus status, char *message, size_t size) {
+    copyMessage(operationStatusText(status), message, size);
+    return status;
+}
+
+const char* operationStatusText(enum OperationStatus status) {
+    switch (status) {
+        case STATUS_OK:
+            return "Success!";
+        case STATUS_INVALID_WITHDRAWAL:
+            return "Invalid withdrawal amount!";
+        case STATUS_INVALID_DEPOSIT:
+            return "Invalid deposit amount!";
+        case STATUS_NOT_MULTIPLE_OF_5:
+            return "Amount must be a multiple of 5, 10 or 20!";
+        case STATUS_INSUFFICIENT_FUNDS:
+            return "Insufficient funds!";
+        case STATUS_PINS_DIFFER:
+            return "Error: PINs do not match!";
+        case STATUS_INVALID_PIN:
+            return "Error: PIN must be exactly 4 digits!";
+        case STATUS_NOT_RECORDED:
+            return "Error: Could not record the transaction!";
+        case STATUS_UNKNOWN_ACCOUNT:
+            return "Error: Unknown account!";
+        case STATUS_UNSUPPORTED_OPERATION:
+            return "Error: Operation not supported!";
+    }
+    return "Unknown error!";
+}
+
+// In atomic balance mode balances are read and changed with the __atomic builtins, which work on
+// the plain Money field, so struct BankAccount and the snapshot format stay as they are.
+Money accountBalance(const struct BankAccount *account) {
+    if (atomicBalancesEnabled()) {
+        return __atomic_load_n(&account->balance, __ATOMIC_ACQUIRE);
+    }
+    return account->balance;
+}
+
+void addToBalance(struct BankAccount *account, Money change) {
+    if (atomicBalancesEnabled()) {
+        __atomic_add_fetch(&account->balance, change, __ATOMIC_ACQ_REL);
+    } else {
+        account->balance += change;
+    }
 }
 
-const char* withdraw(struct BankAccount *account, double amount) {
+enum OperationStatus debitAccount(struct BankAccount *account, Money amount, Money *before) {
     if (amount <= 0) {
-        return "Invalid withdrawal amount!";
+        return STATUS_INVALID_WITHDRAWAL;
     }
     // Ensure the withdrawal amount is a multiple of 5.
-    if ((int)amount % 5 != 0) {
-        return "Amount must be a multiple of 5, 10 or 20!";
+    if (amount % POUNDS(5) != 0) {
+        return STATUS_NOT_MULTIPLE_OF_5;
     }
-    if (account->balance >= amount) {
+    if (!atomicBalancesEnabled()) {
+        if (account->balance < amount) {
+            return STATUS_INSUFFICIENT_FUNDS;
+        }
+        *before = account->balance;
         account->balance -= amount;
-        static char msg[100];
-        snprintf(msg, 100, "Withdrawal successful! New balance: £%.2f", account->balance);
-        return msg;
+        return STATUS_OK;
     }
-    return "Insufficient funds!";
+    // The funds are checked against the very balance the swap replaces, so withdrawals racing on
+    // one account can never overdraw it; a failed swap retries with the balance it found.
+    Money balance = __atomic_load_n(&account->balance, __ATOMIC_RELAXED);
+    do {
+        if (balance < amount) {
+            return STATUS_INSUFFICIENT_FUNDS;
+        }
+    } while (!__atomic_compare_exchange_n(&account->balance, &balance, balance - amount, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    *before = balance;
+    return STATUS_OK;
 }
 
-const char* deposit(struct BankAccount *account, double amount) {
+enum OperationStatus creditAccount(struct BankAccount *account, Money amount, Money *before) {
     if (amount <= 0) {
-        return "Invalid deposit amount!";
+        return STATUS_INVALID_DEPOSIT;
     }
-    account->balance += amount;
-    static char msg[100];
-    snprintf(msg, sizeof(msg), "Deposit successful! New balance: £%.2f", account->balance);
-    return msg;
+    if (atomicBalancesEnabled()) {
+        *before = __atomic_fetch_add(&account->balance, amount, __ATOMIC_ACQ_REL);
+    } else {
+        *before = account->balance;
+        account->balance += amount;
+    }
+    return STATUS_OK;
 }
 
-const char* changePin(struct BankAccount *account, int newPin1, int newPin2) {
+// Journal a balance change that has been made, or take it back if the journal can not be written.
+// Under the account lock, or for a withdrawal: taking back a deposit without the lock could
+// overdraw the account if the money has been withdrawn meanwhile (see depositFunds()).
+static enum OperationStatus recordBalanceChange(struct BankAccount *account, Money change) {
+    // Nothing is acknowledged before it is in the journal.
+    if (!journalAccount(account)) {
+        addToBalance(account, -change);
+        return STATUS_NOT_RECORDED;
+    }
+    markAccountDirty(account);
+    return STATUS_OK;
+}
+
+// Atomic balances need no lock. Otherwise the account stays locked until the change is journaled,
+// so that the journal has the changes of an account in the order they were made. (With atomic
+// balances that holds too: a journal record takes the balance at the time it is written.)
+enum OperationStatus withdrawFunds(struct BankAccount *account, Money amount, char *message, size_t size) {
+    bool atomic = atomicBalancesEnabled();
+    bool begun = journalBeginChange();
+    if (!atomic) {
+        lockAccount(account);
+    }
+    Money before;
+    enum OperationStatus status = debitAccount(account, amount, &before);
+    if (status == STATUS_OK) {
+        status = recordBalanceChange(account, -amount);
+    }
+    if (!atomic) {
+        unlockAccount(account);
+    }
+    journalEndChange(begun);
+    if (status != STATUS_OK) {
+        return report(status, message, size);
+    }
+    balanceMessage(message, size, "Withdrawal successful! New balance: ", before - amount);
+    return STATUS_OK;
+}
+
+enum OperationStatus depositFunds(struct BankAccount *account, Money amount, char *message, size_t size) {
+    bool atomic = atomicBalancesEnabled();
+    Money before;
+    enum OperationStatus status;
+    if (atomic) {
+        // With no lock a deposit could be withdrawn as soon as it is made, and then not be taken
+        // back if the journal fails: the journal makes it once its record is written.
+        if (amount <= 0) {
+            status = STATUS_INVALID_DEPOSIT;
+        } else {
+            status = journalCredits(&account, &amount, &before, 1) ? STATUS_OK : STATUS_NOT_RECORDED;
+        }
+        if (status == STATUS_OK) {
+            markAccountDirty(account);
+        }
+    } else {
+        bool begun = journalBeginChange();
+        lockAccount(account);
+        status = creditAccount(account, amount, &before);
+        if (status == STATUS_OK) {
+            status = recordBalanceChange(account, amount);
+        }
+        unlockAccount(account);
+        journalEndChange(begun);
+    }
+    if (status != STATUS_OK) {
+        return report(status, message, size);
+    }
+    balanceMessage(message, size, "Deposit successful! New balance: ", before + amount);
+    return STATUS_OK;
+}
+
+enum OperationStatus updatePin(struct BankAccount *account, int newPin1, int newPin2, char *message, size_t size) {
     if (newPin1 != newPin2) {
-        return "Error: PINs do not match!";
+        return report(STATUS_PINS_DIFFER, message, size);
     }
     if (newPin1 < 1000 || newPin1 > 9999) { // Ensure exactly 4 digits
-        return "Error: PIN must be exactly 4 digits!";
+        return report(STATUS_INVALID_PIN, message, size);
     }
+    bool begun = journalBeginChange();
+    lockAccount(account);
+    int oldPin = account->pinCode;
     account->pinCode = newPin1;
-    return "PIN successfully changed!";
+    bool recorded = journalAccount(account);
+    if (!recorded) {
+        account->pinCode = oldPin;
+    } else {
+        markAccountDirty(account);
+    }
+    unlockAccount(account);
+    journalEndChange(begun);
+    if (!recorded) {
+        return report(STATUS_NOT_RECORDED, message, size);
+    }
+    copyMessage("PIN successfully changed!", message, size);
+    return STATUS_OK;
+}
+
+void balanceText(const struct BankAccount *account, char *message, size_t size) {
+    Money balance;
+    if (atomicBalancesEnabled()) {
+        balance = accountBalance(account);
+    } else {
+        lockAccount(account);
+        balance = account->balance;
+        unlockAccount(account);
+    }
+    balanceMessage(message, size, "Your current balance is: ", balance);
+}
+
+// The original interface: the same operations with their message in a static buffer.
+const char* withdraw(struct BankAccount *account, Money amount) {
+    static char msg[100];
+    withdrawFunds(account, amount, msg, sizeof(msg));
+    return msg;
+}
+
+const char* deposit(struct BankAccount *account, Money amount) {
+    static char msg[100];
+    depositFunds(account, amount, msg, sizeof(msg));
+    return msg;
+}
+
+const char* changePin(struct BankAccount *account, int newPin1, int newPin2) {
+    static char msg[100];
+    updatePin(account, newPin1, newPin2, msg, sizeof(msg));
+    return msg;
 }
 
 const char* showBalance(struct BankAccount *account) {
     static char msg[100];
-    snprintf(msg, sizeof(msg), "Your current balance is: £%.2f", account->balance);
+    balanceText(account, msg, sizeof(msg));
     return msg;
 }
 
-// Logging function that appends the transaction details to "log.txt"
-void logTransaction(int accountNumber, const char *transactionType, double originalBalance, double newBalance) {
-    FILE *logFile = fopen("log.txt", "a");
-    if (logFile != NULL) {
-        fprintf(logFile, "Account %d - %s: Original Balance = £%.2f, New Balance = £%.2f\n",
-                accountNumber, transactionType, originalBalance, newBalance);
-        fclose(logFile);
-    } else {
-        printf("Error: Could not open log file.\n");
+// Logging function that appends a record of the transaction to the binary log "log.bin".
+// When the background logger runs the record is only queued (see transaction_log.h).
+void logTransaction(int accountNumber, enum TransactionOp operation, Money originalBalance, Money newBalance) {
+    if (!appendTransactionLog(accountNumber, operation, originalBalance, newBalance)) {
+        printf("Error: Could not write to the log file.\n");
     }
 }
 
 // Function to optionally display a receipt on the screen
-void displayReceipt(const char *accountHolder, const char *transactionType, double originalBalance, double newBalance) {
+void displayReceipt(const char *accountHolder, const char *transactionType, Money originalBalance, Money newBalance) {
     char choice;
     // Get the current date/time
     time_t t = time(NULL);
@@ -112,8 +318,11 @@ void displayReceipt(const char *accountHolder, const char *transactionType, doub
         printf("Account Holder: %s\n", accountHolder);
         printf("----------------------\n");
         printf("Transaction: %-12s\n", transactionType);
-        printf("Original Balance: £%10.2f\n", originalBalance);
-        printf("New Balance:      £%10.2f\n", newBalance);
+        char original[MONEY_TEXT_SIZE], updated[MONEY_TEXT_SIZE];
+        formatMoneyDisplay(originalBalance, original, sizeof(original));
+        formatMoneyDisplay(newBalance, updated, sizeof(updated));
+        printf("Original Balance: %12s\n", original);
+        printf("New Balance:      %12s\n", updated);
         printf("----------------------\n");
         printf("Thank you for using our ATM!\n");
         printf("----------------------\n");
@@ -121,45 +330,61 @@ void displayReceipt(const char *accountHolder, const char *transactionType, doub
 }
 
 
-// This function reads the CSV file and fills a static array of BankAccount.
+// This function reads the CSV file into a heap array that grows as rows are read,
+// so any number of accounts can be loaded in a single pass.
+// The file is read in large blocks and parsed by csv_parser.c instead of fgets + sscanf per line.
 // It returns a pointer to that array and sets *accountCount to the number of accounts read.
+// Malformed lines are reported with their line number and skipped.
 struct BankAccount* loadAccountsFromCSV(const char *filename, int *accountCount) {
-    int numberOfAccounts = 2;
-    struct BankAccount *accountList = malloc(numberOfAccounts * sizeof(struct BankAccount));
+    struct CsvLoadState state;
+    csvLoadStateInit(&state, filename);
+    *accountCount = 0;
     FILE *file = fopen(filename, "r");
     if (!file) {
         printf("Error: Could not open %s\n", filename);
-        *accountCount = 0;
-        return accountList;
+        return state.accounts;
     }
-    char line[256];
-    // Skip the header line.
-    if (fgets(line, sizeof(line), file) == NULL) {
-        fclose(file);
-        *accountCount = 0;
-        return accountList;
-    }
-    *accountCount = 0;
-    while (fgets(line, sizeof(line), file) != NULL && *accountCount < numberOfAccounts) {
-        int accNum, pin, blockedInt;
-        double balance;
-        char name[50];
-        // Parse the CSV line.
-        if (sscanf(line, "%d,%49[^,],%lf,%d,%d", &accNum, name, &balance, &pin, &blockedInt) == 5) {
-            accountList[*accountCount].accountNumber = accNum;
-            strcpy(accountList[*accountCount].accountHolder, name);
-            accountList[*accountCount].balance = balance;
-            accountList[*accountCount].pinCode = pin;
-            accountList[*accountCount].blocked = (blockedInt != 0);
-            (*accountCount)++;
+    size_t capacity = CSV_BLOCK_SIZE;
+    size_t filled = 0;
+    char *buffer = malloc(capacity);
+    bool endOfFile = false;
+    while (buffer != NULL && !endOfFile) {
+        // Only a single line longer than the whole buffer can fill it up; make room for it.
+        if (filled == capacity) {
+            char *grown = realloc(buffer, 2 * capacity);
+            if (grown == NULL) {
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
         }
+        size_t got = fread(buffer + filled, 1, capacity - filled, file);
+        filled += got;
+        endOfFile = (got == 0);
+        // Parse the complete lines and carry the incomplete last line over to the next block.
+        size_t consumed = csvParseBlock(&state, buffer, filled, endOfFile);
+        memmove(buffer, buffer + consumed, filled - consumed);
+        filled -= consumed;
     }
+    if (!endOfFile) {
+        printf("Error: Out of memory while reading %s\n", filename);
+    }
+    free(buffer);
     fclose(file);
-    return accountList;
+    *accountCount = state.count;
+    registerAccounts(state.accounts, state.count, state.capacity);
+    return state.accounts;
 }
 
 
+// Arrays returned by the loaders are looked up through their hash index (see account_index.c);
+// any other array is scanned.
 struct BankAccount* findAccount(struct BankAccount *accounts, int counter, int accountNumber) {
+    struct AccountIndex *index = accountIndexFor(accounts, counter);
+    if (index != NULL) {
+        int position = accountIndexLookup(index, accountNumber);
+        return position >= 0 ? &accounts[position] : NULL;
+    }
     for (int i = 0; i < counter; i++) {
         if (accounts[i].accountNumber == accountNumber) {
             return &accounts[i];
@@ -168,24 +393,61 @@ struct BankAccount* findAccount(struct BankAccount *accounts, int counter, int a
     return NULL;
 }
 
-void saveAccountsToCSV(const char *filename, struct BankAccount *accounts, int accountCount) {
-    FILE *file = fopen(filename, "w");
+// Write value in decimal at text (up to 11 characters, no NUL) and return the length.
+static size_t formatInt(int value, char *text) {
+    char digits[12];
+    char *p = digits + sizeof(digits);
+    unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    size_t length = (size_t)(digits + sizeof(digits) - p);
+    memcpy(text, p, length);
+    return length;
+}
+
+bool saveAccountsToCSV(const char *filename, struct BankAccount *accounts, int accountCount) {
+    // Write to a temporary file that replaces accounts.csv only once it is complete and on disk,
+    // so a crash in the middle never leaves a truncated accounts.csv behind.
+    char tempName[4096];
+    snprintf(tempName, sizeof(tempName), "%s.tmp", filename);
+    FILE *file = fopen(tempName, "w");
     if (!file) {
-        printf("Error: Could not open %s for writing.\n", filename);
-        return;
+        printf("Error: Could not open %s for writing.\n", tempName);
+        return false;
     }
     // Write the CSV header
     fprintf(file, "AccountNumber,AccountHolder,Balance,PinCode,Blocked\n");
     // Write each account's details
+    // Lines are assembled by hand: on a large table fprintf's number formatting dominates the save.
     for (int i = 0; i < accountCount; i++) {
-        fprintf(file, "%d,%s,%.2f,%d,%d\n",
-                accounts[i].accountNumber,
-                accounts[i].accountHolder,
-                accounts[i].balance,
-                accounts[i].pinCode,
-                accounts[i].blocked ? 1 : 0);
+        char line[128];
+        size_t length = formatInt(accounts[i].accountNumber, line);
+        line[length++] = ',';
+        size_t nameLength = strnlen(accounts[i].accountHolder, sizeof(accounts[i].accountHolder) - 1);
+        memcpy(line + length, accounts[i].accountHolder, nameLength);
+        length += nameLength;
+        line[length++] = ',';
+        length += formatMoney(accounts[i].balance, line + length, sizeof(line) - length);
+        line[length++] = ',';
+        length += formatInt(accounts[i].pinCode, line + length);
+        line[length++] = ',';
+        line[length++] = accounts[i].blocked ? '1' : '0';
+        line[length++] = '\n';
+        fwrite(line, 1, length, file);
     }
-    fclose(file);
+    if (ferror(file)) {
+        fclose(file);
+        remove(tempName);
+    } else if (replaceFileDurably(file, tempName, filename)) {
+        return true;
+    }
+    printf("Error: Could not write %s\n", filename);
+    return false;
 }
 
 // Helper function to safely read an integer
@@ -199,13 +461,14 @@ int getValidInt() {
     return num;
 }
 
-// Helper function to safely read a double
-double getValidDouble() {
-    double num;
+// Helper function to safely read an amount of money, e.g. "20" or "12.50"
+Money getValidMoney() {
+    char text[64];
+    Money amount;
     char ch;
-    while (scanf("%lf", &num) != 1) {
+    while (scanf("%63s", text) != 1 || !parseMoneyString(text, &amount)) {
         while ((ch = getchar()) != '\n' && ch != EOF);
         printf("Invalid input. Please try again:\n>>> ");
     }
-    return num;
+    return amount;
 }
@@ -2,29 +2,75 @@
 #define PROGRAMMING_ASSIGNMENT_ALGORITHM_H
 
 #include <stdbool.h>  // Required for bool type
+#include <stddef.h>
+#include "money.h"
 
 // Define struct BankAccount before using it anywhere
 struct BankAccount {
     int accountNumber;
     char accountHolder[50];
-    double balance;
+    Money balance;          // Minor units (pence)
     int pinCode;
     bool blocked;
 };
 
+// Kinds of records in the transaction log
+enum TransactionOp {
+    TRANSACTION_WITHDRAWAL = 1,
+    TRANSACTION_DEPOSIT,
+    TRANSACTION_CHECK_BALANCE,
+    TRANSACTION_CHANGE_PIN,
+    TRANSACTION_CARD_RETAINED
+};
+
+// Outcome of an operation on an account
+enum OperationStatus {
+    STATUS_OK = 0,
+    STATUS_INVALID_WITHDRAWAL,      // Amount is not positive
+    STATUS_INVALID_DEPOSIT,
+    STATUS_NOT_MULTIPLE_OF_5,
+    STATUS_INSUFFICIENT_FUNDS,
+    STATUS_PINS_DIFFER,
+    STATUS_INVALID_PIN,             // Not exactly 4 digits
+    STATUS_NOT_RECORDED,            // The journal could not be written; nothing changed
+    STATUS_UNKNOWN_ACCOUNT,
+    STATUS_UNSUPPORTED_OPERATION    // E.g. a balance check in a batch (see batch.h)
+};
+
 // Function prototypes
 struct BankAccount* loadAccountsFromCSV(const char *filename, int *accountCount);
-const char* withdraw(struct BankAccount *account, double amount);
-const char* deposit(struct BankAccount *account, double amount);
+// Operations that report their outcome as a status and, if message is not NULL, write the text
+// for the user into message[size]. They keep no state of their own; with account locking enabled
+// (see account_lock.h) any number of threads can call them, on the same account or not.
+enum OperationStatus withdrawFunds(struct BankAccount *account, Money amount, char *message, size_t size);
+enum OperationStatus depositFunds(struct BankAccount *account, Money amount, char *message, size_t size);
+enum OperationStatus updatePin(struct BankAccount *account, int newPin1, int newPin2, char *message, size_t size);
+void balanceText(const struct BankAccount *account, char *message, size_t size);
+// The balance change of withdrawFunds() and depositFunds() without journaling: checks the rules,
+// changes the balance and sets *before to the balance it replaced. Unless balances are atomic (see
+// account_lock.h) the caller holds the account's lock.
+enum OperationStatus debitAccount(struct BankAccount *account, Money amount, Money *before);
+enum OperationStatus creditAccount(struct BankAccount *account, Money amount, Money *before);
+// Add change to the balance without any checks, to take back a change; same locking as above.
+void addToBalance(struct BankAccount *account, Money change);
+// Read the balance; an atomic load in atomic balance mode.
+Money accountBalance(const struct BankAccount *account);
+// Text for a status, e.g. "Insufficient funds!"
+const char* operationStatusText(enum OperationStatus status);
+// The same operations returning their message in a static buffer, overwritten by the next call,
+// so only for one caller at a time.
+const char* withdraw(struct BankAccount *account, Money amount);
+const char* deposit(struct BankAccount *account, Money amount);
 bool checkPin(struct BankAccount *account, int enteredPin);  // PIN verification
 bool checkBlocked(struct BankAccount *account);
+void blockAccount(struct BankAccount *account);
 const char* changePin(struct BankAccount *account, int newPin1, int newPin2);
 const char* showBalance (struct BankAccount *account);
 struct BankAccount* findAccount(struct BankAccount *accounts, int counter, int accountNumber);
-void logTransaction(int accountNumber, const char *transactionType, double originalBalance, double newBalance);
-void displayReceipt(const char *accountHolder, const char *transactionType, double originalBalance, double newBalance);
-void saveAccountsToCSV(const char *filename, struct BankAccount *accounts, int accountCount);
+void logTransaction(int accountNumber, enum TransactionOp operation, Money originalBalance, Money newBalance);
+void displayReceipt(const char *accountHolder, const char *transactionType, Money originalBalance, Money newBalance);
+bool saveAccountsToCSV(const char *filename, struct BankAccount *accounts, int accountCount);
 int getValidInt();
-double getValidDouble();
+Money getValidMoney();
 
 #endif // PROGRAMMING_ASSIGNMENT_ALGORITHM_H
@@ -0,0 +1,207 @@
+//
+// Batches of withdrawals and deposits applied with one journal write and one log append.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "account_index.h"
+#include "account_lock.h"
+#include "journal.h"
+#include "transaction_log.h"
+
+// Sort key: the operations of one account end up next to each other, in batch order.
+struct BatchKey {
+    int accountNumber;
+    int position;           // Index of the operation in the batch
+};
+
+static int compareKeys(const void *a, const void *b) {
+    const struct BatchKey *x = a;
+    const struct BatchKey *y = b;
+    if (x->accountNumber != y->accountNumber) {
+        return x->accountNumber < y->accountNumber ? -1 : 1;
+    }
+    return (x->position > y->position) - (x->position < y->position);
+}
+
+// With account locking enabled, the batch holds the stripes of all its accounts from the first
+// change until its log records are queued, taking them in increasing order like every caller that
+// locks several accounts.
+static void lockBatchStripes(const uint8_t *stripes, bool lock) {
+    for (int stripe = 0; stripe < ACCOUNT_LOCK_STRIPES; stripe++) {
+        if (stripes[stripe / 8] & (1u << (stripe % 8))) {
+            if (lock) {
+                lockAccountStripe(stripe);
+            } else {
+                unlockAccountStripe(stripe);
+            }
+        }
+    }
+}
+
+// Apply one operation to account, add the balance change to *change and describe the operation in
+// record if it succeeds.
+static enum OperationStatus applyOperation(struct BankAccount *account, const struct BatchOperation *operation,
+                                           struct TransactionRecord *record, Money *change) {
+    Money before;
+    Money amount;
+    enum OperationStatus status;
+    if (operation->operation == TRANSACTION_WITHDRAWAL) {
+        status = debitAccount(account, operation->amount, &before);
+        amount = -operation->amount;
+    } else if (operation->operation == TRANSACTION_DEPOSIT) {
+        status = creditAccount(account, operation->amount, &before);
+        amount = operation->amount;
+    } else {
+        return STATUS_UNSUPPORTED_OPERATION;
+    }
+    if (status == STATUS_OK) {
+        *change += amount;
+        record->accountNumber = account->accountNumber;
+        record->operation = (uint16_t)operation->operation;
+        record->balanceBefore = before;
+        record->balanceAfter = before + amount;
+    }
+    return status;
+}
+
+// Apply the operations of one account (those of keys[0..count)), store their outcomes and records,
+// and return how much they took out of its balance; *credit gets what is still to be added to it.
+// Without atomic balances the account is changed as they go (it is locked, or there is one caller)
+// and *credit is 0. With atomic balances they are worked out on a copy: the lowest balance they
+// pass through is withdrawn at once with a compare-and-swap (working them out again if the
+// balance changed meanwhile), and the rest is a credit the journal adds once it is recorded, so
+// nothing the batch puts in can be withdrawn before then, nor be missing when it is taken back.
+static Money applyAccountOperations(struct BankAccount *account, const struct BatchKey *keys, int count,
+                                    const struct BatchOperation *operations, struct TransactionRecord *records,
+                                    enum OperationStatus *results, Money *credit) {
+    *credit = 0;
+    if (!atomicBalancesEnabled()) {
+        Money change = 0;
+        for (int k = 0; k < count; k++) {
+            int i = keys[k].position;
+            results[i] = applyOperation(account, &operations[i], &records[i], &change);
+        }
+        return -change;
+    }
+    Money balance = accountBalance(account);
+    for (;;) {
+        struct BankAccount copy;
+        memset(&copy, 0, sizeof(copy));
+        copy.accountNumber = account->accountNumber;
+        copy.balance = balance;
+        Money lowest = balance;
+        Money change = 0;
+        for (int k = 0; k < count; k++) {
+            int i = keys[k].position;
+            results[i] = applyOperation(&copy, &operations[i], &records[i], &change);
+            if (copy.balance < lowest) {
+                lowest = copy.balance;
+            }
+        }
+        if (lowest == balance || __atomic_compare_exchange_n(&account->balance, &balance, lowest, false,
+                                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *credit = copy.balance - lowest;
+            return balance - lowest;
+        }
+        // balance now holds the balance that was found instead.
+    }
+}
+
+int applyTransactionBatch(struct BankAccount *accounts, int accountCount, const struct BatchOperation *operations,
+                          int count, enum OperationStatus *results) {
+    if (count <= 0) {
+        return 0;
+    }
+    struct BatchKey *keys = malloc(count * sizeof(struct BatchKey));
+    // records[i] describes operations[i] if it succeeds
+    struct TransactionRecord *records = calloc(count, sizeof(struct TransactionRecord));
+    struct BankAccount **changed = malloc(count * sizeof(struct BankAccount *));
+    Money *taken = malloc(count * sizeof(Money));      // Out of the balance of changed[c] already
+    Money *credits = malloc(count * sizeof(Money));    // Still to be added to it
+    for (int i = 0; i < count; i++) {
+        keys[i].accountNumber = operations[i].accountNumber;
+        keys[i].position = i;
+    }
+    qsort(keys, count, sizeof(struct BatchKey), compareKeys);
+    // The batch takes money out before it is journaled and puts it back if that fails.
+    bool begun = journalBeginChange();
+    uint8_t stripes[ACCOUNT_LOCK_STRIPES / 8];
+    bool locking = accountLockingEnabled();
+    if (locking) {
+        memset(stripes, 0, sizeof(stripes));
+        for (int i = 0; i < count; i++) {
+            int stripe = accountLockStripe(operations[i].accountNumber);
+            stripes[stripe / 8] |= (uint8_t)(1u << (stripe % 8));
+        }
+        lockBatchStripes(stripes, true);
+    }
+
+    int applied = 0;
+    int changedCount = 0;
+    for (int start = 0; start < count; ) {
+        int end = start + 1;
+        while (end < count && keys[end].accountNumber == keys[start].accountNumber) {
+            end++;
+        }
+        struct BankAccount *account = findAccount(accounts, accountCount, keys[start].accountNumber);
+        Money credit = 0;
+        Money out = 0;
+        if (account != NULL) {
+            out = applyAccountOperations(account, &keys[start], end - start, operations, records, results, &credit);
+        }
+        for (int k = start; k < end; k++) {
+            int i = keys[k].position;
+            if (account == NULL) {
+                results[i] = STATUS_UNKNOWN_ACCOUNT;
+            } else if (results[i] == STATUS_OK) {
+                applied++;
+            }
+        }
+        if (out != 0 || credit != 0) {
+            changed[changedCount] = account;
+            taken[changedCount] = out;
+            credits[changedCount] = credit;
+            changedCount++;
+        }
+        start = end;
+    }
+
+    // Nothing is acknowledged before it is in the journal: all of the batch or none of it. Taking
+    // back what was taken out can not overdraw an account (credits are only added once recorded).
+    if (!journalCredits(changed, credits, NULL, changedCount)) {
+        for (int c = 0; c < changedCount; c++) {
+            addToBalance(changed[c], taken[c]);
+        }
+        for (int i = 0; i < count; i++) {
+            if (results[i] == STATUS_OK) {
+                results[i] = STATUS_NOT_RECORDED;
+            }
+        }
+        applied = 0;
+    } else {
+        for (int c = 0; c < changedCount; c++) {
+            markAccountDirty(changed[c]);
+        }
+        int logged = 0;
+        for (int i = 0; i < count; i++) {
+            if (results[i] == STATUS_OK) {
+                records[logged++] = records[i];
+            }
+        }
+        if (!appendTransactionLogRecords(records, logged)) {
+            printf("Error: Could not write to the log file.\n");
+        }
+    }
+    if (locking) {
+        lockBatchStripes(stripes, false);
+    }
+    journalEndChange(begun);
+    free(credits);
+    free(taken);
+    free(changed);
+    free(records);
+    free(keys);
+    return applied;
+}
@@ -0,0 +1,30 @@
+#ifndef PROGRAMMING_ASSIGNMENT_BATCH_H
+#define PROGRAMMING_ASSIGNMENT_BATCH_H
+
+#include "algorithm.h"
+
+// Batches of withdrawals and deposits, e.g. a settlement file or the upload of an offline ATM.
+// The operations are applied grouped by account (each account is looked up once and its
+// operations run back to back, in the order they appear in the batch) under the same rules as
+// withdrawFunds() and depositFunds(). Every changed account is then journaled with one write and
+// one fsync, and the log records of the batch are queued together, in batch order.
+// With account locking enabled (see account_lock.h) a batch can run alongside sessions and other
+// batches: it holds the locks of all its accounts until its changes are journaled and logged.
+// With atomic balances as well, what a batch puts into an account is only added once it is
+// journaled (see journalCredits()), so sessions can not withdraw it before then.
+
+struct BatchOperation {
+    int accountNumber;
+    enum TransactionOp operation;   // TRANSACTION_WITHDRAWAL or TRANSACTION_DEPOSIT
+    Money amount;
+};
+
+// Apply operations[0..count) to accounts and store the outcome of operations[i] in results[i]:
+// STATUS_UNKNOWN_ACCOUNT for an account that is not in the array, STATUS_UNSUPPORTED_OPERATION for
+// any other kind of operation, otherwise what withdrawFunds() or depositFunds() would return at
+// that point. If the journal can not be written nothing is applied and every operation that would
+// have succeeded gets STATUS_NOT_RECORDED. Returns the number of operations applied.
+int applyTransactionBatch(struct BankAccount *accounts, int accountCount, const struct BatchOperation *operations,
+                          int count, enum OperationStatus *results);
+
+#endif // PROGRAMMING_ASSIGNMENT_BATCH_H
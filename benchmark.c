@@ -0,0 +1,1281 @@
+//
+// Benchmarks for the ATM engine.
+// Usage: Programming_Assignment_Bench <benchmark> [options]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "algorithm.h"
+#include "csv_parser.h"
+#include "account_map.h"
+#include "parallel_loader.h"
+#include "snapshot.h"
+#include "account_index.h"
+#include "journal.h"
+#include "transaction_log.h"
+#include "log_index.h"
+#include "replay.h"
+#include "batch.h"
+#include "account_lock.h"
+#include "shard_engine.h"
+#include "account_store.h"
+#include "report.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define BENCH_CSV_FILE "bench_accounts.csv"
+#define BENCH_SNAPSHOT_FILE "bench_accounts.snap"
+#define BENCH_JOURNAL_FILE "bench_accounts.journal"
+
+// Current monotonic time in seconds.
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Write an accounts file with the given number of rows in the accounts.csv format.
+static void writeAccountsFile(const char *filename, long rows) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        printf("Error: Could not create %s\n", filename);
+        exit(1);
+    }
+    fprintf(file, "AccountNumber,AccountHolder,Balance,PinCode,Blocked\n");
+    for (long i = 1; i <= rows; i++) {
+        fprintf(file, "%ld,Holder %ld,%ld.%02ld,%ld,%d\n",
+                i, i, (i * 7919) % 100000, i % 100, 1000 + i % 9000, i % 50 == 0);
+    }
+    fclose(file);
+}
+
+// Load time for growing file sizes; ns/row should stay flat if loading is linear.
+static void benchLoad(long maxRows) {
+    printf("%12s %12s %12s\n", "rows", "seconds", "ns/row");
+    for (long rows = 1000; rows <= maxRows; rows *= 10) {
+        writeAccountsFile(BENCH_CSV_FILE, rows);
+        int count;
+        double start = nowSeconds();
+        struct BankAccount *accounts = loadAccountsFromCSV(BENCH_CSV_FILE, &count);
+        double elapsed = nowSeconds() - start;
+        if (count != rows) {
+            printf("Error: loaded %d of %ld rows\n", count, rows);
+        }
+        printf("%12ld %12.4f %12.1f\n", rows, elapsed, elapsed * 1e9 / rows);
+        releaseAccounts(accounts);
+    }
+    remove(BENCH_CSV_FILE);
+}
+
+// The previous loader: fgets + sscanf per line.
+static struct BankAccount* loadAccountsScanf(const char *filename, int *accountCount) {
+    int capacity = 16;
+    struct BankAccount *accounts = malloc(capacity * sizeof(struct BankAccount));
+    *accountCount = 0;
+    FILE *file = fopen(filename, "r");
+    char line[256];
+    if (!file || fgets(line, sizeof(line), file) == NULL) {
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (*accountCount == capacity) {
+            capacity *= 2;
+            accounts = realloc(accounts, capacity * sizeof(struct BankAccount));
+        }
+        if (csvParseAccountLineScanf(line, &accounts[*accountCount])) {
+            (*accountCount)++;
+        }
+    }
+    fclose(file);
+    return accounts;
+}
+
+// Side-by-side comparison of the sscanf loader and the block/SIMD parser.
+static void benchParse(long rows) {
+    writeAccountsFile(BENCH_CSV_FILE, rows);
+    int count;
+    double start = nowSeconds();
+    struct BankAccount *accounts = loadAccountsScanf(BENCH_CSV_FILE, &count);
+    double scanfTime = nowSeconds() - start;
+    free(accounts);
+    start = nowSeconds();
+    accounts = loadAccountsFromCSV(BENCH_CSV_FILE, &count);
+    double blockTime = nowSeconds() - start;
+    releaseAccounts(accounts);
+    printf("%-28s %10s %10s\n", "loader", "seconds", "ns/row");
+    printf("%-28s %10.4f %10.1f\n", "fgets + sscanf", scanfTime, scanfTime * 1e9 / rows);
+    printf("%-28s %10.4f %10.1f\n", "block + structural index", blockTime, blockTime * 1e9 / rows);
+
+    // Structural index alone, on the file already in memory.
+    FILE *file = fopen(BENCH_CSV_FILE, "r");
+    fseek(file, 0, SEEK_END);
+    size_t length = (size_t)ftell(file);
+    rewind(file);
+    char *buf = malloc(length);
+    uint32_t *positions = malloc(length * sizeof(uint32_t));
+    if (fread(buf, 1, length, file) != length) {
+        exit(1);
+    }
+    fclose(file);
+    start = nowSeconds();
+    size_t scalarCount = csvStructuralIndexScalar(buf, length, positions);
+    double scalarTime = nowSeconds() - start;
+    start = nowSeconds();
+    size_t simdCount = csvStructuralIndex(buf, length, positions);
+    double simdTime = nowSeconds() - start;
+    printf("%-28s %10.4f %10.2f GB/s\n", "structural index (scalar)", scalarTime, length / scalarTime / 1e9);
+    printf("%-28s %10.4f %10.2f GB/s\n", "structural index (SIMD)", simdTime, length / simdTime / 1e9);
+    if (scalarCount != simdCount) {
+        printf("Error: structural index mismatch\n");
+    }
+    free(buf);
+    free(positions);
+    remove(BENCH_CSV_FILE);
+}
+
+// Run one loader in a child process so its peak RSS can be measured on its own.
+static void measureLoader(const char *label, int loader) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int count = 0;
+        double start = nowSeconds();
+        if (loader == 0) {
+            loadAccountsFromCSV(BENCH_CSV_FILE, &count);
+        } else {
+            struct AccountMap *map = mapAccountsFromCSV(BENCH_CSV_FILE);
+            count = map ? map->count : 0;
+        }
+        printf("%-24s %10.4f", label, nowSeconds() - start);
+        fflush(stdout);
+        _exit(count > 0 ? 0 : 1);
+    }
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    printf(" %14ld\n", usage.ru_maxrss);
+}
+
+// Startup time and peak RSS of the copying loader vs the mmap loader.
+static void benchMmap(long rows) {
+    writeAccountsFile(BENCH_CSV_FILE, rows);
+    printf("%-24s %10s %14s\n", "loader", "seconds", "peak RSS (KB)");
+    measureLoader("loadAccountsFromCSV", 0);
+    measureLoader("mapAccountsFromCSV", 1);
+    remove(BENCH_CSV_FILE);
+}
+
+// Scaling of the parallel loader from 1 thread up to maxThreads.
+static void benchThreads(long rows, int maxThreads) {
+    writeAccountsFile(BENCH_CSV_FILE, rows);
+    printf("%8s %10s %10s\n", "threads", "seconds", "speedup");
+    double baseline = 0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        int count;
+        double start = nowSeconds();
+        struct BankAccount *accounts = loadAccountsFromCSVParallel(BENCH_CSV_FILE, &count, threads);
+        double elapsed = nowSeconds() - start;
+        if (threads == 1) {
+            baseline = elapsed;
+        }
+        printf("%8d %10.4f %10.2f\n", threads, elapsed, baseline / elapsed);
+        releaseAccounts(accounts);
+    }
+    remove(BENCH_CSV_FILE);
+}
+
+// Time to start serving from accounts.csv vs from a binary snapshot.
+static void benchSnapshot(long rows) {
+    writeAccountsFile(BENCH_CSV_FILE, rows);
+    int count;
+    struct BankAccount *accounts = loadAccountsFromCSV(BENCH_CSV_FILE, &count);
+    saveAccountsSnapshot(BENCH_SNAPSHOT_FILE, accounts, count);
+    releaseAccounts(accounts);
+    printf("%-32s %10s\n", "boot from", "seconds");
+    double start = nowSeconds();
+    accounts = loadAccountsFromCSVParallel(BENCH_CSV_FILE, &count, defaultLoadThreads());
+    printf("%-32s %10.6f\n", "accounts.csv (parallel parse)", nowSeconds() - start);
+    releaseAccounts(accounts);
+    start = nowSeconds();
+    accounts = openAccountsSnapshot(BENCH_SNAPSHOT_FILE, &count, false);
+    printf("%-32s %10.6f\n", "snapshot", nowSeconds() - start);
+    releaseAccounts(accounts);
+    start = nowSeconds();
+    accounts = openAccountsSnapshot(BENCH_SNAPSHOT_FILE, &count, true);
+    printf("%-32s %10.6f\n", "snapshot + checksum", nowSeconds() - start);
+    releaseAccounts(accounts);
+    remove(BENCH_CSV_FILE);
+    remove(BENCH_SNAPSHOT_FILE);
+}
+
+// Small, fast pseudo-random generator so the benchmarks do not measure rand().
+static uint64_t benchRandom(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Account numbers to look up: hits drawn uniformly, misses, or skewed (90% to the hottest 1%).
+static void makeLookupKeys(int *keys, long lookups, const struct BankAccount *accounts, int count, int pattern) {
+    uint64_t state = 88172645463325252ULL;
+    for (long i = 0; i < lookups; i++) {
+        uint64_t r = benchRandom(&state);
+        int position = (int)(r % (uint64_t)count);
+        if (pattern == 2 && r % 10 != 0) {
+            position = (int)((r >> 8) % (uint64_t)(count / 100 + 1));
+        }
+        // Account numbers are positive, so negated ones always miss.
+        keys[i] = pattern == 1 ? -accounts[position].accountNumber : accounts[position].accountNumber;
+    }
+}
+
+// findAccount through the index vs the linear scan, for hits, misses and skewed lookups.
+// stride is the gap between consecutive account numbers (1 = contiguous IDs).
+static void benchIndex(int count, int stride) {
+    struct BankAccount *accounts = malloc(count * sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        accounts[i].accountNumber = 100000 + i * stride;
+        snprintf(accounts[i].accountHolder, sizeof(accounts[i].accountHolder), "Holder %d", i);
+        accounts[i].balance = POUNDS(100);
+        accounts[i].pinCode = 1234;
+        accounts[i].blocked = false;
+    }
+    // Unregistered copy for the linear scan.
+    struct BankAccount *plain = malloc(count * sizeof(struct BankAccount));
+    memcpy(plain, accounts, count * sizeof(struct BankAccount));
+    registerAccounts(accounts, count, count);
+    double start = nowSeconds();
+    findAccount(accounts, count, 0);
+    printf("accounts: %d, stride: %d, index built in %.4f s\n", count, stride, nowSeconds() - start);
+    printAccountIndexInfo(accounts, count);
+
+    const char *patterns[] = {"hits", "misses", "skewed"};
+    long lookups = 2000000;
+    long linearLookups = 20000000L / count + 1;
+    int *keys = malloc(lookups * sizeof(int));
+    printf("%-8s %16s %16s\n", "pattern", "index ns/lookup", "linear ns/lookup");
+    for (int pattern = 0; pattern < 3; pattern++) {
+        makeLookupKeys(keys, lookups, accounts, count, pattern);
+        long found = 0;
+        start = nowSeconds();
+        for (long i = 0; i < lookups; i++) {
+            found += findAccount(accounts, count, keys[i]) != NULL;
+        }
+        double indexed = (nowSeconds() - start) * 1e9 / lookups;
+        start = nowSeconds();
+        for (long i = 0; i < linearLookups && i < lookups; i++) {
+            found += findAccount(plain, count, keys[i]) != NULL;
+        }
+        double linear = (nowSeconds() - start) * 1e9 / (linearLookups < lookups ? linearLookups : lookups);
+        printf("%-8s %16.1f %16.1f   (%ld found)\n", patterns[pattern], indexed, linear, found);
+    }
+    free(keys);
+    free(plain);
+    releaseAccounts(accounts);
+}
+
+// Hardware cache-miss counter for this thread, or -1 where perf events are not available
+// (containers, perf_event_paranoid, virtual machines without a PMU).
+static int openCacheMissCounter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void startCounter(int counter) {
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+// Misses since startCounter(), or -1 without a counter.
+static long long stopCounter(int counter) {
+    long long misses = -1;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+    }
+    return misses;
+}
+
+static void printStoreRow(const char *label, long operations, double arrayTime, long long arrayMisses,
+                          double storeTime, long long storeMisses) {
+    printf("%-8s %12.2f %12.2f %8.2fx", label, arrayTime * 1e9 / operations, storeTime * 1e9 / operations,
+           arrayTime / storeTime);
+    if (arrayMisses >= 0 && storeMisses >= 0) {
+        printf(" %14.3f %14.3f\n", (double)arrayMisses / operations, (double)storeMisses / operations);
+    } else {
+        printf(" %14s %14s\n", "n/a", "n/a");
+    }
+}
+
+// What a report pays for with the hot/cold split store: the balance scan over every account, on the
+// struct BankAccount array and on the store, and the refresh that brings the store up to date with
+// the array before each report (after 1% of the balances changed).
+static void benchStore(int count) {
+    struct BankAccount *accounts = malloc(count * sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        accounts[i].accountNumber = 100000 + i * 13;
+        snprintf(accounts[i].accountHolder, sizeof(accounts[i].accountHolder), "Holder %d", i);
+        accounts[i].balance = POUNDS(100) + i % 1000;
+        accounts[i].pinCode = 1234;
+        accounts[i].blocked = i % 50 == 0;
+    }
+    double start = nowSeconds();
+    struct AccountStore *store = createAccountStore(accounts, count);
+    printf("accounts: %d, store built in %.3f s\n", count, nowSeconds() - start);
+    printf("bytes per account: array %zu (hot fields %zu); store %zu hot + %.1f cold\n",
+           sizeof(struct BankAccount), sizeof(int) + sizeof(Money) + sizeof(int) + sizeof(bool),
+           sizeof(int) + sizeof(Money) + sizeof(int) + sizeof(uint8_t),
+           (double)(store->namesSize + count * sizeof(uint32_t)) / count);
+    int counter = openCacheMissCounter();
+    if (counter < 0) {
+        printf("hardware cache-miss counter not available here: timings only\n");
+    }
+    printf("%-8s %12s %12s %9s %14s %14s\n", "", "array ns/op", "store ns/op", "speedup",
+           "array miss/op", "store miss/op");
+
+    int rounds = 10;
+    Money total = 0;
+    startCounter(counter);
+    start = nowSeconds();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count; i++) {
+            if (!accounts[i].blocked) {
+                total += accounts[i].balance;
+            }
+        }
+    }
+    double arrayTime = nowSeconds() - start;
+    long long arrayMisses = stopCounter(counter);
+    startCounter(counter);
+    start = nowSeconds();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count; i++) {
+            if (!store->blocked[i]) {
+                total -= store->balances[i];
+            }
+        }
+    }
+    double storeTime = nowSeconds() - start;
+    long long storeMisses = stopCounter(counter);
+    printStoreRow("scan", (long)rounds * count, arrayTime, arrayMisses, storeTime, storeMisses);
+    if (total != 0) {
+        printf("Error: The scans disagree.\n");
+    }
+
+    double refreshTime = 0;
+    uint64_t state = 88172645463325252ULL;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count / 100; i++) {
+            accounts[benchRandom(&state) % (uint64_t)count].balance += 5;
+        }
+        start = nowSeconds();
+        if (!refreshAccountStore(store, accounts, count)) {
+            printf("Error: Out of memory while refreshing the store.\n");
+            break;
+        }
+        refreshTime += nowSeconds() - start;
+    }
+    double saved = (arrayTime - storeTime) / rounds;
+    printf("refresh  %12.2f ns/account", refreshTime * 1e9 / ((double)rounds * count));
+    if (saved > 0) {
+        printf(" (a kept store pays for its refresh after %.1f scans)\n", refreshTime / rounds / saved);
+    } else {
+        printf(" (the store scan is not faster here)\n");
+    }
+    if (counter >= 0) {
+        close(counter);
+    }
+    freeAccountStore(store);
+    free(accounts);
+}
+
+static double timeReport(const struct AccountStore *store, const struct BankAccount *accounts, int count,
+                         const Money *limits, int limitCount, int threads, enum ReportKernel kernel,
+                         struct EndOfDayReport *report) {
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        double start = nowSeconds();
+        if (accounts != NULL) {
+            endOfDayReportAccounts(accounts, count, limits, limitCount, threads, report);
+        } else {
+            endOfDayReportWith(store, limits, limitCount, threads, kernel, report);
+        }
+        double elapsed = nowSeconds() - start;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best * 1e3;
+}
+
+// End-of-day report (total, blocked cards, 9 balance bands): struct BankAccount array vs the
+// store with each kernel, by thread count.
+static void benchReport(int count, int maxThreads) {
+    Money limits[8] = {0, POUNDS(100), POUNDS(500), POUNDS(1000), POUNDS(5000), POUNDS(10000), POUNDS(50000),
+                       POUNDS(100000)};
+    struct BankAccount *accounts = malloc(count * sizeof(struct BankAccount));
+    uint64_t state = 88172645463325252ULL;
+    for (int i = 0; i < count; i++) {
+        uint64_t r = benchRandom(&state);
+        accounts[i].accountNumber = 100000 + i;
+        snprintf(accounts[i].accountHolder, sizeof(accounts[i].accountHolder), "Holder %d", i);
+        accounts[i].balance = (Money)(r % (uint64_t)POUNDS(200000)) - POUNDS(50);
+        accounts[i].pinCode = 1234;
+        accounts[i].blocked = (r >> 40) % 100 == 0;
+    }
+    struct AccountStore *store = createAccountStore(accounts, count);
+    const char *kernelNames[] = {"auto", "scalar", "sse4.2", "avx2"};
+    printf("accounts: %d, best kernel: %s, CPUs: %ld\n", count, kernelNames[bestReportKernel()],
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %-8s %8s %10s %8s\n", "layout", "kernel", "threads", "ms", "GB/s");
+    struct EndOfDayReport report;
+    struct EndOfDayReport first;
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        double ms = timeReport(NULL, accounts, count, limits, 8, n, REPORT_KERNEL_SCALAR, &first);
+        printf("%-8s %-8s %8d %10.2f %8.2f\n", "array", "scalar", n, ms,
+               (double)count * sizeof(struct BankAccount) / ms / 1e6);
+        for (enum ReportKernel kernel = REPORT_KERNEL_SCALAR; kernel <= bestReportKernel(); kernel++) {
+            ms = timeReport(store, NULL, count, limits, 8, n, kernel, &report);
+            printf("%-8s %-8s %8d %10.2f %8.2f\n", "store", kernelNames[kernel], n, ms,
+                   (double)count * (sizeof(Money) + 1) / ms / 1e6);
+            if (memcmp(&report, &first, sizeof(report)) != 0) {
+                printf("Error: The %s kernel disagrees with the array report.\n", kernelNames[kernel]);
+            }
+        }
+        if (n < maxThreads && n * 2 > maxThreads) {
+            n = maxThreads / 2;
+        }
+    }
+    printEndOfDayReport(&report, limits);
+    freeAccountStore(store);
+    free(accounts);
+}
+
+// Full rewrite vs dirty-record save, for a growing number of changed accounts.
+static void benchSave(int count) {
+    struct BankAccount *initial = malloc(count * sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        initial[i].accountNumber = i + 1;
+        snprintf(initial[i].accountHolder, sizeof(initial[i].accountHolder), "Holder %d", i);
+        initial[i].balance = POUNDS(100);
+        initial[i].pinCode = 1234;
+        initial[i].blocked = false;
+    }
+    saveAccountsSnapshot(BENCH_SNAPSHOT_FILE, initial, count);
+    free(initial);
+    int loaded;
+    struct BankAccount *accounts = loadAccounts(BENCH_SNAPSHOT_FILE, &loaded, 1);
+    double start = nowSeconds();
+    saveAccountsSnapshot(BENCH_SNAPSHOT_FILE ".full", accounts, loaded);
+    double full = nowSeconds() - start;
+    saveAccountsToCSV(BENCH_CSV_FILE, accounts, loaded);
+    double fullCsv = nowSeconds() - start - full;
+    printf("accounts: %d, full snapshot rewrite %.4f s, full CSV rewrite %.4f s\n", count, full, fullCsv);
+    printf("%10s %14s\n", "changes", "dirty save s");
+    uint64_t state = 88172645463325252ULL;
+    for (int changes = 1; changes <= count && changes <= 100000; changes *= 10) {
+        for (int i = 0; i < changes; i++) {
+            deposit(&accounts[benchRandom(&state) % (uint64_t)loaded], POUNDS(5));
+        }
+        start = nowSeconds();
+        int written = saveDirtyAccountsSnapshot(BENCH_SNAPSHOT_FILE, accounts, loaded);
+        printf("%10d %14.6f   (%d records written)\n", changes, nowSeconds() - start, written);
+    }
+    releaseAccounts(accounts);
+    remove(BENCH_SNAPSHOT_FILE);
+    remove(BENCH_SNAPSHOT_FILE ".full");
+    remove(BENCH_CSV_FILE);
+}
+
+// How long the caller is blocked by a synchronous full save vs a background save.
+static void benchBackgroundSave(int count) {
+    struct BankAccount *accounts = calloc(count, sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        accounts[i].accountNumber = i + 1;
+        snprintf(accounts[i].accountHolder, sizeof(accounts[i].accountHolder), "Holder %d", i);
+        accounts[i].balance = POUNDS(100);
+    }
+    registerAccounts(accounts, count, count);
+    printf("accounts: %d\n", count);
+    printf("%-10s %14s %14s\n", "format", "sync save s", "blocked s");
+    const char *files[] = {BENCH_SNAPSHOT_FILE, BENCH_CSV_FILE};
+    for (int f = 0; f < 2; f++) {
+        // Create the file first so both saves write the same format.
+        if (f == 0) {
+            saveAccountsSnapshot(files[f], accounts, count);
+        } else {
+            saveAccountsToCSV(files[f], accounts, count);
+        }
+        double start = nowSeconds();
+        if (f == 0) {
+            saveAccountsSnapshot(files[f], accounts, count);
+        } else {
+            saveAccountsToCSV(files[f], accounts, count);
+        }
+        double sync = nowSeconds() - start;
+        start = nowSeconds();
+        saveAccountsInBackground(files[f], accounts, count);
+        double blocked = nowSeconds() - start;
+        // Keep changing accounts while the thread writes, as sessions would.
+        long changes = 0;
+        uint64_t state = 88172645463325252ULL;
+        while (pollBackgroundSave(false) == BACKGROUND_SAVE_RUNNING) {
+            accounts[benchRandom(&state) % (uint64_t)count].balance += 1;
+            changes++;
+        }
+        printf("%-10s %14.4f %14.6f   (%.4f s in the background, %ld changes meanwhile)\n",
+               f == 0 ? "snapshot" : "csv", sync, blocked, nowSeconds() - start, changes);
+        remove(files[f]);
+    }
+    releaseAccounts(accounts);
+}
+
+#define BENCH_LOG_FILE "bench_log.bin"
+#define BENCH_TEXT_LOG_FILE "bench_log.txt"
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// What logTransaction did for every entry before the background logger: open, write a text line, close.
+static void logTransactionUnbuffered(int accountNumber, const char *transactionType, double originalBalance, double newBalance) {
+    FILE *logFile = fopen(BENCH_TEXT_LOG_FILE, "a");
+    if (logFile != NULL) {
+        fprintf(logFile, "Account %d - %s: Original Balance = £%.2f, New Balance = £%.2f\n",
+                accountNumber, transactionType, originalBalance, newBalance);
+        fclose(logFile);
+    }
+}
+
+// Remove the bench log and its segments.
+static void removeBenchLog() {
+    int count;
+    char **segments = listLogSegments(BENCH_LOG_FILE, &count);
+    for (int i = 0; i < count; i++) {
+        remove(segments[i]);
+    }
+    freeLogSegments(segments, count);
+    remove(BENCH_TEXT_LOG_FILE);
+}
+
+// Per-call latency of logTransaction: open/write/close of a text line per entry vs the buffered
+// binary logger, without and with rotation into small compressed segments.
+static void benchLog(int entries) {
+    double *latencies = malloc(entries * sizeof(double));
+    printf("entries: %d\n", entries);
+    printf("%-12s %10s %10s %10s %10s %12s %12s\n", "logger", "mean ns", "p50 ns", "p99 ns", "max ns", "total s", "file bytes");
+    const char *names[] = {"unbuffered", "buffered", "rotating"};
+    for (int mode = 0; mode < 3; mode++) {
+        removeBenchLog();
+        if (mode > 0) {
+            struct TransactionLogConfig config;
+            transactionLogDefaults(&config);
+            config.filename = BENCH_LOG_FILE;
+            if (mode == 2) {
+                config.rotateBytes = 256 << 10;
+                config.retainSegments = 4;
+            }
+            startTransactionLog(&config);
+        }
+        double start = nowSeconds();
+        double sum = 0;
+        for (int i = 0; i < entries; i++) {
+            double before = nowSeconds();
+            if (mode == 0) {
+                logTransactionUnbuffered(i, "Check Balance", 100.0, 100.0);
+            } else {
+                appendTransactionLog(i, TRANSACTION_CHECK_BALANCE, POUNDS(100), POUNDS(100));
+            }
+            latencies[i] = (nowSeconds() - before) * 1e9;
+            sum += latencies[i];
+        }
+        if (mode > 0) {
+            stopTransactionLog();
+        }
+        double total = nowSeconds() - start;
+        struct stat info;
+        long bytes = mode == 0 && stat(BENCH_TEXT_LOG_FILE, &info) == 0 ? (long)info.st_size : 0;
+        int count;
+        char **segments = listLogSegments(BENCH_LOG_FILE, &count);
+        for (int i = 0; i < count; i++) {
+            bytes += stat(segments[i], &info) == 0 ? (long)info.st_size : 0;
+        }
+        freeLogSegments(segments, count);
+        qsort(latencies, entries, sizeof(double), compareDoubles);
+        printf("%-12s %10.0f %10.0f %10.0f %10.0f %12.4f %12ld\n", names[mode],
+               sum / entries, latencies[entries / 2], latencies[(long)entries * 99 / 100], latencies[entries - 1], total, bytes);
+    }
+    free(latencies);
+    removeBenchLog();
+    remove(BENCH_LOG_FILE ".idx");
+}
+
+// History of one account: through the log index vs scanning every segment of the log.
+static void benchHistory(long records, int accounts) {
+    removeBenchLog();
+    remove(BENCH_LOG_FILE ".idx");
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = BENCH_LOG_FILE;
+    config.rotateBytes = 8L << 20;
+    config.compress = false;
+    config.retainSegments = 0;
+    startTransactionLog(&config);
+    uint64_t state = 88172645463325252ULL;
+    for (long i = 0; i < records; i++) {
+        appendTransactionLog((int)(benchRandom(&state) % (uint64_t)accounts), TRANSACTION_DEPOSIT, POUNDS(1), POUNDS(2));
+    }
+    stopTransactionLog();
+    double start = nowSeconds();
+    struct LogIndex *index = openLogIndex(BENCH_LOG_FILE);
+    printf("records: %ld, accounts: %d, index opened in %.4f s\n", records, accounts, nowSeconds() - start);
+    int lookups = 100;
+    long found = 0;
+    start = nowSeconds();
+    for (int i = 0; i < lookups; i++) {
+        long count;
+        free(logIndexHistory(index, (int)(benchRandom(&state) % (uint64_t)accounts), &count));
+        found += count;
+    }
+    double indexed = (nowSeconds() - start) / lookups;
+    closeLogIndex(index);
+    int scans = 3;
+    long scanned = 0;
+    start = nowSeconds();
+    for (int i = 0; i < scans; i++) {
+        int accountNumber = (int)(benchRandom(&state) % (uint64_t)accounts);
+        int segmentCount;
+        char **segments = listLogSegments(BENCH_LOG_FILE, &segmentCount);
+        for (int s = 0; s < segmentCount; s++) {
+            long count;
+            struct TransactionRecord *all = readTransactionLog(segments[s], &count);
+            for (long r = 0; r < count; r++) {
+                scanned += all[r].accountNumber == accountNumber;
+            }
+            free(all);
+        }
+        freeLogSegments(segments, segmentCount);
+    }
+    double scan = (nowSeconds() - start) / scans;
+    printf("%-8s %14s %18s\n", "method", "ms/history", "records/history");
+    printf("%-8s %14.3f %18.1f\n", "index", indexed * 1e3, (double)found / lookups);
+    printf("%-8s %14.3f %18.1f\n", "scan", scan * 1e3, (double)scanned / scans);
+    removeBenchLog();
+    remove(BENCH_LOG_FILE ".idx");
+}
+
+struct JournalBenchWorker {
+    struct BankAccount *account;
+    int operations;
+};
+
+static void* journalBenchWorker(void *arg) {
+    struct JournalBenchWorker *worker = arg;
+    for (int i = 0; i < worker->operations; i++) {
+        depositFunds(worker->account, POUNDS(1), NULL, 0);
+    }
+    return NULL;
+}
+
+// Journaled deposits per second and fsyncs per deposit, from 1 up to maxThreads concurrent clients.
+static void benchJournal(int operations, int maxThreads) {
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+    int count = maxThreads;
+    struct BankAccount *accounts = calloc(count, sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        accounts[i].accountNumber = i + 1;
+        accounts[i].balance = POUNDS(100);
+    }
+    registerAccounts(accounts, count, count);
+    pthread_t *threads = malloc(maxThreads * sizeof(pthread_t));
+    struct JournalBenchWorker *workers = malloc(maxThreads * sizeof(struct JournalBenchWorker));
+    printf("%8s %14s %12s %16s\n", "threads", "deposits/s", "syncs", "deposits/sync");
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        remove(BENCH_JOURNAL_FILE);
+        journalOpen(BENCH_JOURNAL_FILE);
+        double start = nowSeconds();
+        for (int t = 0; t < n; t++) {
+            workers[t].account = &accounts[t];
+            workers[t].operations = operations / n;
+            pthread_create(&threads[t], NULL, journalBenchWorker, &workers[t]);
+        }
+        for (int t = 0; t < n; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        double elapsed = nowSeconds() - start;
+        uint64_t records, syncs;
+        journalStats(&records, &syncs);
+        journalClose();
+        printf("%8d %14.0f %12llu %16.2f\n", n, records / elapsed, (unsigned long long)syncs,
+               syncs ? (double)records / syncs : 0.0);
+        if (n < maxThreads && n * 2 > maxThreads) {
+            n = maxThreads / 2;
+        }
+    }
+    free(workers);
+    free(threads);
+    releaseAccounts(accounts);
+    remove(BENCH_JOURNAL_FILE);
+}
+
+// Formatting one amount: snprintf("%.2f") of a double balance (what every message and CSV line
+// used to do), snprintf of the integer pounds and pence, and the formatters of money.c.
+static void benchMoney(int count) {
+    Money *amounts = malloc(count * sizeof(Money));
+    uint64_t state = 88172645463325252ULL;
+    for (int i = 0; i < count; i++) {
+        amounts[i] = (Money)(benchRandom(&state) % 100000000ULL) - 1000000;
+    }
+    const char *names[] = {"snprintf %.2f", "snprintf int", "formatMoney", "display"};
+    printf("amounts: %d\n", count);
+    printf("%-14s %10s\n", "formatter", "ns/amount");
+    for (int method = 0; method < 4; method++) {
+        char text[MONEY_TEXT_SIZE];
+        size_t checksum = 0;
+        double start = nowSeconds();
+        for (int i = 0; i < count; i++) {
+            Money amount = amounts[i];
+            if (method == 0) {
+                checksum += (size_t)snprintf(text, sizeof(text), "%.2f", amount / 100.0);
+            } else if (method == 1) {
+                uint64_t magnitude = amount < 0 ? (uint64_t)0 - (uint64_t)amount : (uint64_t)amount;
+                checksum += (size_t)snprintf(text, sizeof(text), "%s%llu.%02llu", amount < 0 ? "-" : "",
+                                             (unsigned long long)(magnitude / 100), (unsigned long long)(magnitude % 100));
+            } else if (method == 2) {
+                checksum += formatMoney(amount, text, sizeof(text));
+            } else {
+                checksum += formatMoneyDisplay(amount, text, sizeof(text));
+            }
+        }
+        double elapsed = nowSeconds() - start;
+        printf("%-14s %10.1f   (%zu bytes)\n", names[method], elapsed * 1e9 / count, checksum);
+    }
+    free(amounts);
+}
+
+// Replay of a log of consistent deposits over accounts 0..accounts-1, from 1 up to maxThreads
+// threads, with uncompressed and with compressed segments.
+static void benchReplay(long records, int accounts, int maxThreads) {
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+    Money *balances = calloc(accounts, sizeof(Money));
+    printf("records: %ld, accounts: %d\n", records, accounts);
+    printf("%-12s %8s %10s %14s %12s\n", "segments", "threads", "seconds", "records/s", "mismatches");
+    for (int compressed = 0; compressed < 2; compressed++) {
+        removeBenchLog();
+        struct TransactionLogConfig config;
+        transactionLogDefaults(&config);
+        config.filename = BENCH_LOG_FILE;
+        config.rotateBytes = 8L << 20;
+        config.compress = compressed;
+        config.retainSegments = 0;
+        config.index = false;
+        config.flushRecords = LOG_RING_CAPACITY;
+        startTransactionLog(&config);
+        memset(balances, 0, accounts * sizeof(Money));
+        uint64_t state = 88172645463325252ULL;
+        for (long i = 0; i < records; i++) {
+            int account = (int)(benchRandom(&state) % (uint64_t)accounts);
+            appendTransactionLog(account, TRANSACTION_DEPOSIT, balances[account], balances[account] + POUNDS(5));
+            balances[account] += POUNDS(5);
+        }
+        stopTransactionLog();
+        for (int n = 1; n <= maxThreads; n *= 2) {
+            struct BankAccount *table = calloc(accounts, sizeof(struct BankAccount));
+            for (int i = 0; i < accounts; i++) {
+                table[i].accountNumber = i;
+            }
+            registerAccounts(table, accounts, accounts);
+            struct ReplayResult result;
+            double start = nowSeconds();
+            replayTransactionLog(BENCH_LOG_FILE, 0, table, accounts, n, &result);
+            double elapsed = nowSeconds() - start;
+            printf("%-12s %8d %10.3f %14.0f %12ld\n", compressed ? "compressed" : "plain", n, elapsed,
+                   result.records / elapsed, result.mismatchCount);
+            freeReplayResult(&result);
+            releaseAccounts(table);
+            if (n < maxThreads && n * 2 > maxThreads) {
+                n = maxThreads / 2;
+            }
+        }
+    }
+    free(balances);
+    removeBenchLog();
+}
+
+// Settlement-style operations (2/3 deposits, 1/3 withdrawals of multiples of 5) on random accounts:
+// withdraw()/deposit() plus logTransaction() per operation vs applyTransactionBatch() on batches
+// of batchSize, in memory and with the journal open. Journaled single calls pay one fsync each,
+// so they only run the first 2000 operations.
+static void benchBatch(int operations, int accounts, int batchSize) {
+    if (batchSize < 1) {
+        batchSize = 1;
+    }
+    struct BatchOperation *batch = malloc(operations * sizeof(struct BatchOperation));
+    enum OperationStatus *results = malloc(batchSize * sizeof(enum OperationStatus));
+    uint64_t state = 88172645463325252ULL;
+    for (int i = 0; i < operations; i++) {
+        batch[i].accountNumber = (int)(benchRandom(&state) % (uint64_t)accounts) + 1;
+        batch[i].operation = benchRandom(&state) % 3 == 0 ? TRANSACTION_WITHDRAWAL : TRANSACTION_DEPOSIT;
+        batch[i].amount = POUNDS(5) * (Money)(1 + benchRandom(&state) % 20);
+    }
+    printf("operations: %d, accounts: %d, batch size: %d\n", operations, accounts, batchSize);
+    printf("%-8s %-8s %12s %12s %14s %10s\n", "journal", "method", "operations", "applied", "operations/s", "fsyncs");
+    for (int journaled = 0; journaled < 2; journaled++) {
+        for (int batched = 0; batched < 2; batched++) {
+            struct BankAccount *table = calloc(accounts, sizeof(struct BankAccount));
+            for (int i = 0; i < accounts; i++) {
+                table[i].accountNumber = i + 1;
+                table[i].balance = POUNDS(1000);
+            }
+            registerAccounts(table, accounts, accounts);
+            removeBenchLog();
+            struct TransactionLogConfig config;
+            transactionLogDefaults(&config);
+            config.filename = BENCH_LOG_FILE;
+            config.index = false;
+            startTransactionLog(&config);
+            if (journaled) {
+                remove(BENCH_JOURNAL_FILE);
+                journalOpen(BENCH_JOURNAL_FILE);
+            }
+            int count = journaled && !batched && operations > 2000 ? 2000 : operations;
+            int applied = 0;
+            double start = nowSeconds();
+            if (batched) {
+                for (int first = 0; first < count; first += batchSize) {
+                    int n = count - first < batchSize ? count - first : batchSize;
+                    applied += applyTransactionBatch(table, accounts, batch + first, n, results);
+                }
+            } else {
+                for (int i = 0; i < count; i++) {
+                    struct BankAccount *account = findAccount(table, accounts, batch[i].accountNumber);
+                    Money before = account->balance;
+                    if (batch[i].operation == TRANSACTION_WITHDRAWAL) {
+                        withdraw(account, batch[i].amount);
+                    } else {
+                        deposit(account, batch[i].amount);
+                    }
+                    if (account->balance != before) {
+                        logTransaction(account->accountNumber, batch[i].operation, before, account->balance);
+                        applied++;
+                    }
+                }
+            }
+            flushTransactionLog();
+            double elapsed = nowSeconds() - start;
+            uint64_t records = 0, syncs = 0;
+            if (journaled) {
+                journalStats(&records, &syncs);
+                journalClose();
+            }
+            stopTransactionLog();
+            printf("%-8s %-8s %12d %12d %14.0f %10llu\n", journaled ? "on" : "off", batched ? "batch" : "single",
+                   count, applied, count / elapsed, (unsigned long long)syncs);
+            releaseAccounts(table);
+        }
+    }
+    free(results);
+    free(batch);
+    removeBenchLog();
+    remove(BENCH_JOURNAL_FILE);
+}
+
+// Cards that take most of the operations in the skewed distribution of benchLocks().
+#define BENCH_HOT_ACCOUNTS 16
+#define BENCH_HOT_PERCENT 90
+
+struct LockBenchWorker {
+    struct BankAccount *accounts;
+    int count;
+    int operations;
+    bool skewed;
+    uint64_t seed;
+};
+
+// Deposit and withdraw £5 in turn on random cards, so balances stay where they are.
+static void* lockBenchWorker(void *arg) {
+    struct LockBenchWorker *worker = arg;
+    uint64_t state = worker->seed;
+    for (int i = 0; i < worker->operations; i++) {
+        uint64_t r = benchRandom(&state);
+        int number = worker->skewed && r % 100 < BENCH_HOT_PERCENT ? (int)((r >> 32) % BENCH_HOT_ACCOUNTS)
+                                                                  : (int)((r >> 32) % (uint64_t)worker->count);
+        struct BankAccount *account = findAccount(worker->accounts, worker->count, number + 1);
+        if (i % 2 == 0) {
+            depositFunds(account, POUNDS(5), NULL, 0);
+        } else {
+            withdrawFunds(account, POUNDS(5), NULL, 0);
+        }
+    }
+    return NULL;
+}
+
+// Operations per second of the thread-safe engine (striped account locks) from 1 up to maxThreads
+// threads, with cards picked uniformly and with BENCH_HOT_PERCENT% of the operations on
+// BENCH_HOT_ACCOUNTS cards; the first row of each is one thread without locking.
+static void benchLocks(int operations, int maxThreads, int accounts) {
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+    if (accounts < BENCH_HOT_ACCOUNTS) {
+        accounts = BENCH_HOT_ACCOUNTS;
+    }
+    struct BankAccount *table = calloc(accounts, sizeof(struct BankAccount));
+    for (int i = 0; i < accounts; i++) {
+        table[i].accountNumber = i + 1;
+        table[i].balance = POUNDS(1000);
+    }
+    registerAccounts(table, accounts, accounts);
+    pthread_t *threads = malloc(maxThreads * sizeof(pthread_t));
+    struct LockBenchWorker *workers = malloc(maxThreads * sizeof(struct LockBenchWorker));
+    printf("operations: %d, accounts: %d, lock stripes: %d\n", operations, accounts, ACCOUNT_LOCK_STRIPES);
+    printf("%-8s %-8s %8s %14s %10s\n", "cards", "locking", "threads", "operations/s", "speedup");
+    for (int skewed = 0; skewed < 2; skewed++) {
+        double base = 0;
+        for (int n = 0; n <= maxThreads; n = n ? n * 2 : 1) {
+            // n == 0: one thread with locking off
+            int threadCount = n ? n : 1;
+            setAccountLocking(n > 0);
+            double start = nowSeconds();
+            for (int t = 0; t < threadCount; t++) {
+                workers[t].accounts = table;
+                workers[t].count = accounts;
+                workers[t].operations = operations / threadCount;
+                workers[t].skewed = skewed;
+                workers[t].seed = 88172645463325252ULL + (uint64_t)t * 7919;
+                pthread_create(&threads[t], NULL, lockBenchWorker, &workers[t]);
+            }
+            for (int t = 0; t < threadCount; t++) {
+                pthread_join(threads[t], NULL);
+            }
+            double rate = operations / (nowSeconds() - start);
+            if (n == 0) {
+                base = rate;
+            }
+            printf("%-8s %-8s %8d %14.0f %9.2fx\n", skewed ? "skewed" : "uniform", n ? "on" : "off", threadCount,
+                   rate, rate / base);
+            if (n > 0 && n < maxThreads && n * 2 > maxThreads) {
+                n = maxThreads / 2;
+            }
+        }
+        clearDirtyAccounts(table);
+    }
+    setAccountLocking(false);
+    free(workers);
+    free(threads);
+    releaseAccounts(table);
+}
+
+// Deposits and withdrawals on one hot account from 1 up to maxThreads threads: the account's stripe
+// lock (locking mode) vs the compare-and-swap loops of atomic balance mode.
+static void benchAtomicBalances(int operations, int maxThreads) {
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+    struct BankAccount *table = calloc(1, sizeof(struct BankAccount));
+    table[0].accountNumber = 1;
+    table[0].balance = POUNDS(1000);
+    registerAccounts(table, 1, 1);
+    pthread_t *threads = malloc(maxThreads * sizeof(pthread_t));
+    struct LockBenchWorker *workers = malloc(maxThreads * sizeof(struct LockBenchWorker));
+    printf("operations: %d on one account\n", operations);
+    printf("%8s %14s %14s %10s\n", "threads", "mutex ops/s", "cas ops/s", "cas/mutex");
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        double rates[2];
+        for (int atomic = 0; atomic < 2; atomic++) {
+            setAccountLocking(!atomic);
+            setAtomicBalances(atomic);
+            double start = nowSeconds();
+            for (int t = 0; t < n; t++) {
+                workers[t].accounts = table;
+                workers[t].count = 1;
+                workers[t].operations = operations / n;
+                workers[t].skewed = false;
+                workers[t].seed = 88172645463325252ULL + (uint64_t)t * 7919;
+                pthread_create(&threads[t], NULL, lockBenchWorker, &workers[t]);
+            }
+            for (int t = 0; t < n; t++) {
+                pthread_join(threads[t], NULL);
+            }
+            rates[atomic] = operations / (nowSeconds() - start);
+        }
+        printf("%8d %14.0f %14.0f %9.2fx\n", n, rates[0], rates[1], rates[1] / rates[0]);
+        if (n < maxThreads && n * 2 > maxThreads) {
+            n = maxThreads / 2;
+        }
+    }
+    setAccountLocking(false);
+    setAtomicBalances(false);
+    free(workers);
+    free(threads);
+    releaseAccounts(table);
+}
+
+struct ShardBenchClient {
+    struct ShardedEngine *engine;
+    int client;
+    int accounts;
+    int operations;
+    uint64_t seed;
+};
+
+// Collect answers, giving up the CPU while there are none yet (the workers may share it).
+static int collectShardAnswers(struct ShardBenchClient *worker, struct ShardMessage *answers) {
+    int n = shardCollect(worker->engine, worker->client, answers, 256);
+    if (n == 0) {
+        sched_yield();
+    }
+    return n;
+}
+
+// Keep the client's queues full of deposits and withdrawals on random cards until all are answered.
+static void* shardBenchClient(void *arg) {
+    struct ShardBenchClient *worker = arg;
+    uint64_t state = worker->seed;
+    struct ShardMessage answers[256];
+    int outstanding = 0;
+    for (int i = 0; i < worker->operations; i++) {
+        uint64_t r = benchRandom(&state);
+        struct ShardMessage request = {(uint64_t)i, (int)((r >> 32) % (uint64_t)worker->accounts) + 1,
+                                       i % 2 ? TRANSACTION_WITHDRAWAL : TRANSACTION_DEPOSIT, POUNDS(5), STATUS_OK};
+        while (!shardSubmit(worker->engine, worker->client, &request)) {
+            outstanding -= collectShardAnswers(worker, answers);
+        }
+        outstanding++;
+    }
+    while (outstanding > 0) {
+        outstanding -= collectShardAnswers(worker, answers);
+    }
+    return NULL;
+}
+
+// Throughput of the sharded engine with 1 up to maxShards shards (pinned workers), each with one
+// client thread that spreads its requests over all shards.
+static void benchShards(int operations, int maxShards, int accounts) {
+    if (maxShards < 1) {
+        maxShards = 1;
+    }
+    if (maxShards > MAX_SHARDS) {
+        maxShards = MAX_SHARDS;
+    }
+    struct BankAccount *table = calloc(accounts, sizeof(struct BankAccount));
+    for (int i = 0; i < accounts; i++) {
+        table[i].accountNumber = i + 1;
+        table[i].balance = POUNDS(1000);
+    }
+    registerAccounts(table, accounts, accounts);
+    pthread_t threads[MAX_SHARDS];
+    struct ShardBenchClient clients[MAX_SHARDS];
+    printf("operations: %d, accounts: %d, CPUs: %ld\n", operations, accounts, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %14s %10s %18s\n", "shards", "operations/s", "speedup", "busiest/quietest");
+    double base = 0;
+    for (int n = 1; n <= maxShards; n *= 2) {
+        // The workers log every request, as the front-ends do (without a journal).
+        removeBenchLog();
+        struct TransactionLogConfig config;
+        transactionLogDefaults(&config);
+        config.filename = BENCH_LOG_FILE;
+        config.index = false;
+        startTransactionLog(&config);
+        struct ShardedEngine *engine = startShardedEngine(table, accounts, n, n, true);
+        if (engine == NULL) {
+            stopTransactionLog();
+            break;
+        }
+        double start = nowSeconds();
+        for (int c = 0; c < n; c++) {
+            clients[c].engine = engine;
+            clients[c].client = c;
+            clients[c].accounts = accounts;
+            clients[c].operations = operations / n;
+            clients[c].seed = 88172645463325252ULL + (uint64_t)c * 7919;
+            pthread_create(&threads[c], NULL, shardBenchClient, &clients[c]);
+        }
+        for (int c = 0; c < n; c++) {
+            pthread_join(threads[c], NULL);
+        }
+        double rate = (double)(operations / n) * n / (nowSeconds() - start);
+        uint64_t processed[MAX_SHARDS];
+        shardedEngineStats(engine, processed);
+        uint64_t busiest = 0, quietest = UINT64_MAX;
+        for (int s = 0; s < n; s++) {
+            busiest = processed[s] > busiest ? processed[s] : busiest;
+            quietest = processed[s] < quietest ? processed[s] : quietest;
+        }
+        stopShardedEngine(engine, table, accounts);
+        stopTransactionLog();
+        if (n == 1) {
+            base = rate;
+        }
+        printf("%8d %14.0f %9.2fx %18.3f\n", n, rate, rate / base, quietest ? (double)busiest / quietest : 0.0);
+        if (n < maxShards && n * 2 > maxShards) {
+            n = maxShards / 2;
+        }
+    }
+    removeBenchLog();
+    releaseAccounts(table);
+}
+
+struct LogStressWorker {
+    int account;
+    int records;
+    double *latencies;
+};
+
+static void* logStressWorker(void *arg) {
+    struct LogStressWorker *worker = arg;
+    for (int i = 0; i < worker->records; i++) {
+        double before = nowSeconds();
+        appendTransactionLog(worker->account, TRANSACTION_DEPOSIT, POUNDS(i), POUNDS(i + 1));
+        worker->latencies[i] = (nowSeconds() - before) * 1e9;
+    }
+    return NULL;
+}
+
+// appendTransactionLog from 1 up to maxThreads producers at once: enqueue latency percentiles
+// over every call of every producer, and records logged per second including the final flush.
+static void benchLogStress(int maxThreads, int recordsPerThread) {
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+    pthread_t *threads = malloc(maxThreads * sizeof(pthread_t));
+    struct LogStressWorker *workers = malloc(maxThreads * sizeof(struct LogStressWorker));
+    double *latencies = malloc((size_t)maxThreads * recordsPerThread * sizeof(double));
+    printf("records per thread: %d\n", recordsPerThread);
+    printf("%8s %10s %10s %10s %10s %14s %10s\n", "threads", "p50 ns", "p99 ns", "p99.9 ns", "max ns", "records/s", "batches");
+    for (int n = 1; n <= maxThreads; n *= 2) {
+        removeBenchLog();
+        struct TransactionLogConfig config;
+        transactionLogDefaults(&config);
+        config.filename = BENCH_LOG_FILE;
+        config.index = false;
+        startTransactionLog(&config);
+        double start = nowSeconds();
+        for (int t = 0; t < n; t++) {
+            workers[t].account = t;
+            workers[t].records = recordsPerThread;
+            workers[t].latencies = latencies + (size_t)t * recordsPerThread;
+            pthread_create(&threads[t], NULL, logStressWorker, &workers[t]);
+        }
+        for (int t = 0; t < n; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        flushTransactionLog();
+        double elapsed = nowSeconds() - start;
+        uint64_t records, batches;
+        transactionLogStats(&records, &batches);
+        stopTransactionLog();
+        long total = (long)n * recordsPerThread;
+        qsort(latencies, total, sizeof(double), compareDoubles);
+        printf("%8d %10.0f %10.0f %10.0f %10.0f %14.0f %10llu\n", n, latencies[total / 2], latencies[total * 99 / 100],
+               latencies[total * 999 / 1000], latencies[total - 1], records / elapsed, (unsigned long long)batches);
+        if (n < maxThreads && n * 2 > maxThreads) {
+            n = maxThreads / 2;
+        }
+    }
+    free(latencies);
+    free(workers);
+    free(threads);
+    removeBenchLog();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <benchmark> [options]\n", argv[0]);
+        printf("  load [maxRows]   load time of accounts.csv from 1k rows up to maxRows (default 10M)\n");
+        printf("  parse [rows]     sscanf loader vs block/SIMD loader (default 1M rows)\n");
+        printf("  mmap [rows]      copying loader vs zero-copy mmap loader (default 1M rows)\n");
+        printf("  threads [rows] [maxThreads]  parallel loader scaling (default 1M rows, all CPUs)\n");
+        printf("  snapshot [rows]  boot time from accounts.csv vs a binary snapshot (default 1M rows)\n");
+        printf("  index [accounts] [stride]  findAccount: index vs linear scan (default 1M accounts, stride 13)\n");
+        printf("  store [accounts]  account array vs the reporting store: scan, and the refresh before each report (default 4M accounts)\n");
+        printf("  report [accounts] [maxThreads]  end-of-day totals: account array vs store, per kernel and thread count (default 10M accounts, all CPUs)\n");
+        printf("  save [accounts]  full rewrite vs dirty-record save (default 1M accounts)\n");
+        printf("  bgsave [accounts]  caller blocking time of a full save vs a background save (default 1M accounts)\n");
+        printf("  log [entries]    logTransaction latency: open/write/close per entry vs buffered logger, with and without rotation (default 200k)\n");
+        printf("  history [records] [accounts]  one account's log records: index vs full scan (default 2M records, 10k accounts)\n");
+        printf("  journal [operations] [maxThreads]  journaled deposits with group commit (default 20k, 16 threads)\n");
+        printf("  money [amounts]  formatting amounts: snprintf vs the integer formatters (default 10M)\n");
+        printf("  replay [records] [accounts] [maxThreads]  log replay over the account table (default 5M records, 100k accounts, all CPUs)\n");
+        printf("  batch [operations] [accounts] [batchSize]  withdraw/deposit per call vs applyTransactionBatch (default 1M operations, 100k accounts, batches of 10k)\n");
+        printf("  locks [operations] [maxThreads] [accounts]  thread-safe engine scaling, uniform and skewed cards (default 10M, all CPUs, 1M accounts)\n");
+        printf("  cas [operations] [maxThreads]  one hot account: stripe lock vs atomic compare-and-swap balances (default 10M, 16 threads)\n");
+        printf("  shards [operations] [maxShards] [accounts]  sharded engine throughput by shard count (default 10M, all CPUs, 1M accounts)\n");
+        printf("  logstress [maxThreads] [records]  concurrent logTransaction producers: enqueue latency percentiles (default 64 threads, 100k records each)\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "load") == 0) {
+        benchLoad(argc > 2 ? atol(argv[2]) : 10000000);
+    } else if (strcmp(argv[1], "parse") == 0) {
+        benchParse(argc > 2 ? atol(argv[2]) : 1000000);
+    } else if (strcmp(argv[1], "mmap") == 0) {
+        benchMmap(argc > 2 ? atol(argv[2]) : 1000000);
+    } else if (strcmp(argv[1], "threads") == 0) {
+        benchThreads(argc > 2 ? atol(argv[2]) : 1000000, argc > 3 ? atoi(argv[3]) : defaultLoadThreads());
+    } else if (strcmp(argv[1], "snapshot") == 0) {
+        benchSnapshot(argc > 2 ? atol(argv[2]) : 1000000);
+    } else if (strcmp(argv[1], "index") == 0) {
+        benchIndex(argc > 2 ? atoi(argv[2]) : 1000000, argc > 3 ? atoi(argv[3]) : 13);
+    } else if (strcmp(argv[1], "store") == 0) {
+        benchStore(argc > 2 ? atoi(argv[2]) : 4000000);
+    } else if (strcmp(argv[1], "report") == 0) {
+        benchReport(argc > 2 ? atoi(argv[2]) : 10000000, argc > 3 ? atoi(argv[3]) : defaultLoadThreads());
+    } else if (strcmp(argv[1], "save") == 0) {
+        benchSave(argc > 2 ? atoi(argv[2]) : 1000000);
+    } else if (strcmp(argv[1], "bgsave") == 0) {
+        benchBackgroundSave(argc > 2 ? atoi(argv[2]) : 1000000);
+    } else if (strcmp(argv[1], "log") == 0) {
+        benchLog(argc > 2 ? atoi(argv[2]) : 200000);
+    } else if (strcmp(argv[1], "history") == 0) {
+        benchHistory(argc > 2 ? atol(argv[2]) : 2000000, argc > 3 ? atoi(argv[3]) : 10000);
+    } else if (strcmp(argv[1], "journal") == 0) {
+        benchJournal(argc > 2 ? atoi(argv[2]) : 20000, argc > 3 ? atoi(argv[3]) : 16);
+    } else if (strcmp(argv[1], "money") == 0) {
+        benchMoney(argc > 2 ? atoi(argv[2]) : 10000000);
+    } else if (strcmp(argv[1], "replay") == 0) {
+        benchReplay(argc > 2 ? atol(argv[2]) : 5000000, argc > 3 ? atoi(argv[3]) : 100000,
+                    argc > 4 ? atoi(argv[4]) : defaultLoadThreads());
+    } else if (strcmp(argv[1], "batch") == 0) {
+        benchBatch(argc > 2 ? atoi(argv[2]) : 1000000, argc > 3 ? atoi(argv[3]) : 100000,
+                   argc > 4 ? atoi(argv[4]) : 10000);
+    } else if (strcmp(argv[1], "locks") == 0) {
+        benchLocks(argc > 2 ? atoi(argv[2]) : 10000000, argc > 3 ? atoi(argv[3]) : defaultLoadThreads(),
+                   argc > 4 ? atoi(argv[4]) : 1000000);
+    } else if (strcmp(argv[1], "cas") == 0) {
+        benchAtomicBalances(argc > 2 ? atoi(argv[2]) : 10000000, argc > 3 ? atoi(argv[3]) : 16);
+    } else if (strcmp(argv[1], "shards") == 0) {
+        benchShards(argc > 2 ? atoi(argv[2]) : 10000000, argc > 3 ? atoi(argv[3]) : defaultLoadThreads(),
+                    argc > 4 ? atoi(argv[4]) : 1000000);
+    } else if (strcmp(argv[1], "logstress") == 0) {
+        benchLogStress(argc > 2 ? atoi(argv[2]) : 64, argc > 3 ? atoi(argv[3]) : 100000);
+    } else {
+        printf("Unknown benchmark: %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
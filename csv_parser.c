@@ -0,0 +1,304 @@
+//
+// Block-based parser for accounts.csv.
+// Commas and newlines are located with SIMD compares (the "structural index"), then each
+// field is decoded directly from the buffer without going through sscanf.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "csv_parser.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CSV_HAVE_X86_SIMD 1
+#endif
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static size_t structuralScalarFrom(const char *buf, size_t start, size_t length, uint32_t *positions, size_t count) {
+    for (size_t i = start; i < length; i++) {
+        if (buf[i] == ',' || buf[i] == '\n') {
+            positions[count++] = (uint32_t)i;
+        }
+    }
+    return count;
+}
+
+size_t csvStructuralIndexScalar(const char *buf, size_t length, uint32_t *positions) {
+    return structuralScalarFrom(buf, 0, length, positions, 0);
+}
+
+#ifdef CSV_HAVE_X86_SIMD
+static size_t structuralSSE2(const char *buf, size_t length, uint32_t *positions) {
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, newline)));
+        while (mask != 0) {
+            positions[count++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return structuralScalarFrom(buf, i, length, positions, count);
+}
+
+__attribute__((target("avx2")))
+static size_t structuralAVX2(const char *buf, size_t length, uint32_t *positions) {
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, comma), _mm256_cmpeq_epi8(chunk, newline)));
+        while (mask != 0) {
+            positions[count++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return structuralScalarFrom(buf, i, length, positions, count);
+}
+#endif
+
+size_t csvStructuralIndex(const char *buf, size_t length, uint32_t *positions) {
+#ifdef CSV_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        return structuralAVX2(buf, length, positions);
+    }
+    return structuralSSE2(buf, length, positions);
+#else
+    return csvStructuralIndexScalar(buf, length, positions);
+#endif
+}
+
+// Decode "%d" from [p, end): optional whitespace, optional sign, at least one digit.
+// When wholeField is set nothing may follow the digits (the next character in the line is a comma).
+static bool parseIntField(const char *p, const char *end, bool wholeField, int *out) {
+    while (p < end && isSpace(*p)) p++;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    unsigned long long value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (unsigned)(*p - '0');
+        p++;
+    }
+    if (wholeField && p != end) {
+        return false;
+    }
+    *out = (int)(negative ? 0 - value : value);
+    return true;
+}
+
+bool csvParseAccountView(const char *line, size_t length, const uint32_t commas[4], struct AccountView *view) {
+    size_t nameLength = commas[1] - commas[0] - 1;
+    // %49[^,] needs at least one character and stops after 49, so a longer name can not reach its comma.
+    if (nameLength == 0 || nameLength >= sizeof(((struct BankAccount *)0)->accountHolder)) {
+        return false;
+    }
+    int blockedInt;
+    if (!parseIntField(line, line + commas[0], true, &view->accountNumber) ||
+        !parseMoney(line + commas[1] + 1, line + commas[2], &view->balance) ||
+        !parseIntField(line + commas[2] + 1, line + commas[3], true, &view->pinCode) ||
+        !parseIntField(line + commas[3] + 1, line + length, false, &blockedInt)) {
+        return false;
+    }
+    view->nameOffset = commas[0] + 1;
+    view->nameLength = (uint8_t)nameLength;
+    view->blocked = (blockedInt != 0);
+    return true;
+}
+
+bool csvParseAccountFields(const char *line, size_t length, const uint32_t commas[4], struct BankAccount *account) {
+    struct AccountView view;
+    if (!csvParseAccountView(line, length, commas, &view)) {
+        return false;
+    }
+    account->accountNumber = view.accountNumber;
+    memcpy(account->accountHolder, line + view.nameOffset, view.nameLength);
+    account->accountHolder[view.nameLength] = '\0';
+    account->balance = view.balance;
+    account->pinCode = view.pinCode;
+    account->blocked = view.blocked;
+    return true;
+}
+
+bool csvParseAccountLine(const char *line, size_t length, struct BankAccount *account) {
+    uint32_t commas[4];
+    int found = 0;
+    for (size_t i = 0; i < length && found < 4; i++) {
+        if (line[i] == ',') {
+            commas[found++] = (uint32_t)i;
+        }
+    }
+    return found == 4 && csvParseAccountFields(line, length, commas, account);
+}
+
+bool csvParseAccountLineScanf(const char *line, struct BankAccount *account) {
+    int accNum, pin, blockedInt;
+    double balance;
+    char name[50];
+    if (sscanf(line, "%d,%49[^,],%lf,%d,%d", &accNum, name, &balance, &pin, &blockedInt) != 5 ||
+        !moneyFromDouble(balance, &account->balance)) {
+        return false;
+    }
+    account->accountNumber = accNum;
+    strcpy(account->accountHolder, name);
+    account->pinCode = pin;
+    account->blocked = (blockedInt != 0);
+    return true;
+}
+
+void csvLoadStateInit(struct CsvLoadState *state, const char *filename) {
+    state->capacity = 16;
+    state->accounts = malloc(state->capacity * sizeof(struct BankAccount));
+    state->views = NULL;
+    state->base = NULL;
+    state->count = 0;
+    state->lineNumber = 0;
+    state->filename = filename;
+    state->deferWarnings = false;
+    state->skippedLines = NULL;
+    state->skippedCount = 0;
+    state->skippedCapacity = 0;
+}
+
+void csvLoadStateInitViews(struct CsvLoadState *state, const char *filename, const char *base) {
+    state->capacity = 16;
+    state->accounts = NULL;
+    state->views = malloc(state->capacity * sizeof(struct AccountView));
+    state->base = base;
+    state->count = 0;
+    state->lineNumber = 0;
+    state->filename = filename;
+    state->deferWarnings = false;
+    state->skippedLines = NULL;
+    state->skippedCount = 0;
+    state->skippedCapacity = 0;
+}
+
+// Make room for one more record, growing the array geometrically so loading stays linear.
+static bool reserveRecord(struct CsvLoadState *state) {
+    if (state->count < state->capacity) {
+        return true;
+    }
+    void *grown;
+    if (state->views != NULL) {
+        grown = realloc(state->views, 2 * state->capacity * sizeof(struct AccountView));
+    } else {
+        grown = realloc(state->accounts, 2 * state->capacity * sizeof(struct BankAccount));
+    }
+    if (grown == NULL) {
+        printf("Error: Out of memory after %d accounts from %s\n", state->count, state->filename);
+        return false;
+    }
+    if (state->views != NULL) {
+        state->views = grown;
+    } else {
+        state->accounts = grown;
+    }
+    state->capacity *= 2;
+    return true;
+}
+
+void csvReportSkippedLine(const char *filename, int lineNumber, bool tooLong) {
+    if (tooLong) {
+        printf("Warning: Line %d in %s is too long, skipping it.\n", lineNumber, filename);
+    } else {
+        printf("Warning: Malformed line %d in %s, skipping it.\n", lineNumber, filename);
+    }
+}
+
+static void skipLine(struct CsvLoadState *state, bool tooLong) {
+    if (!state->deferWarnings) {
+        csvReportSkippedLine(state->filename, state->lineNumber, tooLong);
+        return;
+    }
+    if (state->skippedCount == state->skippedCapacity) {
+        int capacity = state->skippedCapacity ? 2 * state->skippedCapacity : 16;
+        int *grown = realloc(state->skippedLines, capacity * sizeof(int));
+        if (grown == NULL) {
+            return;
+        }
+        state->skippedLines = grown;
+        state->skippedCapacity = capacity;
+    }
+    state->skippedLines[state->skippedCount++] = tooLong ? -state->lineNumber : state->lineNumber;
+}
+
+static void parseLine(struct CsvLoadState *state, const char *line, size_t length,
+                      const uint32_t commas[4], int commaCount) {
+    state->lineNumber++;
+    // Skip the header line.
+    if (state->lineNumber == 1) {
+        return;
+    }
+    if (length >= CSV_MAX_LINE) {
+        skipLine(state, true);
+        return;
+    }
+    size_t i = 0;
+    while (i < length && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) i++;
+    // Ignore blank lines (e.g. a trailing newline at the end of the file).
+    if (i == length) {
+        return;
+    }
+    if (!reserveRecord(state)) {
+        return;
+    }
+    bool parsed;
+    if (state->views != NULL) {
+        struct AccountView *view = &state->views[state->count];
+        parsed = commaCount == 4 && csvParseAccountView(line, length, commas, view);
+        view->nameOffset += (uint64_t)(line - state->base);
+    } else {
+        parsed = commaCount == 4 && csvParseAccountFields(line, length, commas, &state->accounts[state->count]);
+    }
+    if (!parsed) {
+        skipLine(state, false);
+        return;
+    }
+    state->count++;
+}
+
+size_t csvParseBlock(struct CsvLoadState *state, const char *buf, size_t length, bool final) {
+    uint32_t *positions = malloc((length + 1) * sizeof(uint32_t));
+    if (positions == NULL) {
+        printf("Error: Out of memory while parsing %s\n", state->filename);
+        return length;
+    }
+    size_t found = csvStructuralIndex(buf, length, positions);
+    size_t lineStart = 0;
+    uint32_t commas[4];
+    int commaCount = 0;
+    for (size_t k = 0; k < found; k++) {
+        uint32_t pos = positions[k];
+        if (buf[pos] == ',') {
+            if (commaCount < 4) {
+                commas[commaCount++] = (uint32_t)(pos - lineStart);
+            }
+            continue;
+        }
+        parseLine(state, buf + lineStart, pos - lineStart, commas, commaCount);
+        lineStart = pos + 1;
+        commaCount = 0;
+    }
+    if (final && lineStart < length) {
+        parseLine(state, buf + lineStart, length - lineStart, commas, commaCount);
+        lineStart = length;
+    }
+    free(positions);
+    return lineStart;
+}
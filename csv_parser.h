@@ -0,0 +1,67 @@
+#ifndef PROGRAMMING_ASSIGNMENT_CSV_PARSER_H
+#define PROGRAMMING_ASSIGNMENT_CSV_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "algorithm.h"
+
+// Size of the blocks read from disk when loading accounts.csv.
+#define CSV_BLOCK_SIZE (1 << 20)
+// Lines longer than this (newline included) are rejected, like the old fgets-based loader did.
+#define CSV_MAX_LINE 255
+
+// A parsed record whose holder name is left in the source buffer as (offset, length).
+struct AccountView {
+    int accountNumber;
+    int pinCode;
+    Money balance;
+    uint64_t nameOffset;   // Offset of the name from the start of the buffer passed to csvLoadStateInitViews
+    uint8_t nameLength;
+    bool blocked;
+};
+
+// Accounts parsed so far, plus what is needed to report malformed lines.
+struct CsvLoadState {
+    struct BankAccount *accounts;
+    struct AccountView *views;  // Used instead of accounts when the names stay in place
+    const char *base;           // Start of the buffer that view name offsets refer to
+    int count;
+    int capacity;
+    int lineNumber;        // Number of the last line seen; line 1 is the header
+    const char *filename;  // Used in warnings only
+    // When deferWarnings is set, skipped lines are collected here instead of being printed
+    // (negative numbers for lines that were too long), so a parallel loader can renumber them.
+    bool deferWarnings;
+    int *skippedLines;
+    int skippedCount;
+    int skippedCapacity;
+};
+
+// Structural index: writes the offset of every ',' and '\n' in buf[0..length) to positions
+// (which must hold up to length entries) and returns how many were found.
+// Uses AVX2 or SSE2 when the CPU supports it and a scalar loop otherwise.
+size_t csvStructuralIndex(const char *buf, size_t length, uint32_t *positions);
+size_t csvStructuralIndexScalar(const char *buf, size_t length, uint32_t *positions);
+
+// Parse one record (without its '\n') given the offsets of its first four commas.
+// Accepts exactly what sscanf("%d,%49[^,],%lf,%d,%d") accepts, as long as the balance is a finite
+// amount that fits in Money; the balance is converted exactly (see parseMoney).
+bool csvParseAccountFields(const char *line, size_t length, const uint32_t commas[4], struct BankAccount *account);
+// Same as above but leaves the name in place; view->nameOffset is relative to line.
+bool csvParseAccountView(const char *line, size_t length, const uint32_t commas[4], struct AccountView *view);
+// Same as csvParseAccountFields but locates the commas itself.
+bool csvParseAccountLine(const char *line, size_t length, struct BankAccount *account);
+// Reference implementation based on sscanf, kept for tests and benchmarks.
+bool csvParseAccountLineScanf(const char *line, struct BankAccount *account);
+
+void csvLoadStateInit(struct CsvLoadState *state, const char *filename);
+// Collect AccountViews instead of BankAccounts; every block parsed must lie inside the buffer at base.
+void csvLoadStateInitViews(struct CsvLoadState *state, const char *filename, const char *base);
+// Print the warning for a line that was skipped.
+void csvReportSkippedLine(const char *filename, int lineNumber, bool tooLong);
+// Parse every complete line of buf[0..length) into state. Returns the number of bytes consumed;
+// the unconsumed tail is an incomplete line. When final is true the tail is parsed as the last line.
+size_t csvParseBlock(struct CsvLoadState *state, const char *buf, size_t length, bool final);
+
+#endif // PROGRAMMING_ASSIGNMENT_CSV_PARSER_H
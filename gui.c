@@ -7,6 +7,15 @@
 #include <stdio.h>
 #include <string.h>
 #include "algorithm.h"  // Your ATM functions: checkPin, dep, withdraw, changePin
+#include "parallel_loader.h"
+#include "snapshot.h"
+#include "account_index.h"
+#include "journal.h"
+
+// Accounts file the GUI boots from (CSV or binary snapshot); set with --accounts FILE.
+static const char *accounts_file = "accounts.csv";
+static struct BankAccount *accounts = NULL;
+static int account_count = 0;
 
 // Structure to hold account data and pointers to UI widgets.
 typedef struct {
@@ -59,16 +68,12 @@ typedef struct {
     GtkWidget *error_label;
     GtkWidget *error_back_button;
 
-    // Two hardcoded accounts.
-    struct BankAccount account1;
-    struct BankAccount account2;
-
     // Pointer to the currently active account.
     struct BankAccount *active_account;
 
     // Fields to store the original balance before a transaction,
     // and the type of transaction ("Deposit" or "Withdrawal").
-    double original_balance;
+    Money original_balance;
     char transaction_type[50];
 
     // Field to track the number of incorrect PIN attempts.
@@ -77,8 +82,9 @@ typedef struct {
 
 // Utility: update balance label to display the actual balance.
 void update_balance_label(AppData *app_data) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "Balance: £%.2f", app_data->active_account->balance);
+    char buf[64], balance[MONEY_TEXT_SIZE];
+    formatMoneyDisplay(app_data->active_account->balance, balance, sizeof(balance));
+    snprintf(buf, sizeof(buf), "Balance: %s", balance);
     gtk_label_set_text(GTK_LABEL(app_data->balance_label), buf);
 }
 
@@ -99,10 +105,21 @@ static void on_card_selected(GtkWidget *widget, gpointer user_data) {
     AppData *app_data = (AppData *)user_data;
     const gchar *button_label = gtk_button_get_label(GTK_BUTTON(widget));
 
-    if (g_strcmp0(button_label, "Card 1") == 0)
-        app_data->active_account = &app_data->account1;
-    else
-        app_data->active_account = &app_data->account2;
+    int card_number = g_strcmp0(button_label, "Card 1") == 0 ? 1 : 2;
+    app_data->active_account = findAccount(accounts, account_count, card_number);
+
+    // If the selected card is not in the accounts file, show an error dialog.
+    if (app_data->active_account == NULL) {
+        GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(app_data->main_window),
+                                                   GTK_DIALOG_MODAL,
+                                                   GTK_MESSAGE_ERROR,
+                                                   GTK_BUTTONS_OK,
+                                                   "This card is not known to the bank.");
+        gtk_window_set_transient_for(GTK_WINDOW(dialog), GTK_WINDOW(app_data->main_window));
+        g_signal_connect(dialog, "response", G_CALLBACK(gtk_window_destroy), dialog);
+        gtk_window_present(GTK_WINDOW(dialog));
+        return;
+    }
 
     // If the selected card is blocked, show an error dialog.
     if (app_data->active_account->blocked) {
@@ -136,7 +153,7 @@ static void on_pin_submit(GtkWidget *widget, gpointer user_data) {
     } else {
         app_data->pin_attempts++;
         if (app_data->pin_attempts >= 3) {
-            app_data->active_account->blocked = true;
+            blockAccount(app_data->active_account);
             GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(app_data->main_window),
                                                        GTK_DIALOG_MODAL,
                                                        GTK_MESSAGE_ERROR,
@@ -163,7 +180,8 @@ static void on_submit_new_pin(GtkWidget *widget, gpointer user_data) {
     const char *new_pin2_str = gtk_editable_get_text(GTK_EDITABLE(app_data->new_pin_entry2));
     int new_pin1 = atoi(new_pin1_str);
     int new_pin2 = atoi(new_pin2_str);
-    const char *result = changePin(app_data->active_account, new_pin1, new_pin2);
+    char result[100];
+    enum OperationStatus status = updatePin(app_data->active_account, new_pin1, new_pin2, result, sizeof(result));
 
     /* Clear all children from the change PIN screen */
     GtkWidget *child = gtk_widget_get_first_child(app_data->change_pin_screen);
@@ -175,7 +193,7 @@ static void on_submit_new_pin(GtkWidget *widget, gpointer user_data) {
 
     /* Prepare a result message. If successful, include the new PIN. */
     char message[128];
-    if (strstr(result, "successfully") != NULL) {
+    if (status == STATUS_OK) {
         snprintf(message, sizeof(message), "%s New PIN: %d", result, new_pin1);
     } else {
         snprintf(message, sizeof(message), "%s", result);
@@ -230,6 +248,12 @@ static void on_back_to_card_selection(GtkWidget *widget, gpointer user_data) {
     switch_screen(app_data, "card_selection");
 }
 
+// Periodically save the accounts so the journal does not grow without bound.
+static gboolean on_checkpoint_timer(gpointer user_data) {
+    journalCheckpointIfDue(accounts_file, accounts, account_count);
+    return G_SOURCE_CONTINUE;
+}
+
 // Quit callback.
 static void on_quit(GtkWidget *widget, gpointer user_data) {
     g_application_quit(G_APPLICATION(user_data));
@@ -239,17 +263,19 @@ static void on_quit(GtkWidget *widget, gpointer user_data) {
 // This creates a separate window showing the receipt.
 static void on_receipt_yes(GtkWidget *widget, gpointer user_data) {
     AppData *app_data = (AppData *)user_data;
-    char receipt_text[512];
+    char receipt_text[512], original[MONEY_TEXT_SIZE], updated[MONEY_TEXT_SIZE];
+    formatMoneyDisplay(app_data->original_balance, original, sizeof(original));
+    formatMoneyDisplay(app_data->active_account->balance, updated, sizeof(updated));
     snprintf(receipt_text, sizeof(receipt_text),
              "---- Transaction Receipt ----\n"
              "Transaction: %s\n"
-             "Original Balance: £%.2f\n"
-             "New Balance: £%.2f\n"
+             "Original Balance: %s\n"
+             "New Balance: %s\n"
              "Thank you, %s\n"
              "------------------------------",
              app_data->transaction_type,
-             app_data->original_balance,
-             app_data->active_account->balance,
+             original,
+             updated,
              app_data->active_account->accountHolder);
 
     GtkWidget *receipt_window = gtk_application_window_new(
@@ -307,11 +333,12 @@ static void on_balance_back(GtkWidget *widget, gpointer data) {
 static void on_deposit_confirm(GtkWidget *widget, gpointer user_data) {
     AppData *app_data = (AppData *)user_data;
     const char *amount_str = gtk_editable_get_text(GTK_EDITABLE(app_data->amount_entry));
-    double amount = atof(amount_str);
+    Money amount = 0;  // Not a number: rejected as an invalid amount
+    parseMoneyString(amount_str, &amount);
     app_data->original_balance = app_data->active_account->balance;
     strcpy(app_data->transaction_type, "Deposit");
-    const char *result = deposit(app_data->active_account, amount);
-    if (strstr(result, "successful") != NULL) {
+    char result[100];
+    if (depositFunds(app_data->active_account, amount, result, sizeof(result)) == STATUS_OK) {
         switch_screen(app_data, "receipt_menu");
     } else {
         gtk_label_set_text(GTK_LABEL(app_data->error_label), result);
@@ -322,11 +349,12 @@ static void on_deposit_confirm(GtkWidget *widget, gpointer user_data) {
 static void on_withdraw_confirm(GtkWidget *widget, gpointer user_data) {
     AppData *app_data = (AppData *)user_data;
     const char *amount_str = gtk_editable_get_text(GTK_EDITABLE(app_data->withdraw_entry));
-    double amount = atof(amount_str);
+    Money amount = 0;  // Not a number: rejected as an invalid amount
+    parseMoneyString(amount_str, &amount);
     app_data->original_balance = app_data->active_account->balance;
     strcpy(app_data->transaction_type, "Withdrawal");
-    const char *result = withdraw(app_data->active_account, amount);
-    if (strstr(result, "successful") != NULL) {
+    char result[100];
+    if (withdrawFunds(app_data->active_account, amount, result, sizeof(result)) == STATUS_OK) {
         switch_screen(app_data, "receipt_menu");
     } else {
         gtk_label_set_text(GTK_LABEL(app_data->error_label), result);
@@ -336,8 +364,9 @@ static void on_withdraw_confirm(GtkWidget *widget, gpointer user_data) {
 
 static void on_show_balance_full(GtkWidget *widget, gpointer user_data) {
     AppData *app_data = (AppData *)user_data;
-    char buf[128];
-    snprintf(buf, sizeof(buf), "Your Balance:\n£%.2f", app_data->active_account->balance);
+    char buf[128], balance[MONEY_TEXT_SIZE];
+    formatMoneyDisplay(app_data->active_account->balance, balance, sizeof(balance));
+    snprintf(buf, sizeof(buf), "Your Balance:\n%s", balance);
     gtk_label_set_text(GTK_LABEL(app_data->balance_label), buf);
     switch_screen(app_data, "balance_full");
 }
@@ -548,17 +577,6 @@ static void activate(GtkApplication *app, gpointer user_data) {
     g_signal_connect(app_data->error_back_button, "clicked", G_CALLBACK(on_error_back), app_data);
     gtk_stack_add_named(GTK_STACK(app_data->stack), app_data->error_screen, "error");
 
-    /* ------------------ Initialize Hardcoded Accounts ------------------ */
-    app_data->account1.accountNumber = 1;
-    snprintf(app_data->account1.accountHolder, sizeof(app_data->account1.accountHolder), "Kirill Tumoian");
-    app_data->account1.balance = 1234.60;
-    app_data->account1.pinCode = 1234;
-    app_data->account1.blocked = false;
-    app_data->account2.accountNumber = 2;
-    snprintf(app_data->account2.accountHolder, sizeof(app_data->account2.accountHolder), "Andrew Bradley");
-    app_data->account2.balance = 848.50;
-    app_data->account2.pinCode = 5678;
-    app_data->account2.blocked = false;
     switch_screen(app_data, "card_selection");
     gtk_window_set_child(GTK_WINDOW(window), app_data->stack);
     gtk_window_present(GTK_WINDOW(window));
@@ -566,9 +584,38 @@ static void activate(GtkApplication *app, gpointer user_data) {
 
 
 int main(int argc, char *argv[]) {
+    // Take --accounts FILE out of the arguments before GTK sees them.
+    int gtk_argc = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--accounts") == 0 && i + 1 < argc) {
+            accounts_file = argv[++i];
+        } else {
+            argv[gtk_argc++] = argv[i];
+        }
+    }
+    argc = gtk_argc;
+    // Boot from the accounts file and write it back, in the same format, on exit.
+    accounts = loadAccounts(accounts_file, &account_count, defaultLoadThreads());
+    if (account_count == 0) {
+        printf("No accounts loaded. Exiting.\n");
+        return 1;
+    }
+    printAccountIndexInfo(accounts, account_count);
+    // Replay changes journaled since the last save (e.g. before a crash), then keep journaling.
+    char journal_file[4096];
+    snprintf(journal_file, sizeof(journal_file), "%s.journal", accounts_file);
+    int recovered = journalReplay(journal_file, accounts, account_count);
+    if (recovered > 0) {
+        printf("Recovered %d journaled changes from %s\n", recovered, journal_file);
+    }
+    journalOpen(journal_file);
     GtkApplication *app = gtk_application_new("com.example.ATM", G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
+    g_timeout_add_seconds(5, on_checkpoint_timer, NULL);
     int status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
+    // Save the accounts; the journal is emptied once they are on disk.
+    journalCheckpoint(accounts_file, accounts, account_count);
+    journalClose();
     return status;
 }
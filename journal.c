@@ -0,0 +1,414 @@
+//
+// Write-ahead journal for account changes, with group commit.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "snapshot.h"
+#include "account_index.h"
+
+static pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journalSynced = PTHREAD_COND_INITIALIZER;
+static int journalFd = -1;
+static uint64_t appendedSequence;     // Last record written to the file
+static uint64_t durableSequence;      // Last record known to be on disk
+static bool syncInProgress;
+static uint64_t syncCount;
+static uint64_t recordsSinceCheckpoint;
+static time_t lastCheckpoint;
+static char journalName[4096];
+
+// Changes made in memory whose records are not written (or taken back) yet, and whether a
+// checkpoint is waiting for them to finish before it copies the accounts.
+static pthread_mutex_t changeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changesSettled = PTHREAD_COND_INITIALIZER;
+static int changesInFlight;
+static bool changesFrozen;
+static bool changeTracking;
+
+static uint32_t recordChecksum(const struct JournalRecord *record) {
+    const unsigned char *bytes = (const unsigned char *)record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(struct JournalRecord, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int replayFile(const char *filename, struct BankAccount *accounts, int accountCount) {
+    int fd = open(filename, O_RDWR);
+    if (fd < 0) {
+        return 0;
+    }
+    struct JournalRecord record;
+    int applied = 0;
+    off_t validEnd = 0;
+    while (read(fd, &record, sizeof(record)) == (ssize_t)sizeof(record) &&
+           record.checksum == recordChecksum(&record)) {
+        struct BankAccount *account = findAccount(accounts, accountCount, record.accountNumber);
+        if (account == NULL) {
+            printf("Warning: Journal entry for unknown account %d ignored.\n", record.accountNumber);
+        } else {
+            if (record.units == JOURNAL_MINOR_UNITS) {
+                account->balance = record.balance;
+            } else {
+                double pounds;
+                memcpy(&pounds, &record.balance, sizeof(pounds));
+                moneyFromDouble(pounds, &account->balance);
+            }
+            account->pinCode = record.pinCode;
+            account->blocked = record.blocked != 0;
+            // Replayed changes are not in the accounts file yet.
+            markAccountDirty(account);
+            applied++;
+        }
+        validEnd += (off_t)sizeof(record);
+    }
+    // Drop a torn or damaged tail so that new records follow the last good one.
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size != validEnd) {
+        printf("Warning: Discarding %ld damaged bytes at the end of %s\n", (long)(info.st_size - validEnd), filename);
+        if (ftruncate(fd, validEnd) != 0) {
+            printf("Error: Could not truncate %s\n", filename);
+        }
+    }
+    close(fd);
+    return applied;
+}
+
+int journalReplay(const char *filename, struct BankAccount *accounts, int accountCount) {
+    // A journal rotated out by an interrupted background checkpoint holds the older records.
+    // Records carry the full account state, so replaying ones the accounts file already has is harmless.
+    char rotated[4112];
+    snprintf(rotated, sizeof(rotated), "%s.1", filename);
+    int applied = replayFile(rotated, accounts, accountCount);
+    return applied + replayFile(filename, accounts, accountCount);
+}
+
+bool journalOpen(const char *filename) {
+    pthread_mutex_lock(&journalLock);
+    if (journalFd >= 0) {
+        close(journalFd);
+    }
+    journalFd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    snprintf(journalName, sizeof(journalName), "%s", filename);
+    appendedSequence = durableSequence = 0;
+    syncCount = recordsSinceCheckpoint = 0;
+    lastCheckpoint = time(NULL);
+    __atomic_store_n(&changeTracking, journalFd >= 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&journalLock);
+    if (journalFd < 0) {
+        printf("Error: Could not open journal %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+void journalClose() {
+    pthread_mutex_lock(&journalLock);
+    if (journalFd >= 0) {
+        fdatasync(journalFd);
+        close(journalFd);
+        journalFd = -1;
+    }
+    __atomic_store_n(&changeTracking, false, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&journalLock);
+}
+
+bool journalIsOpen() {
+    return journalFd >= 0;
+}
+
+bool journalBeginChange() {
+    // Without a journal there are no checkpoints to hold off, and no shared lock to take.
+    if (!__atomic_load_n(&changeTracking, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    pthread_mutex_lock(&changeLock);
+    while (changesFrozen) {
+        pthread_cond_wait(&changesSettled, &changeLock);
+    }
+    changesInFlight++;
+    pthread_mutex_unlock(&changeLock);
+    return true;
+}
+
+void journalEndChange(bool begun) {
+    if (!begun) {
+        return;
+    }
+    pthread_mutex_lock(&changeLock);
+    if (--changesInFlight == 0 && changesFrozen) {
+        pthread_cond_broadcast(&changesSettled);
+    }
+    pthread_mutex_unlock(&changeLock);
+}
+
+// Wait until no change is half done and hold off new ones, so that the accounts can be copied
+// with every change in them recorded; thawChanges() lets them run again.
+static void freezeChanges() {
+    pthread_mutex_lock(&changeLock);
+    // One checkpoint at a time: a second one waits for the first to thaw.
+    while (changesFrozen) {
+        pthread_cond_wait(&changesSettled, &changeLock);
+    }
+    changesFrozen = true;
+    while (changesInFlight > 0) {
+        pthread_cond_wait(&changesSettled, &changeLock);
+    }
+    pthread_mutex_unlock(&changeLock);
+}
+
+static void thawChanges() {
+    pthread_mutex_lock(&changeLock);
+    changesFrozen = false;
+    pthread_cond_broadcast(&changesSettled);
+    pthread_mutex_unlock(&changeLock);
+}
+
+bool journalAccount(const struct BankAccount *account) {
+    return journalAccounts(&account, 1);
+}
+
+// Records written with one write() by journalAccounts(); larger sets take several.
+#define JOURNAL_WRITE_RECORDS 256
+
+// Called with the lock held and the journal open: append the records of accounts, each with
+// credits[i] (if credits is not NULL) added to the balance it carries. A set that can not be
+// written in full is taken back.
+static bool writeRecords(const struct BankAccount *const *accounts, const Money *credits, int count) {
+    struct JournalRecord records[JOURNAL_WRITE_RECORDS];
+    // Where the records start, so that a set that is only partly written can be taken back.
+    off_t start = lseek(journalFd, 0, SEEK_END);
+    uint64_t startSequence = appendedSequence;
+    for (int done = 0; done < count; ) {
+        int n = count - done < JOURNAL_WRITE_RECORDS ? count - done : JOURNAL_WRITE_RECORDS;
+        memset(records, 0, (size_t)n * sizeof(struct JournalRecord));
+        for (int i = 0; i < n; i++) {
+            const struct BankAccount *account = accounts[done + i];
+            struct JournalRecord *record = &records[i];
+            record->sequence = appendedSequence + 1 + (uint64_t)i;
+            record->accountNumber = account->accountNumber;
+            record->pinCode = account->pinCode;
+            // The latest balance, also with atomic balances, and the credit about to be added to it
+            record->balance = accountBalance(account) + (credits != NULL ? credits[done + i] : 0);
+            record->blocked = account->blocked;
+            record->units = JOURNAL_MINOR_UNITS;
+            record->checksum = recordChecksum(record);
+        }
+        size_t length = (size_t)n * sizeof(struct JournalRecord);
+        if (write(journalFd, records, length) != (ssize_t)length) {
+            if (start >= 0 && ftruncate(journalFd, start) == 0) {
+                recordsSinceCheckpoint -= appendedSequence - startSequence;
+                appendedSequence = startSequence;
+            }
+            return false;
+        }
+        appendedSequence += (uint64_t)n;
+        recordsSinceCheckpoint += (uint64_t)n;
+        done += n;
+    }
+    return true;
+}
+
+// Called with the lock held: wait until everything appended so far is on disk, then unlock.
+static bool syncRecords() {
+    uint64_t mine = appendedSequence;
+    // Group commit: whoever finds no sync running syncs everything appended so far; the others
+    // wait for a sync that covers their record.
+    bool ok = true;
+    while (durableSequence < mine) {
+        if (syncInProgress) {
+            pthread_cond_wait(&journalSynced, &journalLock);
+            continue;
+        }
+        syncInProgress = true;
+        uint64_t target = appendedSequence;
+        int fd = journalFd;
+        pthread_mutex_unlock(&journalLock);
+        ok = fdatasync(fd) == 0;
+        pthread_mutex_lock(&journalLock);
+        syncInProgress = false;
+        syncCount++;
+        if (ok && target > durableSequence) {
+            durableSequence = target;
+        }
+        pthread_cond_broadcast(&journalSynced);
+        if (!ok) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&journalLock);
+    return ok;
+}
+
+bool journalAccounts(const struct BankAccount *const *accounts, int count) {
+    pthread_mutex_lock(&journalLock);
+    if (journalFd < 0 || count <= 0) {
+        pthread_mutex_unlock(&journalLock);
+        return true;
+    }
+    if (!writeRecords(accounts, NULL, count)) {
+        pthread_mutex_unlock(&journalLock);
+        return false;
+    }
+    return syncRecords();
+}
+
+bool journalCredits(struct BankAccount *const *accounts, const Money *credits, Money *before, int count) {
+    pthread_mutex_lock(&journalLock);
+    if (journalFd >= 0 && count > 0 && !writeRecords((const struct BankAccount *const *)accounts, credits, count)) {
+        pthread_mutex_unlock(&journalLock);
+        return false;
+    }
+    // Added while the lock is still held, so that every later record of these accounts has them.
+    for (int i = 0; i < count; i++) {
+        Money balance = accountBalance(accounts[i]);
+        if (credits[i] > 0) {
+            creditAccount(accounts[i], credits[i], &balance);
+        }
+        if (before != NULL) {
+            before[i] = balance;
+        }
+    }
+    if (journalFd < 0 || count <= 0) {
+        pthread_mutex_unlock(&journalLock);
+        return true;
+    }
+    return syncRecords();
+}
+
+// fsync a file by name (and its directory, so a rename into place is durable too).
+static bool syncFile(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    syncDirectoryOf(filename);
+    return ok;
+}
+
+// Name of the journal that was rotated out when the running (or a failed) background
+// checkpoint started. Its records are covered by the accounts file once that save succeeds.
+static void rotatedJournalName(char *name, size_t size) {
+    snprintf(name, size, "%s.1", journalName);
+}
+
+// Called with journalLock held: collect the result of a background checkpoint. Returns true
+// while one is still running.
+static bool finishBackgroundCheckpoint(bool wait) {
+    enum BackgroundSaveState state = pollBackgroundSave(wait);
+    if (state == BACKGROUND_SAVE_DONE) {
+        char rotated[4112];
+        rotatedJournalName(rotated, sizeof(rotated));
+        if (remove(rotated) == 0) {
+            syncDirectoryOf(rotated);
+        }
+    }
+    return state == BACKGROUND_SAVE_RUNNING;
+}
+
+bool journalCheckpoint(const char *accountsFile, struct BankAccount *accounts, int accountCount) {
+    // Appends wait until the checkpoint is done, so no record can fall between the save and the
+    // truncate; changes wait too, so none that may still be taken back is saved.
+    freezeChanges();
+    pthread_mutex_lock(&journalLock);
+    while (syncInProgress) {
+        pthread_cond_wait(&journalSynced, &journalLock);
+    }
+    finishBackgroundCheckpoint(true);
+    // Only a save that reports success may empty the journal: the old accounts file would sync
+    // just as well, without the changes the journal holds.
+    bool ok = saveAccounts(accountsFile, accounts, accountCount) && syncFile(accountsFile);
+    if (ok && journalFd >= 0) {
+        ok = ftruncate(journalFd, 0) == 0 && fdatasync(journalFd) == 0;
+        char rotated[4112];
+        rotatedJournalName(rotated, sizeof(rotated));
+        if (ok && remove(rotated) == 0) {
+            syncDirectoryOf(rotated);
+        }
+    }
+    if (ok) {
+        recordsSinceCheckpoint = 0;
+        lastCheckpoint = time(NULL);
+    } else {
+        printf("Error: Checkpoint of %s failed; keeping the journal.\n", accountsFile);
+    }
+    pthread_mutex_unlock(&journalLock);
+    thawChanges();
+    return ok;
+}
+
+bool journalCheckpointInBackground(const char *accountsFile, struct BankAccount *accounts, int accountCount) {
+    // Changes are held off until the accounts are copied, so the copy has none that is not in the
+    // journal yet (and may still be taken back) ...
+    freezeChanges();
+    pthread_mutex_lock(&journalLock);
+    if (journalFd < 0 || finishBackgroundCheckpoint(false)) {
+        pthread_mutex_unlock(&journalLock);
+        thawChanges();
+        return false;
+    }
+    // ... and appends from here to the copy, so every record in the rotated journal is in it.
+    // The sync of the old file must not race with the rotation.
+    while (syncInProgress) {
+        pthread_cond_wait(&journalSynced, &journalLock);
+    }
+    char rotated[4112];
+    rotatedJournalName(rotated, sizeof(rotated));
+    // If a rotated journal is left over from a failed checkpoint its records are not saved yet;
+    // keep it and keep appending to the current journal, which is rotated next time instead.
+    if (access(rotated, F_OK) != 0) {
+        int fd = -1;
+        if (fdatasync(journalFd) == 0 && rename(journalName, rotated) == 0) {
+            fd = open(journalName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd < 0) {
+                rename(rotated, journalName);
+            }
+        }
+        if (fd < 0) {
+            printf("Error: Could not rotate journal %s\n", journalName);
+            pthread_mutex_unlock(&journalLock);
+            thawChanges();
+            return false;
+        }
+        close(journalFd);
+        journalFd = fd;
+        durableSequence = appendedSequence;
+        syncDirectoryOf(journalName);
+    }
+    bool ok = saveAccountsInBackground(accountsFile, accounts, accountCount);
+    if (ok) {
+        recordsSinceCheckpoint = 0;
+        lastCheckpoint = time(NULL);
+    }
+    pthread_mutex_unlock(&journalLock);
+    thawChanges();
+    return ok;
+}
+
+bool journalCheckpointIfDue(const char *accountsFile, struct BankAccount *accounts, int accountCount) {
+    pthread_mutex_lock(&journalLock);
+    bool running = finishBackgroundCheckpoint(false);
+    bool due = !running && journalFd >= 0 && recordsSinceCheckpoint > 0 &&
+               (recordsSinceCheckpoint >= JOURNAL_CHECKPOINT_RECORDS ||
+                time(NULL) - lastCheckpoint >= JOURNAL_CHECKPOINT_SECONDS);
+    pthread_mutex_unlock(&journalLock);
+    return due ? journalCheckpointInBackground(accountsFile, accounts, accountCount) : true;
+}
+
+void journalStats(uint64_t *records, uint64_t *syncs) {
+    pthread_mutex_lock(&journalLock);
+    *records = appendedSequence;
+    *syncs = syncCount;
+    pthread_mutex_unlock(&journalLock);
+}
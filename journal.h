@@ -0,0 +1,72 @@
+#ifndef PROGRAMMING_ASSIGNMENT_JOURNAL_H
+#define PROGRAMMING_ASSIGNMENT_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "algorithm.h"
+
+// Write-ahead journal: every change to an account is appended (and made durable) before the
+// operation reports success. On startup the journal is replayed over the last saved accounts;
+// a checkpoint saves the accounts and empties the journal.
+
+// A checkpoint is due after this many records or this many seconds, whichever comes first.
+#define JOURNAL_CHECKPOINT_RECORDS 1000
+#define JOURNAL_CHECKPOINT_SECONDS 60
+
+// Value of JournalRecord.units; journals written before balances were Money have 0 there.
+#define JOURNAL_MINOR_UNITS 1
+
+// One journal entry: the full state of an account after a change, so replay is idempotent.
+struct JournalRecord {
+    uint64_t sequence;
+    int32_t accountNumber;
+    int32_t pinCode;
+    Money balance;          // Minor units; a double in pounds if units is not JOURNAL_MINOR_UNITS
+    uint8_t blocked;
+    uint8_t units;
+    uint8_t reserved[2];
+    uint32_t checksum;      // FNV-1a of the bytes before it; a torn write at the tail fails it
+};
+
+// Apply the records of filename (after those of a journal rotated out to filename.1 by an
+// unfinished background checkpoint) to accounts. Stops at the first damaged record of a file and
+// cuts the file there. Returns the number of records applied, or 0 if there is no journal.
+int journalReplay(const char *filename, struct BankAccount *accounts, int accountCount);
+// Start journaling to filename (appending to it). Returns false if it can not be opened.
+bool journalOpen(const char *filename);
+void journalClose();
+bool journalIsOpen();
+// Append the current state of account and wait until it is on disk. Operations running at the
+// same time share one fsync (group commit). Returns true when no journal is open.
+bool journalAccount(const struct BankAccount *account);
+// Same for several accounts, with one write per JOURNAL_WRITE_RECORDS records and one fsync.
+bool journalAccounts(const struct BankAccount *const *accounts, int count);
+// Journal accounts as they will be once credits[i] is added to their balances, and add the credits
+// (those above zero) right after the records are written, before the fsync: a credit is never
+// published before it is in the journal, so a failed write has nothing to take back that someone
+// may already have spent. With atomic balances this is how deposits are made. before[i], if before
+// is not NULL, gets the balance the credit was added to. If the fsync then fails the credits stay
+// (their records are in the journal, which wins on the next start) and false is returned.
+bool journalCredits(struct BankAccount *const *accounts, const Money *credits, Money *before, int count);
+// A change is made in memory before its record is written, and taken back if the write fails.
+// Operations that can take a change back bracket it, from before it is made (and before any
+// account lock is taken) until it is journaled or taken back, with journalBeginChange() and
+// journalEndChange(its result); checkpoints copy the accounts only while no change is in between.
+// Returns false, and costs nothing, when no journal is open.
+bool journalBeginChange();
+void journalEndChange(bool begun);
+// Save accounts to accountsFile durably, then empty the journal. Waits for a background checkpoint.
+// If the save fails the journal is kept (and returns false), so it is replayed on the next start.
+bool journalCheckpoint(const char *accountsFile, struct BankAccount *accounts, int accountCount);
+// Rotate the journal to <journal>.1 and save a copy of accounts on a background thread (see
+// saveAccountsInBackground); sessions keep running meanwhile. The rotated journal is deleted
+// once a later journalCheckpointIfDue() or journalCheckpoint() sees that the save succeeded.
+// Returns false if a background checkpoint is still running or could not be started.
+bool journalCheckpointInBackground(const char *accountsFile, struct BankAccount *accounts, int accountCount);
+// Collect a finished background checkpoint, and start a new one if JOURNAL_CHECKPOINT_RECORDS
+// or JOURNAL_CHECKPOINT_SECONDS have passed since the last one.
+bool journalCheckpointIfDue(const char *accountsFile, struct BankAccount *accounts, int accountCount);
+// Records appended and fsyncs issued since journalOpen().
+void journalStats(uint64_t *records, uint64_t *syncs);
+
+#endif // PROGRAMMING_ASSIGNMENT_JOURNAL_H
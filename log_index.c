@@ -0,0 +1,613 @@
+//
+// Per-account index over the transaction log.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "log_index.h"
+
+_Static_assert(sizeof(struct LogIndexEntry) == 16, "log index entries must be 16 bytes");
+
+// Header of "<log>.idx"; the same layout as the log header.
+struct LogIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entrySize;
+};
+
+static void indexFileName(const char *logFile, char *name, size_t size) {
+    snprintf(name, size, "%s.idx", logFile);
+}
+
+// Called with the lock held (or before the index is shared) when memory runs out: the index stops
+// changing, lookups fail, and closeLogIndex() rebuilds the file from the log.
+static void markBroken(struct LogIndex *index) {
+    if (!index->broken) {
+        printf("Error: Out of memory in the log index of %s; it is rebuilt from the log when closed.\n",
+               index->logFile);
+        index->broken = true;
+    }
+}
+
+static struct LogIndexList* findList(struct LogIndex *index, int accountNumber, bool create) {
+    uint32_t slot = ((uint32_t)accountNumber * 2654435761u) & index->listMask;
+    while (index->lists[slot].capacity != 0) {
+        if (index->lists[slot].accountNumber == accountNumber) {
+            return &index->lists[slot];
+        }
+        slot = (slot + 1) & index->listMask;
+    }
+    if (!create) {
+        return NULL;
+    }
+    // Keep the table at most half full.
+    if ((uint32_t)(index->listCount + 1) * 2 > index->listMask + 1) {
+        struct LogIndexList *old = index->lists;
+        uint32_t oldSize = index->listMask + 1;
+        struct LogIndexList *grown = calloc(oldSize * 2, sizeof(struct LogIndexList));
+        if (grown == NULL) {
+            return NULL;
+        }
+        index->listMask = oldSize * 2 - 1;
+        index->lists = grown;
+        for (uint32_t i = 0; i < oldSize; i++) {
+            if (old[i].capacity != 0) {
+                uint32_t moved = ((uint32_t)old[i].accountNumber * 2654435761u) & index->listMask;
+                while (index->lists[moved].capacity != 0) {
+                    moved = (moved + 1) & index->listMask;
+                }
+                index->lists[moved] = old[i];
+            }
+        }
+        free(old);
+        return findList(index, accountNumber, true);
+    }
+    // The slot is only taken (capacity set) once its list is allocated.
+    uint64_t *sequences = malloc(4 * sizeof(uint64_t));
+    if (sequences == NULL) {
+        return NULL;
+    }
+    struct LogIndexList *list = &index->lists[slot];
+    list->accountNumber = accountNumber;
+    list->capacity = 4;
+    list->sequences = sequences;
+    index->listCount++;
+    return list;
+}
+
+// Returns false, with the index unchanged, if out of memory.
+static bool addToIndex(struct LogIndex *index, int accountNumber, uint64_t sequence) {
+    struct LogIndexList *list = findList(index, accountNumber, true);
+    if (list == NULL) {
+        return false;
+    }
+    if (list->count == list->capacity) {
+        uint64_t *grown = realloc(list->sequences, 2 * list->capacity * sizeof(uint64_t));
+        if (grown == NULL) {
+            return false;
+        }
+        list->sequences = grown;
+        list->capacity *= 2;
+    }
+    list->sequences[list->count++] = sequence;
+    index->liveEntries++;
+    if (sequence > index->lastSequence) {
+        index->lastSequence = sequence;
+    }
+    return true;
+}
+
+// Sequence number of the first record of a segment: closed segments are named after it, the
+// active log is read. UINT64_MAX if the active log has no records.
+static uint64_t segmentFirstSequence(const char *segment, const char *logFile) {
+    if (strcmp(segment, logFile) != 0) {
+        return strtoull(segment + strlen(logFile) + 1, NULL, 10);
+    }
+    struct TransactionRecord first;
+    int fd = open(segment, O_RDONLY);
+    bool found = fd >= 0 && pread(fd, &first, sizeof(first), sizeof(struct TransactionLogHeader)) == (ssize_t)sizeof(first);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return found ? first.sequence : UINT64_MAX;
+}
+
+// Sequence number of the last complete record of the active log, or 0 if it has none.
+static uint64_t activeLastSequence(const char *logFile) {
+    struct stat info;
+    uint64_t first = segmentFirstSequence(logFile, logFile);
+    if (first == UINT64_MAX || stat(logFile, &info) != 0) {
+        return 0;
+    }
+    return first + (uint64_t)(info.st_size - sizeof(struct TransactionLogHeader)) / sizeof(struct TransactionRecord) - 1;
+}
+
+static void pruneDeletedSegments(struct LogIndex *index);
+
+static bool writeEntries(int fd, const struct LogIndexEntry *entries, size_t count) {
+    return write(fd, entries, count * sizeof(*entries)) == (ssize_t)(count * sizeof(*entries));
+}
+
+// Index (and append to the file) the records of the log that come after index->lastSequence.
+static void catchUp(struct LogIndex *index) {
+    for (int s = 0; s < index->segmentCount; s++) {
+        // Skip segments that end before the first missing record without reading them.
+        uint64_t last = s + 1 < index->segmentCount ? index->segments[s + 1].firstSequence - 1
+                                                    : activeLastSequence(index->logFile);
+        if (last <= index->lastSequence) {
+            continue;
+        }
+        long count;
+        struct TransactionRecord *records = readTransactionLog(index->segments[s].name, &count);
+        long start = 0;
+        while (start < count && records[start].sequence <= index->lastSequence) {
+            start++;
+        }
+        if (records != NULL && !index->broken) {
+            logIndexAppend(index, records + start, (size_t)(count - start));
+        }
+        free(records);
+    }
+}
+
+// List the log's files once; afterwards the log reports every change (see logIndexSegmentClosed).
+// The list always ends with the active log, even before it exists. Returns false if out of memory.
+static bool loadSegments(struct LogIndex *index) {
+    int count;
+    char **names = listLogSegments(index->logFile, &count);
+    bool active = count > 0 && strcmp(names[count - 1], index->logFile) == 0;
+    index->segments = malloc((count + 8) * sizeof(struct LogSegment));
+    if (index->segments == NULL) {
+        freeLogSegments(names, count);
+        return false;
+    }
+    index->segmentCapacity = count + 8;
+    for (int s = 0; s < count; s++) {
+        index->segments[s].name = names[s];
+        index->segments[s].firstSequence = segmentFirstSequence(names[s], index->logFile);
+    }
+    index->segmentCount = count;
+    free(names);    // The names now belong to index->segments
+    if (!active) {
+        index->segments[index->segmentCount].name = strdup(index->logFile);
+        index->segments[index->segmentCount].firstSequence = UINT64_MAX;
+        if (index->segments[index->segmentCount].name == NULL) {
+            return false;
+        }
+        index->segmentCount++;
+    }
+    return true;
+}
+
+// Called with the lock held: the active log's first sequence, read once it has records.
+static void refreshActiveSegment(struct LogIndex *index) {
+    struct LogSegment *active = &index->segments[index->segmentCount - 1];
+    if (active->firstSequence == UINT64_MAX) {
+        active->firstSequence = segmentFirstSequence(active->name, index->logFile);
+    }
+}
+
+// Open "<logFile>.idx" for appending, writing the header if it is new. Returns -1 if it can not be
+// opened or holds something else.
+static int openIndexFile(const char *name, bool truncate) {
+    int fd = open(name, O_RDWR | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        printf("Error: Could not open log index %s\n", name);
+        return -1;
+    }
+    struct LogIndexHeader header;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        strcpy(header.magic, LOG_INDEX_MAGIC);
+        header.version = LOG_INDEX_VERSION;
+        header.entrySize = sizeof(struct LogIndexEntry);
+        if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC)) != 0 ||
+        header.version != LOG_INDEX_VERSION || header.entrySize != sizeof(struct LogIndexEntry)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct LogIndex* openLogIndex(const char *logFile) {
+    char name[4200];
+    indexFileName(logFile, name, sizeof(name));
+    int fd = openIndexFile(name, false);
+    if (fd < 0) {
+        // Unreadable or from another version: start over from the log.
+        if (!rebuildLogIndex(logFile) || (fd = openIndexFile(name, false)) < 0) {
+            return NULL;
+        }
+    }
+    struct LogIndex *index = calloc(1, sizeof(struct LogIndex));
+    if (index == NULL) {
+        close(fd);
+        return NULL;
+    }
+    index->logFile = strdup(logFile);
+    index->fd = fd;
+    pthread_mutex_init(&index->lock, NULL);
+    index->listMask = 15;
+    index->lists = calloc(index->listMask + 1, sizeof(struct LogIndexList));
+    if (index->logFile == NULL || index->lists == NULL) {
+        // Nothing is loaded yet, so the file needs no rebuild.
+        closeLogIndex(index);
+        return NULL;
+    }
+    // Load the entries; a partly written one at the end (a crash) is cut off.
+    struct LogIndexEntry entries[512];
+    off_t valid = sizeof(struct LogIndexHeader);
+    ssize_t bytes;
+    while (!index->broken && (bytes = pread(fd, entries, sizeof(entries), valid)) > 0) {
+        size_t count = (size_t)bytes / sizeof(struct LogIndexEntry);
+        for (size_t i = 0; i < count && !index->broken; i++) {
+            if (!addToIndex(index, entries[i].accountNumber, entries[i].sequence)) {
+                markBroken(index);
+            }
+        }
+        index->fileEntries += count;
+        valid += (off_t)(count * sizeof(struct LogIndexEntry));
+        if (count * sizeof(struct LogIndexEntry) != (size_t)bytes) {
+            break;
+        }
+    }
+    struct stat info;
+    if (!index->broken && fstat(fd, &info) == 0 && info.st_size != valid && ftruncate(fd, valid) != 0) {
+        printf("Error: Could not truncate log index %s\n", name);
+    }
+    // Entries past the end of the log belong to records cut off after a crash.
+    uint64_t logEnd = activeLastSequence(logFile);
+    if (logEnd != 0 && index->lastSequence > logEnd) {
+        closeLogIndex(index);
+        return rebuildLogIndex(logFile) ? openLogIndex(logFile) : NULL;
+    }
+    if (!index->broken && !loadSegments(index)) {
+        markBroken(index);
+    }
+    if (!index->broken) {
+        catchUp(index);
+    }
+    if (index->broken) {
+        closeLogIndex(index);
+        return NULL;
+    }
+    pthread_mutex_lock(&index->lock);
+    pruneDeletedSegments(index);
+    pthread_mutex_unlock(&index->lock);
+    return index;
+}
+
+void closeLogIndex(struct LogIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; index->lists != NULL && i <= index->listMask; i++) {
+        free(index->lists[i].sequences);
+    }
+    free(index->lists);
+    for (int s = 0; s < index->segmentCount; s++) {
+        free(index->segments[s].name);
+    }
+    free(index->segments);
+    close(index->fd);
+    // Everything in memory is freed by now, which leaves the most for the rebuild.
+    if (index->broken && !rebuildLogIndex(index->logFile)) {
+        printf("Error: The log index of %s is incomplete; rebuild it with the log tool's reindex command.\n", index->logFile);
+    }
+    pthread_mutex_destroy(&index->lock);
+    free(index->logFile);
+    free(index);
+}
+
+void logIndexAppend(struct LogIndex *index, const struct TransactionRecord *records, size_t count) {
+    struct LogIndexEntry entries[512];
+    pthread_mutex_lock(&index->lock);
+    // Once broken, the file stays a prefix of the log's entries, which the next open catches up
+    // on even if the rebuild on close does not happen.
+    for (size_t start = 0; start < count && !index->broken; start += 512) {
+        size_t chunk = count - start < 512 ? count - start : 512;
+        for (size_t i = 0; i < chunk; i++) {
+            const struct TransactionRecord *record = &records[start + i];
+            entries[i].sequence = record->sequence;
+            entries[i].accountNumber = record->accountNumber;
+            entries[i].reserved = 0;
+            if (!index->broken && !addToIndex(index, record->accountNumber, record->sequence)) {
+                markBroken(index);
+            }
+        }
+        if (writeEntries(index->fd, entries, chunk)) {
+            index->fileEntries += chunk;
+        } else {
+            printf("Error: Could not write to the log index.\n");
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+struct TransactionRecord* logIndexHistory(struct LogIndex *index, int accountNumber, long *recordCount) {
+    *recordCount = 0;
+    pthread_mutex_lock(&index->lock);
+    if (index->broken) {
+        pthread_mutex_unlock(&index->lock);
+        return NULL;
+    }
+    struct LogIndexList *list = findList(index, accountNumber, false);
+    int count = list ? list->count : 0;
+    uint64_t *sequences = malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+    // A copy of the segment list: the compressor may rename or delete segments meanwhile.
+    refreshActiveSegment(index);
+    int segmentCount = index->segmentCount;
+    char **segments = calloc(segmentCount, sizeof(char *));
+    uint64_t *firsts = malloc(segmentCount * sizeof(uint64_t));
+    struct TransactionRecord *history = malloc((count > 0 ? count : 1) * sizeof(struct TransactionRecord));
+    bool copied = sequences != NULL && segments != NULL && firsts != NULL && history != NULL;
+    for (int s = 0; copied && s < segmentCount; s++) {
+        segments[s] = strdup(index->segments[s].name);
+        firsts[s] = index->segments[s].firstSequence;
+        copied = segments[s] != NULL;
+    }
+    if (copied && count > 0) {
+        memcpy(sequences, list->sequences, count * sizeof(uint64_t));
+    }
+    pthread_mutex_unlock(&index->lock);
+    if (!copied) {
+        printf("Error: Out of memory looking up the history of account %d\n", accountNumber);
+        free(history);
+        free(firsts);
+        if (segments != NULL) {
+            freeLogSegments(segments, segmentCount);
+        }
+        free(sequences);
+        return NULL;
+    }
+
+    // The sequences are ascending, so the segment only ever moves forward.
+    int segment = -1, openSegment = -1, fd = -1;
+    struct TransactionRecord *decompressed = NULL;
+    long decompressedCount = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t sequence = sequences[i];
+        while (segment + 1 < segmentCount && firsts[segment + 1] <= sequence) {
+            segment++;
+        }
+        if (segment < 0) {
+            continue;  // Its segment was deleted by the retention limit
+        }
+        uint64_t position = sequence - firsts[segment];
+        if (segment != openSegment) {
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+            free(decompressed);
+            decompressed = NULL;
+            decompressedCount = 0;
+            size_t length = strlen(segments[segment]);
+            if (length > 3 && strcmp(segments[segment] + length - 3, ".gz") == 0) {
+                decompressed = readTransactionLog(segments[segment], &decompressedCount);
+            } else {
+                fd = open(segments[segment], O_RDONLY);
+            }
+            openSegment = segment;
+        }
+        struct TransactionRecord record;
+        bool found = false;
+        if (decompressed != NULL) {
+            found = position < (uint64_t)decompressedCount;
+            if (found) {
+                record = decompressed[position];
+            }
+        } else if (fd >= 0) {
+            off_t offset = (off_t)(sizeof(struct TransactionLogHeader) + position * sizeof(struct TransactionRecord));
+            found = pread(fd, &record, sizeof(record), offset) == (ssize_t)sizeof(record);
+        }
+        // The segment may have been rotated or deleted since it was listed.
+        if (found && record.sequence == sequence && record.accountNumber == accountNumber) {
+            history[(*recordCount)++] = record;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(decompressed);
+    free(firsts);
+    freeLogSegments(segments, segmentCount);
+    free(sequences);
+    return history;
+}
+
+// Called with the lock held: rewrite "<log>.idx" with only the entries still in memory, so that it
+// stops growing with the entries of deleted segments. On failure the old file is kept; it only
+// has entries that are skipped on load.
+static void compactIndexFile(struct LogIndex *index) {
+    char name[4200], temp[4210];
+    indexFileName(index->logFile, name, sizeof(name));
+    snprintf(temp, sizeof(temp), "%s.tmp", name);
+    int fd = openIndexFile(temp, true);
+    if (fd < 0) {
+        return;
+    }
+    bool ok = true;
+    struct LogIndexEntry entries[512];
+    size_t pending = 0;
+    for (uint32_t i = 0; ok && i <= index->listMask; i++) {
+        const struct LogIndexList *list = &index->lists[i];
+        for (int k = 0; ok && k < list->count; k++) {
+            entries[pending].sequence = list->sequences[k];
+            entries[pending].accountNumber = list->accountNumber;
+            entries[pending].reserved = 0;
+            if (++pending == 512) {
+                ok = writeEntries(fd, entries, pending);
+                pending = 0;
+            }
+        }
+    }
+    ok = ok && writeEntries(fd, entries, pending);
+    ok = (close(fd) == 0) && ok;
+    int reopened = -1;
+    if (ok && rename(temp, name) == 0) {
+        reopened = openIndexFile(name, false);
+    } else {
+        remove(temp);
+    }
+    if (reopened < 0) {
+        printf("Error: Could not compact log index %s\n", name);
+        return;
+    }
+    close(index->fd);
+    index->fd = reopened;
+    index->fileEntries = index->liveEntries;
+}
+
+// Called with the lock held: drop the entries of records older than the oldest segment left, which
+// retention has deleted, and compact the file once they are the majority of it.
+static void pruneDeletedSegments(struct LogIndex *index) {
+    refreshActiveSegment(index);
+    uint64_t oldest = index->segments[0].firstSequence;
+    if (oldest == UINT64_MAX) {
+        return;  // Nothing left but an empty log: keep the entries rather than guess
+    }
+    for (uint32_t i = 0; i <= index->listMask; i++) {
+        struct LogIndexList *list = &index->lists[i];
+        if (list->count == 0 || list->sequences[0] >= oldest) {
+            continue;
+        }
+        // The sequences are ascending: find the first one that is kept.
+        int low = 0, high = list->count;
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (list->sequences[middle] < oldest) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        memmove(list->sequences, list->sequences + low, (size_t)(list->count - low) * sizeof(uint64_t));
+        list->count -= low;
+        index->liveEntries -= (uint64_t)low;
+        // A shrink that fails keeps the larger list.
+        uint64_t *shrunk;
+        if (list->capacity > 4 && list->count < list->capacity / 4 &&
+            (shrunk = realloc(list->sequences, list->capacity / 2 * sizeof(uint64_t))) != NULL) {
+            list->capacity /= 2;
+            list->sequences = shrunk;
+        }
+    }
+    if (index->fileEntries - index->liveEntries > index->liveEntries) {
+        compactIndexFile(index);
+    }
+}
+
+void logIndexSegmentClosed(struct LogIndex *index, const char *segment, uint64_t firstSequence) {
+    pthread_mutex_lock(&index->lock);
+    if (index->segmentCount == index->segmentCapacity && !index->broken) {
+        struct LogSegment *grown = realloc(index->segments, 2 * index->segmentCapacity * sizeof(struct LogSegment));
+        if (grown == NULL) {
+            markBroken(index);
+        } else {
+            index->segments = grown;
+            index->segmentCapacity *= 2;
+        }
+    }
+    char *name = index->broken ? NULL : strdup(segment);
+    if (name == NULL) {
+        markBroken(index);
+        pthread_mutex_unlock(&index->lock);
+        return;
+    }
+    // The closed segment goes in front of the active log, which starts over without records.
+    struct LogSegment *active = &index->segments[index->segmentCount - 1];
+    index->segments[index->segmentCount] = *active;
+    active->name = name;
+    active->firstSequence = firstSequence;
+    index->segments[index->segmentCount].firstSequence = UINT64_MAX;
+    index->segmentCount++;
+    pthread_mutex_unlock(&index->lock);
+}
+
+// Same segment, compressed or not.
+static bool sameSegment(const char *a, const char *b) {
+    size_t lengthA = strlen(a), lengthB = strlen(b);
+    if (lengthA > 3 && strcmp(a + lengthA - 3, ".gz") == 0) lengthA -= 3;
+    if (lengthB > 3 && strcmp(b + lengthB - 3, ".gz") == 0) lengthB -= 3;
+    return lengthA == lengthB && strncmp(a, b, lengthA) == 0;
+}
+
+void logIndexSegmentCompressed(struct LogIndex *index, const char *segment, const char *compressed) {
+    pthread_mutex_lock(&index->lock);
+    for (int s = 0; !index->broken && s + 1 < index->segmentCount; s++) {
+        if (strcmp(index->segments[s].name, segment) == 0) {
+            char *name = strdup(compressed);
+            if (name == NULL) {
+                markBroken(index);
+            } else {
+                free(index->segments[s].name);
+                index->segments[s].name = name;
+            }
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+void logIndexSegmentDeleted(struct LogIndex *index, const char *segment) {
+    pthread_mutex_lock(&index->lock);
+    // A broken index does not compact its file: the entries in memory are not all of them.
+    for (int s = 0; !index->broken && s + 1 < index->segmentCount; s++) {
+        if (sameSegment(index->segments[s].name, segment)) {
+            free(index->segments[s].name);
+            memmove(&index->segments[s], &index->segments[s + 1],
+                    (size_t)(index->segmentCount - s - 1) * sizeof(struct LogSegment));
+            index->segmentCount--;
+            pruneDeletedSegments(index);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+bool rebuildLogIndex(const char *logFile) {
+    char name[4200], temp[4210];
+    indexFileName(logFile, name, sizeof(name));
+    snprintf(temp, sizeof(temp), "%s.tmp", name);
+    int fd = openIndexFile(temp, true);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = true;
+    int segmentCount;
+    char **segments = listLogSegments(logFile, &segmentCount);
+    struct LogIndexEntry entries[512];
+    for (int s = 0; ok && s < segmentCount; s++) {
+        long count;
+        struct TransactionRecord *records = readTransactionLog(segments[s], &count);
+        for (long start = 0; ok && start < count; start += 512) {
+            size_t chunk = count - start < 512 ? (size_t)(count - start) : 512;
+            for (size_t i = 0; i < chunk; i++) {
+                entries[i].sequence = records[start + i].sequence;
+                entries[i].accountNumber = records[start + i].accountNumber;
+                entries[i].reserved = 0;
+            }
+            ok = writeEntries(fd, entries, chunk);
+        }
+        free(records);
+    }
+    freeLogSegments(segments, segmentCount);
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(temp, name) != 0) {
+        printf("Error: Could not rebuild log index %s\n", name);
+        remove(temp);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef PROGRAMMING_ASSIGNMENT_LOG_INDEX_H
+#define PROGRAMMING_ASSIGNMENT_LOG_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "transaction_log.h"
+
+// Per-account index over the transaction log. Log records have a fixed size and consecutive
+// sequence numbers, so a sequence number is an offset: the record is at
+// header + (sequence - first sequence of its segment) * record size. The index keeps, for each
+// account, the sequence numbers of its records in the order they were logged.
+//
+// It is persisted next to the log as "<log>.idx" (a header followed by LogIndexEntry pairs),
+// appended to by the log writer after every batch, caught up from the log when it is opened,
+// and can be rebuilt from the log at any time.
+
+#define LOG_INDEX_MAGIC "ATMLIDX"
+#define LOG_INDEX_VERSION 1
+
+struct LogIndexEntry {
+    uint64_t sequence;
+    int32_t accountNumber;
+    uint32_t reserved;      // Always zero
+};
+
+// The sequence numbers of one account.
+struct LogIndexList {
+    int accountNumber;
+    int count;
+    int capacity;
+    uint64_t *sequences;
+};
+
+// A file of the log as the index knows it, so lookups do not have to list the directory.
+struct LogSegment {
+    char *name;
+    uint64_t firstSequence;     // UINT64_MAX while the active log has no records
+};
+
+struct LogIndex {
+    char *logFile;
+    int fd;                     // "<log>.idx", opened for appending
+    pthread_mutex_t lock;       // The writer appends while others look up
+    struct LogIndexList *lists; // Open-addressing hash table keyed by account number
+    uint32_t listMask;
+    int listCount;
+    uint64_t lastSequence;      // Last record indexed
+    struct LogSegment *segments;    // Closed segments, oldest first, then the active log
+    int segmentCount;
+    int segmentCapacity;
+    uint64_t fileEntries;       // Entries in "<log>.idx"
+    uint64_t liveEntries;       // Entries still in memory; the rest belong to deleted segments
+    bool broken;                // Out of memory: no longer updated, and rebuilt from the log on close
+};
+
+// Open the index of the log at logFile, creating it or catching it up with records logged after
+// it was last written. Returns NULL if the index file can not be created or memory runs out.
+// If memory runs out later, the index stops changing (it is marked broken), lookups return NULL,
+// and closeLogIndex() rebuilds the file from the log.
+struct LogIndex* openLogIndex(const char *logFile);
+void closeLogIndex(struct LogIndex *index);
+// Index records that were just appended to the log.
+void logIndexAppend(struct LogIndex *index, const struct TransactionRecord *records, size_t count);
+// Read the records of one account, oldest first, into a new array (free() it). Costs one read per
+// record in uncompressed segments; a compressed segment is decompressed once if the account has
+// records in it. Records in segments deleted by the retention limit are skipped. The segments come
+// from the index's own list (see below), not from the directory. NULL if the index is broken or
+// out of memory.
+struct TransactionRecord* logIndexHistory(struct LogIndex *index, int accountNumber, long *recordCount);
+// Called by the log as its files change, to keep the segment list current. A deleted segment's
+// entries are dropped, and the index file is rewritten once most of its entries are dropped ones.
+void logIndexSegmentClosed(struct LogIndex *index, const char *segment, uint64_t firstSequence);
+void logIndexSegmentCompressed(struct LogIndex *index, const char *segment, const char *compressed);
+void logIndexSegmentDeleted(struct LogIndex *index, const char *segment);
+// Rewrite "<logFile>.idx" from the log itself (dropping entries of deleted segments).
+bool rebuildLogIndex(const char *logFile);
+
+#endif // PROGRAMMING_ASSIGNMENT_LOG_INDEX_H
@@ -0,0 +1,140 @@
+//
+// Tools for the binary transaction log.
+// Usage: Programming_Assignment_Log decode <log.bin> [--time]
+//        Programming_Assignment_Log history <log.bin> <account> [--time]
+//        Programming_Assignment_Log reindex <log.bin>
+//        Programming_Assignment_Log replay <log.bin> <accounts> <output> [--from SEQUENCE] [--threads N]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "transaction_log.h"
+#include "log_index.h"
+#include "replay.h"
+#include "snapshot.h"
+#include "parallel_loader.h"
+#include "account_index.h"
+
+static void printRecord(const struct TransactionRecord *record, bool showTime) {
+    char line[256];
+    formatTransactionRecord(record, line, sizeof(line));
+    if (showTime) {
+        printf("#%llu [%lld.%06lld] ", (unsigned long long)record->sequence,
+               (long long)(record->timestampNs / 1000000000LL),
+               (long long)(record->timestampNs % 1000000000LL / 1000));
+    }
+    fputs(line, stdout);
+}
+
+// Print every record of the log (its closed segments, oldest first, then the log itself) as a
+// line of the old text log; with --time each line is prefixed by the sequence number and the
+// monotonic timestamp in seconds.
+static int decodeLog(const char *filename, bool showTime) {
+    int segmentCount;
+    char **segments = listLogSegments(filename, &segmentCount);
+    if (segmentCount == 0) {
+        printf("Error: Could not open %s\n", filename);
+    }
+    int status = segmentCount == 0;
+    for (int s = 0; s < segmentCount; s++) {
+        long count;
+        struct TransactionRecord *records = readTransactionLog(segments[s], &count);
+        if (records == NULL) {
+            status = 1;
+            continue;
+        }
+        for (long i = 0; i < count; i++) {
+            printRecord(&records[i], showTime);
+        }
+        free(records);
+    }
+    freeLogSegments(segments, segmentCount);
+    return status;
+}
+
+// Print the records of one account, found through the log index.
+static int printHistory(const char *filename, int accountNumber, bool showTime) {
+    struct LogIndex *index = openLogIndex(filename);
+    if (index == NULL) {
+        return 1;
+    }
+    long count;
+    struct TransactionRecord *records = logIndexHistory(index, accountNumber, &count);
+    if (records == NULL) {
+        closeLogIndex(index);
+        return 1;
+    }
+    for (long i = 0; i < count; i++) {
+        printRecord(&records[i], showTime);
+    }
+    free(records);
+    closeLogIndex(index);
+    return 0;
+}
+
+// Replay the log over the accounts in accountsFile (CSV or snapshot), print every record whose
+// original balance does not match the replayed one, and write the result to outputFile in the
+// format of accountsFile.
+static int replayLog(const char *logFile, const char *accountsFile, const char *outputFile, uint64_t fromSequence, int threads) {
+    int accountCount;
+    struct BankAccount *accounts = loadAccounts(accountsFile, &accountCount, threads);
+    if (accounts == NULL) {
+        return 1;
+    }
+    struct ReplayResult result;
+    bool ok = replayTransactionLog(logFile, fromSequence, accounts, accountCount, threads, &result);
+    for (long i = 0; i < result.mismatchCount; i++) {
+        const struct ReplayMismatch *mismatch = &result.mismatches[i];
+        char replayed[MONEY_TEXT_SIZE], logged[MONEY_TEXT_SIZE];
+        formatMoney(mismatch->replayedBalance, replayed, sizeof(replayed));
+        formatMoney(mismatch->loggedBalance, logged, sizeof(logged));
+        printf("Mismatch #%llu Account %d - %s: Replayed Balance = £%s, Original Balance = £%s\n",
+               (unsigned long long)mismatch->sequence, mismatch->accountNumber, transactionOpName(mismatch->operation),
+               replayed, logged);
+    }
+    printf("Replayed %llu records up to #%llu: %ld mismatches, %llu records of unknown accounts, %llu records missing\n",
+           (unsigned long long)result.records, (unsigned long long)result.lastSequence, result.mismatchCount,
+           (unsigned long long)result.unknownAccounts, (unsigned long long)result.missingRecords);
+    bool consistent = result.mismatchCount == 0;
+    freeReplayResult(&result);
+    bool saved = isAccountsSnapshot(accountsFile) ? saveAccountsSnapshot(outputFile, accounts, accountCount)
+                                                  : saveAccountsToCSV(outputFile, accounts, accountCount);
+    releaseAccounts(accounts);
+    return ok && saved && consistent ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 5 && strcmp(argv[1], "replay") == 0) {
+        uint64_t fromSequence = 0;
+        int threads = defaultLoadThreads();
+        bool valid = true;
+        for (int i = 5; i < argc; i++) {
+            if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+                fromSequence = strtoull(argv[++i], NULL, 10);
+            } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                threads = atoi(argv[++i]);
+            } else {
+                valid = false;
+            }
+        }
+        if (valid) {
+            return replayLog(argv[2], argv[3], argv[4], fromSequence, threads);
+        }
+    }
+    bool showTime = argc > 3 && strcmp(argv[argc - 1], "--time") == 0;
+    int args = argc - showTime;
+    if (args == 3 && strcmp(argv[1], "decode") == 0) {
+        return decodeLog(argv[2], showTime);
+    }
+    if (args == 4 && strcmp(argv[1], "history") == 0) {
+        return printHistory(argv[2], atoi(argv[3]), showTime);
+    }
+    if (argc == 3 && strcmp(argv[1], "reindex") == 0) {
+        return rebuildLogIndex(argv[2]) ? 0 : 1;
+    }
+    printf("Usage: %s decode <log.bin> [--time]\n", argv[0]);
+    printf("       %s history <log.bin> <account> [--time]\n", argv[0]);
+    printf("       %s reindex <log.bin>\n", argv[0]);
+    printf("       %s replay <log.bin> <accounts> <output> [--from SEQUENCE] [--threads N]\n", argv[0]);
+    return 1;
+}
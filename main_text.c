@@ -2,16 +2,77 @@
 #include <stdlib.h>
 #include <string.h>
 #include "algorithm.h"
+#include "parallel_loader.h"
+#include "snapshot.h"
+#include "account_index.h"
+#include "journal.h"
+#include "transaction_log.h"
+#include "report.h"
 
+// Bands of the end-of-day report: below £0, then from £0, £100, £1,000 and £10,000 up.
+static const Money reportLimits[] = {0, POUNDS(100), POUNDS(1000), POUNDS(10000)};
 
-int main() {
+// End-of-day report over the accounts as they are now. It is printed once, so it runs over the
+// array itself: a reporting copy (see account_store.h) would cost as much to build as this pass.
+static void printReport(const struct BankAccount *accounts, int accountCount, int threads) {
+    int limitCount = (int)(sizeof(reportLimits) / sizeof(reportLimits[0]));
+    struct EndOfDayReport report;
+    endOfDayReportAccounts(accounts, accountCount, reportLimits, limitCount, threads, &report);
+    printf("\n--- End of Day ---\n");
+    printEndOfDayReport(&report, reportLimits);
+}
+
+int main(int argc, char *argv[]) {
+    // Optional: --accounts FILE boots from another accounts file (CSV or binary snapshot),
+    // --threads N sets how many threads parse a CSV file at startup, --log-flush-records N and
+    // --log-flush-ms N set when buffered log entries are written to log.bin, --log-rotate-mb N
+    // and --log-rotate-hours N when it rolls over to a new segment, --log-retain N how many
+    // closed segments are kept, --report prints the end-of-day report when the program exits.
+    const char *accountsFile = "accounts.csv";
+    int loadThreads = defaultLoadThreads();
+    bool report = false;
+    struct TransactionLogConfig logConfig;
+    transactionLogDefaults(&logConfig);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--accounts") == 0 && i + 1 < argc) {
+            accountsFile = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            loadThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-flush-records") == 0 && i + 1 < argc) {
+            logConfig.flushRecords = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-flush-ms") == 0 && i + 1 < argc) {
+            logConfig.flushIntervalMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-rotate-mb") == 0 && i + 1 < argc) {
+            logConfig.rotateBytes = atol(argv[++i]) << 20;
+        } else if (strcmp(argv[i], "--log-rotate-hours") == 0 && i + 1 < argc) {
+            logConfig.rotateSeconds = atoi(argv[++i]) * 3600;
+        } else if (strcmp(argv[i], "--log-retain") == 0 && i + 1 < argc) {
+            logConfig.retainSegments = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--report") == 0) {
+            report = true;
+        } else {
+            printf("Usage: %s [--accounts FILE] [--threads N] [--log-flush-records N] [--log-flush-ms N]\n"
+                   "       [--log-rotate-mb N] [--log-rotate-hours N] [--log-retain N] [--report]\n", argv[0]);
+            return 1;
+        }
+    }
     int accountCount;
     // Load accounts once at the beginning
-    struct BankAccount *accounts = loadAccountsFromCSV("accounts.csv", &accountCount);
+    struct BankAccount *accounts = loadAccounts(accountsFile, &accountCount, loadThreads);
     if (accountCount == 0) {
         printf("No accounts loaded. Exiting.\n");
         return 1;
     }
+    printAccountIndexInfo(accounts, accountCount);
+    // Replay changes journaled since the last save (e.g. before a crash), then keep journaling.
+    char journalFile[4096];
+    snprintf(journalFile, sizeof(journalFile), "%s.journal", accountsFile);
+    int recovered = journalReplay(journalFile, accounts, accountCount);
+    if (recovered > 0) {
+        printf("Recovered %d journaled changes from %s\n", recovered, journalFile);
+    }
+    journalOpen(journalFile);
+    startTransactionLog(&logConfig);
     while (true) {
         struct BankAccount *account = NULL;
         int pinAttempts;
@@ -21,8 +82,12 @@ int main() {
         int selectedCard = getValidInt();
         if (selectedCard == 0) {
             printf("Exiting program. Thanks for using the ATM!.\n");
-            // Save updated accounts before exiting.
-            saveAccountsToCSV("accounts.csv", accounts, accountCount);
+            if (report) {
+                printReport(accounts, accountCount, loadThreads);
+            }
+            // Save updated accounts before exiting; the journal is emptied once they are on disk.
+            journalCheckpoint(accountsFile, accounts, accountCount);
+            stopTransactionLog();
             exit(0);
         }
         account = findAccount(accounts, accountCount, selectedCard);
@@ -48,8 +113,8 @@ int main() {
             }
         }
         if (!pinVerified) {
-            account->blocked = true;
-            logTransaction(account->accountNumber, "Card Retained", 0, 0);
+            blockAccount(account);
+            logTransaction(account->accountNumber, TRANSACTION_CARD_RETAINED, 0, 0);
             printf("Card has been retained due to too many incorrect attempts. Please contact the bank.\n");
             continue;
         }
@@ -57,6 +122,8 @@ int main() {
         // Main transaction loop for the logged-in card
         int exitChoice = 0;
         while (!exitChoice) {
+            // Periodically save the accounts so the journal does not grow without bound.
+            journalCheckpointIfDue(accountsFile, accounts, accountCount);
             printf("\n--- ATM Menu ---\n");
             printf("1. Change PIN\n");
             printf("2. Check Balance\n");
@@ -67,43 +134,43 @@ int main() {
             printf("Select an option:\n>>> ");
             int choice = getValidInt();
 
-            double originalBalance = account->balance;
-            const char *result;
+            Money originalBalance = account->balance;
+            char message[100];
             switch (choice) {
                 case 1: {
                     printf("Enter new PIN:\n>>> ");
                     int newPin1 = getValidInt();
                     printf("Re-enter new PIN:\n>>> ");
                     int newPin2 = getValidInt();
-                    result = changePin(account, newPin1, newPin2);
-                    printf("%s\n", result);
-                    logTransaction(account->accountNumber, "Change PIN", 0, 0);
+                    updatePin(account, newPin1, newPin2, message, sizeof(message));
+                    printf("%s\n", message);
+                    logTransaction(account->accountNumber, TRANSACTION_CHANGE_PIN, 0, 0);
                     break;
                 }
                 case 2: {
-                    result = showBalance(account);
-                    printf("%s\n", result);
-                    logTransaction(account->accountNumber, "Check Balance", originalBalance, account->balance);
+                    balanceText(account, message, sizeof(message));
+                    printf("%s\n", message);
+                    logTransaction(account->accountNumber, TRANSACTION_CHECK_BALANCE, originalBalance, account->balance);
                     break;
                 }
                 case 3: {
                     printf("Enter amount to withdraw:\n>>> ");
-                    double amount = getValidDouble();
-                    result = withdraw(account, amount);
-                    printf("%s\n", result);
-                    if (strstr(result, "successful") != NULL) {
-                        logTransaction(account->accountNumber, "Withdrawal", originalBalance, account->balance);
+                    Money amount = getValidMoney();
+                    enum OperationStatus status = withdrawFunds(account, amount, message, sizeof(message));
+                    printf("%s\n", message);
+                    if (status == STATUS_OK) {
+                        logTransaction(account->accountNumber, TRANSACTION_WITHDRAWAL, originalBalance, account->balance);
                         displayReceipt(account->accountHolder, "Withdrawal", originalBalance, account->balance);
                     }
                     break;
                 }
                 case 4: {
                     printf("Enter amount to deposit:\n>>> ");
-                    double amount = getValidDouble();
-                    result = deposit(account, amount);
-                    printf("%s\n", result);
-                    if (strstr(result, "successful") != NULL) {
-                        logTransaction(account->accountNumber, "Deposit", originalBalance, account->balance);
+                    Money amount = getValidMoney();
+                    enum OperationStatus status = depositFunds(account, amount, message, sizeof(message));
+                    printf("%s\n", message);
+                    if (status == STATUS_OK) {
+                        logTransaction(account->accountNumber, TRANSACTION_DEPOSIT, originalBalance, account->balance);
                         displayReceipt(account->accountHolder, "Deposit", originalBalance, account->balance);
                     }
                     break;
@@ -114,8 +181,12 @@ int main() {
                     break;
                 case 6:
                     printf("Exiting program. Please take your card. Thanks for using the ATM!\n");
-                    // Save updated accounts before exiting.
-                    saveAccountsToCSV("accounts.csv", accounts, accountCount);
+                    if (report) {
+                        printReport(accounts, accountCount, loadThreads);
+                    }
+                    // Save updated accounts before exiting; the journal is emptied once they are on disk.
+                    journalCheckpoint(accountsFile, accounts, accountCount);
+                    stopTransactionLog();
                     exit(0);
                 default:
                     printf("Invalid option. Try again.\n");
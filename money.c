@@ -0,0 +1,133 @@
+//
+// Fixed-point money: parsing and formatting of minor-unit amounts.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "money.h"
+
+// Integer digits the exact path takes; 10^16 pounds are still far from overflowing in pence.
+#define MONEY_MAX_DIGITS 16
+// Longest field handed to strtod.
+#define MONEY_MAX_FIELD 255
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+bool moneyFromDouble(double pounds, Money *amount) {
+    double minor = pounds * MONEY_SCALE;
+    // Also false for NaN.
+    if (!(minor > -9.2e18 && minor < 9.2e18)) {
+        return false;
+    }
+    *amount = llround(minor);
+    return true;
+}
+
+bool parseMoney(const char *text, const char *end, Money *amount) {
+    const char *p = text;
+    while (p < end && isSpace(*p)) p++;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+    int64_t units = 0;
+    int digits = 0;
+    while (p < end && *p >= '0' && *p <= '9' && digits < MONEY_MAX_DIGITS) {
+        units = units * 10 + (*p - '0');
+        digits++;
+        p++;
+    }
+    int64_t minor = 0;
+    int fractionDigits = 0;
+    bool roundUp = false;
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (fractionDigits < 2) {
+                minor = minor * 10 + (*p - '0');
+            } else if (fractionDigits == 2) {
+                roundUp = *p >= '5';
+            }
+            fractionDigits++;
+            p++;
+        }
+    }
+    if (p == end && digits + fractionDigits > 0) {
+        for (int i = fractionDigits; i < 2; i++) {
+            minor *= 10;
+        }
+        int64_t value = units * MONEY_SCALE + minor + roundUp;
+        *amount = negative ? -value : value;
+        return true;
+    }
+    // Exponents, hex, too many digits: let strtod decide, like the sscanf-based loader did.
+    size_t length = (size_t)(end - text);
+    if (length == 0 || length > MONEY_MAX_FIELD) {
+        return false;
+    }
+    char field[MONEY_MAX_FIELD + 1];
+    memcpy(field, text, length);
+    field[length] = '\0';
+    char *parsedEnd;
+    double value = strtod(field, &parsedEnd);
+    return parsedEnd != field && parsedEnd == field + length && moneyFromDouble(value, amount);
+}
+
+bool parseMoneyString(const char *text, Money *amount) {
+    const char *end = text + strlen(text);
+    while (end > text && isSpace(end[-1])) end--;
+    return parseMoney(text, end, amount);
+}
+
+// Write the digits of amount right to left, ending at end, and return where they start.
+static char* writeMoneyBackwards(Money amount, bool display, char *end) {
+    uint64_t magnitude = amount < 0 ? (uint64_t)0 - (uint64_t)amount : (uint64_t)amount;
+    char *p = end;
+    uint64_t pence = magnitude % MONEY_SCALE;
+    uint64_t pounds = magnitude / MONEY_SCALE;
+    *--p = (char)('0' + pence % 10);
+    *--p = (char)('0' + pence / 10);
+    *--p = '.';
+    int digits = 0;
+    do {
+        if (display && digits > 0 && digits % 3 == 0) {
+            *--p = ',';
+        }
+        *--p = (char)('0' + pounds % 10);
+        pounds /= 10;
+        digits++;
+    } while (pounds > 0);
+    if (display) {
+        p -= sizeof(MONEY_CURRENCY) - 1;
+        memcpy(p, MONEY_CURRENCY, sizeof(MONEY_CURRENCY) - 1);
+    }
+    if (amount < 0) {
+        *--p = '-';
+    }
+    return p;
+}
+
+static size_t copyMoneyText(const char *start, const char *end, char *text, size_t size) {
+    size_t length = (size_t)(end - start);
+    if (size > 0) {
+        size_t copied = length < size ? length : size - 1;
+        memcpy(text, start, copied);
+        text[copied] = '\0';
+    }
+    return length;
+}
+
+size_t formatMoney(Money amount, char *text, size_t size) {
+    char buffer[MONEY_TEXT_SIZE];
+    char *end = buffer + sizeof(buffer);
+    return copyMoneyText(writeMoneyBackwards(amount, false, end), end, text, size);
+}
+
+size_t formatMoneyDisplay(Money amount, char *text, size_t size) {
+    char buffer[MONEY_TEXT_SIZE];
+    char *end = buffer + sizeof(buffer);
+    return copyMoneyText(writeMoneyBackwards(amount, true, end), end, text, size);
+}
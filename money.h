@@ -0,0 +1,35 @@
+#ifndef PROGRAMMING_ASSIGNMENT_MONEY_H
+#define PROGRAMMING_ASSIGNMENT_MONEY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Amounts of money are whole minor units (pence) in a 64-bit integer, so balances add up exactly.
+// Text (accounts.csv, user input, messages, receipts) is converted at the edges with the
+// functions below.
+typedef int64_t Money;
+
+#define MONEY_SCALE 100                         // Minor units per pound
+#define POUNDS(n) ((Money)(n) * MONEY_SCALE)
+// Longest text formatMoney() or formatMoneyDisplay() produces, including the terminating NUL.
+#define MONEY_TEXT_SIZE 32
+#define MONEY_CURRENCY "£"
+
+// Parse an amount from [text, end), which must be consumed entirely: optional whitespace, an
+// optional sign, digits with an optional decimal point. A plain decimal is converted exactly,
+// rounding a third decimal place half away from zero; other forms that strtod accepts
+// (exponents, hex) go through a double. Fails for an amount that is not finite or does not fit.
+bool parseMoney(const char *text, const char *end, Money *amount);
+// Same for a NUL-terminated string; trailing whitespace is allowed.
+bool parseMoneyString(const char *text, Money *amount);
+// Round a double amount in pounds to the nearest minor unit. Fails if it is not finite or does not fit.
+bool moneyFromDouble(double pounds, Money *amount);
+// Format as "1234.56" or "-0.50", the form used in accounts.csv and the log. Like snprintf, writes
+// at most size bytes including the NUL and returns the length of the whole text, but uses neither
+// printf nor the locale nor floating point.
+size_t formatMoney(Money amount, char *text, size_t size);
+// Format for people: currency sign and thousands separators, "£1,234.56" or "-£0.50".
+size_t formatMoneyDisplay(Money amount, char *text, size_t size);
+
+#endif // PROGRAMMING_ASSIGNMENT_MONEY_H
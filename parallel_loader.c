@@ -0,0 +1,158 @@
+//
+// Multi-threaded loading of accounts.csv.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "parallel_loader.h"
+#include "csv_parser.h"
+#include "account_index.h"
+
+// Files smaller than this are not worth splitting.
+#define MIN_CHUNK_SIZE (64 * 1024)
+
+struct LoadChunk {
+    const char *start;
+    size_t length;
+    struct CsvLoadState state;
+    pthread_t thread;
+    bool started;                   // Parsed on its own thread
+};
+
+static void* parseChunk(void *arg) {
+    struct LoadChunk *chunk = arg;
+    size_t offset = 0;
+    while (offset < chunk->length) {
+        size_t window = chunk->length - offset < CSV_BLOCK_SIZE ? chunk->length - offset : CSV_BLOCK_SIZE;
+        bool final = (offset + window == chunk->length);
+        size_t consumed = csvParseBlock(&chunk->state, chunk->start + offset, window, final);
+        if (consumed == 0) {
+            // A single line longer than the window: hand it to the parser on its own.
+            const char *newline = memchr(chunk->start + offset, '\n', chunk->length - offset);
+            size_t lineLength = newline ? (size_t)(newline - (chunk->start + offset)) + 1 : chunk->length - offset;
+            consumed = csvParseBlock(&chunk->state, chunk->start + offset, lineLength, true);
+        }
+        offset += consumed;
+    }
+    return NULL;
+}
+
+int defaultLoadThreads() {
+    const char *configured = getenv("ATM_LOAD_THREADS");
+    int threads = configured ? atoi(configured) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+    return threads > MAX_LOAD_THREADS ? MAX_LOAD_THREADS : threads;
+}
+
+struct BankAccount* loadAccountsFromCSVParallel(const char *filename, int *accountCount, int threads) {
+    *accountCount = 0;
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        printf("Error: Could not open %s\n", filename);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return malloc(sizeof(struct BankAccount));
+    }
+    size_t size = (size_t)info.st_size;
+    if (size == 0) {
+        close(fd);
+        return malloc(sizeof(struct BankAccount));
+    }
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        // Not mappable (e.g. a pipe): fall back to the streaming loader.
+        return loadAccountsFromCSV(filename, accountCount);
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_LOAD_THREADS) {
+        threads = MAX_LOAD_THREADS;
+    }
+    if ((size_t)threads > size / MIN_CHUNK_SIZE + 1) {
+        threads = (int)(size / MIN_CHUNK_SIZE + 1);
+    }
+
+    // Cut the file into roughly equal chunks, moving each boundary just past the next newline.
+    struct LoadChunk chunks[MAX_LOAD_THREADS];
+    size_t begin = 0;
+    int chunkCount = 0;
+    for (int t = 0; t < threads && begin < size; t++) {
+        size_t end = (t == threads - 1) ? size : size / threads * (t + 1);
+        if (end < begin) {
+            end = begin;
+        }
+        const char *newline = end < size ? memchr(data + end, '\n', size - end) : NULL;
+        end = newline ? (size_t)(newline - data) + 1 : size;
+        struct LoadChunk *chunk = &chunks[chunkCount++];
+        chunk->start = data + begin;
+        chunk->length = end - begin;
+        csvLoadStateInit(&chunk->state, filename);
+        chunk->state.deferWarnings = true;
+        // Only the first chunk contains the header line.
+        chunk->state.lineNumber = (begin == 0) ? 0 : 1;
+        begin = end;
+    }
+    // A chunk whose thread can not be started is parsed here instead.
+    for (int t = 1; t < chunkCount; t++) {
+        chunks[t].started = pthread_create(&chunks[t].thread, NULL, parseChunk, &chunks[t]) == 0;
+        if (!chunks[t].started) {
+            parseChunk(&chunks[t]);
+        }
+    }
+    parseChunk(&chunks[0]);
+    for (int t = 1; t < chunkCount; t++) {
+        if (chunks[t].started) {
+            pthread_join(chunks[t].thread, NULL);
+        }
+    }
+
+    // Merge in file order, appending every chunk to the first one's array.
+    int total = 0;
+    for (int t = 0; t < chunkCount; t++) {
+        total += chunks[t].state.count;
+    }
+    struct BankAccount *accounts = realloc(chunks[0].state.accounts,
+                                           (total > 0 ? total : 1) * sizeof(struct BankAccount));
+    if (accounts == NULL) {
+        printf("Error: Out of memory while loading %s\n", filename);
+        accounts = chunks[0].state.accounts;
+        total = chunks[0].state.count;
+    } else {
+        int filled = chunks[0].state.count;
+        for (int t = 1; t < chunkCount; t++) {
+            memcpy(accounts + filled, chunks[t].state.accounts, chunks[t].state.count * sizeof(struct BankAccount));
+            filled += chunks[t].state.count;
+        }
+    }
+    // Report skipped lines with their line numbers in the whole file.
+    int linesBefore = 0;
+    for (int t = 0; t < chunkCount; t++) {
+        int first = (t == 0) ? 0 : 1;
+        for (int i = 0; i < chunks[t].state.skippedCount; i++) {
+            int line = chunks[t].state.skippedLines[i];
+            bool tooLong = line < 0;
+            csvReportSkippedLine(filename, linesBefore + (tooLong ? -line : line) - first, tooLong);
+        }
+        linesBefore += chunks[t].state.lineNumber - first;
+        free(chunks[t].state.skippedLines);
+        if (t > 0) {
+            free(chunks[t].state.accounts);
+        }
+    }
+    munmap((void *)data, size);
+    *accountCount = total;
+    registerAccounts(accounts, total, total > 0 ? total : 1);
+    return accounts;
+}
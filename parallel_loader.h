@@ -0,0 +1,16 @@
+#ifndef PROGRAMMING_ASSIGNMENT_PARALLEL_LOADER_H
+#define PROGRAMMING_ASSIGNMENT_PARALLEL_LOADER_H
+
+#include "algorithm.h"
+
+// Upper bound on the number of loader threads.
+#define MAX_LOAD_THREADS 64
+
+// Same result as loadAccountsFromCSV, but the file is split into newline-aligned chunks that are
+// parsed by `threads` threads and merged back in file order.
+struct BankAccount* loadAccountsFromCSVParallel(const char *filename, int *accountCount, int threads);
+
+// Thread count to use when none is given: $ATM_LOAD_THREADS, otherwise the number of online CPUs.
+int defaultLoadThreads();
+
+#endif // PROGRAMMING_ASSIGNMENT_PARALLEL_LOADER_H
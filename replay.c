@@ -0,0 +1,249 @@
+//
+// Replay of the transaction log over a set of accounts.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "replay.h"
+#include "account_index.h"
+#include "parallel_loader.h"
+
+// One replay thread. It is given only the records of the accounts it owns (see
+// partitionRecords), so no two threads ever touch the same account.
+struct ReplayWorker {
+    const struct TransactionRecord *records;
+    long count;
+    struct BankAccount *accounts;
+    int accountCount;
+    struct AccountIndex *index;     // NULL for an array that is not registered
+    uint8_t *changed;               // changed[position] is set for every account the replay modifies
+    pthread_t thread;
+    bool started;                   // Running on its own thread
+    uint64_t applied;
+    uint64_t unknownAccounts;
+    struct ReplayMismatch *mismatches;
+    long mismatchCount;
+    long mismatchCapacity;
+};
+
+static int ownerOf(int accountNumber, int threads) {
+    return (int)((((uint32_t)accountNumber * 2654435761u) >> 16) % (uint32_t)threads);
+}
+
+static void addMismatch(struct ReplayWorker *worker, const struct TransactionRecord *record, int64_t replayed) {
+    if (worker->mismatchCount == worker->mismatchCapacity) {
+        worker->mismatchCapacity = worker->mismatchCapacity ? 2 * worker->mismatchCapacity : 64;
+        worker->mismatches = realloc(worker->mismatches, worker->mismatchCapacity * sizeof(struct ReplayMismatch));
+    }
+    struct ReplayMismatch *mismatch = &worker->mismatches[worker->mismatchCount++];
+    mismatch->sequence = record->sequence;
+    mismatch->accountNumber = record->accountNumber;
+    mismatch->operation = (enum TransactionOp)record->operation;
+    mismatch->replayedBalance = replayed;
+    mismatch->loggedBalance = record->balanceBefore;
+}
+
+static void* replayWorkerMain(void *arg) {
+    struct ReplayWorker *worker = arg;
+    for (long i = 0; i < worker->count; i++) {
+        const struct TransactionRecord *record = &worker->records[i];
+        int position;
+        if (worker->index != NULL) {
+            position = accountIndexLookup(worker->index, record->accountNumber);
+        } else {
+            struct BankAccount *account = findAccount(worker->accounts, worker->accountCount, record->accountNumber);
+            position = account != NULL ? (int)(account - worker->accounts) : -1;
+        }
+        if (position < 0) {
+            worker->unknownAccounts++;
+            continue;
+        }
+        struct BankAccount *account = &worker->accounts[position];
+        worker->applied++;
+        switch (record->operation) {
+            case TRANSACTION_WITHDRAWAL:
+            case TRANSACTION_DEPOSIT:
+            case TRANSACTION_CHECK_BALANCE: {
+                Money replayed = account->balance;
+                if (replayed != record->balanceBefore) {
+                    addMismatch(worker, record, replayed);
+                }
+                // The log is the record of what happened: carry on from its balance.
+                if (record->operation != TRANSACTION_CHECK_BALANCE || replayed != record->balanceAfter) {
+                    account->balance = record->balanceAfter;
+                    worker->changed[position] = 1;
+                }
+                break;
+            }
+            case TRANSACTION_CARD_RETAINED:
+                account->blocked = true;
+                worker->changed[position] = 1;
+                break;
+            default:
+                // A PIN change does not log the new PIN; nothing to replay.
+                break;
+        }
+    }
+    return NULL;
+}
+
+static int compareMismatches(const void *a, const void *b) {
+    uint64_t x = ((const struct ReplayMismatch *)a)->sequence, y = ((const struct ReplayMismatch *)b)->sequence;
+    return (x > y) - (x < y);
+}
+
+// Copy records[0..count) into partitioned grouped by owner, keeping their order within each group:
+// worker t gets partitioned[starts[t]..starts[t + 1]). One pass to count, one to scatter.
+static void partitionRecords(const struct TransactionRecord *records, long count, int threads,
+                             struct TransactionRecord *partitioned, long *starts) {
+    long next[MAX_LOAD_THREADS];
+    memset(next, 0, sizeof(next));
+    for (long i = 0; i < count; i++) {
+        next[ownerOf(records[i].accountNumber, threads)]++;
+    }
+    long start = 0;
+    for (int t = 0; t < threads; t++) {
+        long size = next[t];
+        starts[t] = next[t] = start;
+        start += size;
+    }
+    starts[threads] = count;
+    for (long i = 0; i < count; i++) {
+        partitioned[next[ownerOf(records[i].accountNumber, threads)]++] = records[i];
+    }
+}
+
+// Start applying records[0..count) on every worker, each on its own thread so that the caller
+// can read the next segment meanwhile. With several workers the records are partitioned into
+// `partitioned` (room for count records) first.
+static void runWorkers(struct ReplayWorker *workers, int threads, const struct TransactionRecord *records, long count,
+                       struct TransactionRecord *partitioned) {
+    long starts[MAX_LOAD_THREADS + 1] = {0, count};
+    if (threads > 1) {
+        partitionRecords(records, count, threads, partitioned, starts);
+        records = partitioned;
+    }
+    for (int t = 0; t < threads; t++) {
+        workers[t].records = records + starts[t];
+        workers[t].count = starts[t + 1] - starts[t];
+        workers[t].started = pthread_create(&workers[t].thread, NULL, replayWorkerMain, &workers[t]) == 0;
+        if (!workers[t].started) {
+            replayWorkerMain(&workers[t]);
+        }
+    }
+}
+
+static void joinWorkers(struct ReplayWorker *workers, int threads) {
+    for (int t = 0; t < threads; t++) {
+        if (workers[t].started) {
+            pthread_join(workers[t].thread, NULL);
+            workers[t].started = false;
+        }
+    }
+}
+
+bool replayTransactionLog(const char *logFile, uint64_t fromSequence, struct BankAccount *accounts, int accountCount,
+                          int threads, struct ReplayResult *result) {
+    memset(result, 0, sizeof(*result));
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_LOAD_THREADS) {
+        threads = MAX_LOAD_THREADS;
+    }
+    int segmentCount;
+    char **segments = listLogSegments(logFile, &segmentCount);
+    if (segmentCount == 0) {
+        printf("Error: Could not open %s\n", logFile);
+        return false;
+    }
+    // Build the index now; the workers only read it.
+    struct AccountIndex *index = accountIndexFor(accounts, accountCount);
+    uint8_t *changed = calloc(accountCount > 0 ? accountCount : 1, 1);
+    struct ReplayWorker *workers = calloc(threads, sizeof(struct ReplayWorker));
+    for (int t = 0; t < threads; t++) {
+        workers[t].accounts = accounts;
+        workers[t].accountCount = accountCount;
+        workers[t].index = index;
+        workers[t].changed = changed;
+    }
+
+    long count;
+    struct TransactionRecord *records = readTransactionLog(segments[0], &count);
+    bool ok = records != NULL;
+    // The records of the segment being applied, grouped by worker; reused from segment to segment.
+    struct TransactionRecord *partitioned = NULL;
+    long partitionedCapacity = 0;
+    for (int s = 0; s < segmentCount && records != NULL; s++) {
+        // Records are in sequence order: skip those before fromSequence.
+        long first = 0;
+        while (first < count && records[first].sequence < fromSequence) {
+            first++;
+        }
+        long kept = count - first;
+        if (kept > 0) {
+            uint64_t firstSequence = records[first].sequence;
+            uint64_t expectedFirst = result->lastSequence ? result->lastSequence + 1
+                                                          : (fromSequence > 0 ? fromSequence : 1);
+            if (firstSequence > expectedFirst) {
+                result->missingRecords += firstSequence - expectedFirst;
+            }
+            result->missingRecords += records[count - 1].sequence - firstSequence + 1 - (uint64_t)kept;
+            result->lastSequence = records[count - 1].sequence;
+            if (threads > 1 && kept > partitionedCapacity) {
+                free(partitioned);
+                partitionedCapacity = kept;
+                partitioned = malloc(partitionedCapacity * sizeof(struct TransactionRecord));
+            }
+            runWorkers(workers, threads, records + first, kept, partitioned);
+        }
+        // Read the next segment while the workers apply this one.
+        long nextCount = 0;
+        struct TransactionRecord *next = NULL;
+        if (s + 1 < segmentCount) {
+            next = readTransactionLog(segments[s + 1], &nextCount);
+            ok = next != NULL;
+        }
+        if (kept > 0) {
+            joinWorkers(workers, threads);
+        }
+        free(records);
+        records = next;
+        count = nextCount;
+    }
+    free(records);
+    free(partitioned);
+    freeLogSegments(segments, segmentCount);
+
+    for (int t = 0; t < threads; t++) {
+        result->records += workers[t].applied;
+        result->unknownAccounts += workers[t].unknownAccounts;
+        result->mismatchCount += workers[t].mismatchCount;
+    }
+    result->mismatches = malloc((result->mismatchCount > 0 ? result->mismatchCount : 1) * sizeof(struct ReplayMismatch));
+    long merged = 0;
+    for (int t = 0; t < threads; t++) {
+        if (workers[t].mismatchCount > 0) {
+            memcpy(result->mismatches + merged, workers[t].mismatches,
+                   workers[t].mismatchCount * sizeof(struct ReplayMismatch));
+            merged += workers[t].mismatchCount;
+        }
+        free(workers[t].mismatches);
+    }
+    qsort(result->mismatches, result->mismatchCount, sizeof(struct ReplayMismatch), compareMismatches);
+    for (int i = 0; i < accountCount; i++) {
+        if (changed[i]) {
+            markAccountDirty(&accounts[i]);
+        }
+    }
+    free(changed);
+    free(workers);
+    return ok;
+}
+
+void freeReplayResult(struct ReplayResult *result) {
+    free(result->mismatches);
+    result->mismatches = NULL;
+    result->mismatchCount = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef PROGRAMMING_ASSIGNMENT_REPLAY_H
+#define PROGRAMMING_ASSIGNMENT_REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "algorithm.h"
+#include "transaction_log.h"
+
+// Replay of the transaction log over a set of accounts: every withdrawal and deposit sets the
+// account's balance to the record's balance after, a retained card blocks the account, and every
+// record that carries a balance is checked against the balance replayed so far. The log is read
+// one segment at a time (the next one is read while the current one is applied) and the records
+// of a segment are applied on several threads, each owning a share of the accounts, so the records
+// of one account are always applied in sequence order. Each segment's records are grouped by owner
+// once, so every thread only goes through its own.
+
+// A record whose balance before does not match the replayed balance of its account.
+struct ReplayMismatch {
+    uint64_t sequence;
+    int accountNumber;
+    enum TransactionOp operation;
+    Money replayedBalance;      // As replayed up to this record
+    Money loggedBalance;        // The record's balance before
+};
+
+struct ReplayResult {
+    uint64_t records;           // Records applied or checked
+    uint64_t unknownAccounts;   // Records of accounts that are not in the table (skipped)
+    uint64_t missingRecords;    // Gaps in the sequence numbers, e.g. segments deleted by retention
+    uint64_t lastSequence;      // Last record replayed, 0 if none
+    struct ReplayMismatch *mismatches;  // In sequence order
+    long mismatchCount;
+};
+
+// Replay every record of the log at logFile (its segments, oldest first, then the file itself)
+// with a sequence number of at least fromSequence over accounts, on `threads` threads.
+// The accounts that change are marked dirty, so saveAccounts() writes them out.
+// Returns false if the log can not be read; result then holds what was replayed before the error.
+bool replayTransactionLog(const char *logFile, uint64_t fromSequence, struct BankAccount *accounts, int accountCount,
+                          int threads, struct ReplayResult *result);
+void freeReplayResult(struct ReplayResult *result);
+
+#endif // PROGRAMMING_ASSIGNMENT_REPLAY_H
@@ -0,0 +1,294 @@
+//
+// End-of-day aggregates over the account table: one pass, SIMD kernels, split between threads.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "report.h"
+#include "parallel_loader.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define REPORT_HAVE_X86_SIMD 1
+#endif
+
+// Below this many accounts per thread the threads cost more than they save.
+#define REPORT_MIN_ACCOUNTS_PER_THREAD (1L << 18)
+
+// What one kernel adds up over its share of the table. Bands are counted cumulatively, as the
+// number of balances at or above each limit, which takes one compare per limit and no branches;
+// the band counts are the differences.
+struct ReportPartial {
+    Money total;
+    long blocked;
+    long atLeast[REPORT_MAX_BANDS - 1];
+};
+
+static void reportScalar(const Money *balances, const uint8_t *blocked, long count, const Money *limits,
+                         int limitCount, struct ReportPartial *partial) {
+    for (long i = 0; i < count; i++) {
+        partial->total += balances[i];
+        partial->blocked += blocked[i];
+        for (int k = 0; k < limitCount; k++) {
+            partial->atLeast[k] += balances[i] >= limits[k];
+        }
+    }
+}
+
+#ifdef REPORT_HAVE_X86_SIMD
+// Blocks of 16 accounts: one load of blocked flags, eight of two balances each. balance >= limit
+// is computed as balance > limit - 1, and a true compare is -1, so subtracting it counts.
+__attribute__((target("sse4.2")))
+static void reportSSE(const Money *balances, const uint8_t *blocked, long count, const Money *limits,
+                      int limitCount, struct ReportPartial *partial) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    __m128i flags = zero;
+    __m128i below[REPORT_MAX_BANDS - 1];
+    __m128i atLeast[REPORT_MAX_BANDS - 1];
+    for (int k = 0; k < limitCount; k++) {
+        below[k] = _mm_set1_epi64x(limits[k] - 1);
+        atLeast[k] = zero;
+    }
+    long i = 0;
+    for (; i + 16 <= count; i += 16) {
+        flags = _mm_add_epi64(flags, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(blocked + i)), zero));
+        for (int j = 0; j < 16; j += 2) {
+            __m128i balance = _mm_loadu_si128((const __m128i *)(balances + i + j));
+            total = _mm_add_epi64(total, balance);
+            for (int k = 0; k < limitCount; k++) {
+                atLeast[k] = _mm_sub_epi64(atLeast[k], _mm_cmpgt_epi64(balance, below[k]));
+            }
+        }
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, total);
+    partial->total += lanes[0] + lanes[1];
+    _mm_storeu_si128((__m128i *)lanes, flags);
+    partial->blocked += lanes[0] + lanes[1];
+    for (int k = 0; k < limitCount; k++) {
+        _mm_storeu_si128((__m128i *)lanes, atLeast[k]);
+        partial->atLeast[k] += lanes[0] + lanes[1];
+    }
+    reportScalar(balances + i, blocked + i, count - i, limits, limitCount, partial);
+}
+
+// The same with blocks of 32 accounts and four balances per vector.
+__attribute__((target("avx2")))
+static void reportAVX2(const Money *balances, const uint8_t *blocked, long count, const Money *limits,
+                       int limitCount, struct ReportPartial *partial) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    __m256i flags = zero;
+    __m256i below[REPORT_MAX_BANDS - 1];
+    __m256i atLeast[REPORT_MAX_BANDS - 1];
+    for (int k = 0; k < limitCount; k++) {
+        below[k] = _mm256_set1_epi64x(limits[k] - 1);
+        atLeast[k] = zero;
+    }
+    long i = 0;
+    for (; i + 32 <= count; i += 32) {
+        flags = _mm256_add_epi64(flags, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(blocked + i)), zero));
+        for (int j = 0; j < 32; j += 4) {
+            __m256i balance = _mm256_loadu_si256((const __m256i *)(balances + i + j));
+            total = _mm256_add_epi64(total, balance);
+            for (int k = 0; k < limitCount; k++) {
+                atLeast[k] = _mm256_sub_epi64(atLeast[k], _mm256_cmpgt_epi64(balance, below[k]));
+            }
+        }
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, total);
+    partial->total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i *)lanes, flags);
+    partial->blocked += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (int k = 0; k < limitCount; k++) {
+        _mm256_storeu_si256((__m256i *)lanes, atLeast[k]);
+        partial->atLeast[k] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    reportScalar(balances + i, blocked + i, count - i, limits, limitCount, partial);
+}
+#endif
+
+enum ReportKernel bestReportKernel() {
+#ifdef REPORT_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        return REPORT_KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return REPORT_KERNEL_SSE;
+    }
+#endif
+    return REPORT_KERNEL_SCALAR;
+}
+
+// One thread's share: a range of the store's arrays, or of a struct BankAccount array.
+struct ReportWorker {
+    const Money *balances;
+    const uint8_t *blocked;
+    const struct BankAccount *accounts;     // Set instead of balances/blocked for an array
+    long count;
+    const Money *limits;
+    int limitCount;
+    enum ReportKernel kernel;
+    struct ReportPartial partial;
+    pthread_t thread;
+    bool started;
+};
+
+static void* reportWorkerMain(void *arg) {
+    struct ReportWorker *worker = arg;
+    struct ReportPartial *partial = &worker->partial;
+    if (worker->accounts != NULL) {
+        for (long i = 0; i < worker->count; i++) {
+            const struct BankAccount *account = &worker->accounts[i];
+            partial->total += account->balance;
+            partial->blocked += account->blocked;
+            for (int k = 0; k < worker->limitCount; k++) {
+                partial->atLeast[k] += account->balance >= worker->limits[k];
+            }
+        }
+        return NULL;
+    }
+    switch (worker->kernel) {
+#ifdef REPORT_HAVE_X86_SIMD
+        case REPORT_KERNEL_AVX2:
+            reportAVX2(worker->balances, worker->blocked, worker->count, worker->limits, worker->limitCount, partial);
+            break;
+        case REPORT_KERNEL_SSE:
+            reportSSE(worker->balances, worker->blocked, worker->count, worker->limits, worker->limitCount, partial);
+            break;
+#endif
+        default:
+            reportScalar(worker->balances, worker->blocked, worker->count, worker->limits, worker->limitCount, partial);
+            break;
+    }
+    return NULL;
+}
+
+static bool validLimits(const Money *limits, int limitCount) {
+    if (limitCount < 0 || limitCount >= REPORT_MAX_BANDS || (limitCount > 0 && limits == NULL)) {
+        return false;
+    }
+    for (int k = 0; k < limitCount; k++) {
+        // limits[k] - 1 must not overflow in the kernels; a band below INT64_MIN would be empty anyway.
+        if (limits[k] == INT64_MIN || (k > 0 && limits[k] <= limits[k - 1])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Split count accounts between threads in ranges that are whole blocks of 64, run the workers
+// (the first on the calling thread) and add their partials up into report.
+static void runReport(const Money *balances, const uint8_t *blocked, const struct BankAccount *accounts, long count,
+                      const Money *limits, int limitCount, int threads, enum ReportKernel kernel,
+                      struct EndOfDayReport *report) {
+    if (threads > MAX_LOAD_THREADS) {
+        threads = MAX_LOAD_THREADS;
+    }
+    if (threads > count / REPORT_MIN_ACCOUNTS_PER_THREAD) {
+        threads = (int)(count / REPORT_MIN_ACCOUNTS_PER_THREAD);
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    struct ReportWorker workers[MAX_LOAD_THREADS];
+    memset(workers, 0, threads * sizeof(struct ReportWorker));
+    long share = (count / threads + 63) / 64 * 64;
+    for (int t = 0; t < threads; t++) {
+        long first = t * share < count ? t * share : count;
+        long last = first + share < count && t < threads - 1 ? first + share : count;
+        workers[t].balances = balances != NULL ? balances + first : NULL;
+        workers[t].blocked = blocked != NULL ? blocked + first : NULL;
+        workers[t].accounts = accounts != NULL ? accounts + first : NULL;
+        workers[t].count = last - first;
+        workers[t].limits = limits;
+        workers[t].limitCount = limitCount;
+        workers[t].kernel = kernel;
+    }
+    for (int t = 1; t < threads; t++) {
+        workers[t].started = pthread_create(&workers[t].thread, NULL, reportWorkerMain, &workers[t]) == 0;
+        if (!workers[t].started) {
+            reportWorkerMain(&workers[t]);
+        }
+    }
+    reportWorkerMain(&workers[0]);
+
+    struct ReportPartial sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int t = 0; t < threads; t++) {
+        if (workers[t].started) {
+            pthread_join(workers[t].thread, NULL);
+        }
+        sum.total += workers[t].partial.total;
+        sum.blocked += workers[t].partial.blocked;
+        for (int k = 0; k < limitCount; k++) {
+            sum.atLeast[k] += workers[t].partial.atLeast[k];
+        }
+    }
+    report->accounts = count;
+    report->totalBalance = sum.total;
+    report->blockedCards = sum.blocked;
+    report->bandCount = limitCount + 1;
+    for (int b = 0; b <= limitCount; b++) {
+        long atOrAbove = b > 0 ? sum.atLeast[b - 1] : count;
+        long above = b < limitCount ? sum.atLeast[b] : 0;
+        report->bands[b] = atOrAbove - above;
+    }
+}
+
+bool endOfDayReportWith(const struct AccountStore *store, const Money *limits, int limitCount, int threads,
+                        enum ReportKernel kernel, struct EndOfDayReport *report) {
+    memset(report, 0, sizeof(*report));
+    if (!validLimits(limits, limitCount)) {
+        return false;
+    }
+    // A kernel this CPU lacks falls back to the best one it has (never above what was asked for).
+    enum ReportKernel best = bestReportKernel();
+    if (kernel == REPORT_KERNEL_AUTO || kernel > best) {
+        kernel = best;
+    }
+    runReport(store->balances, store->blocked, NULL, store->count, limits, limitCount, threads, kernel, report);
+    return true;
+}
+
+bool endOfDayReport(const struct AccountStore *store, const Money *limits, int limitCount, int threads,
+                    struct EndOfDayReport *report) {
+    return endOfDayReportWith(store, limits, limitCount, threads, REPORT_KERNEL_AUTO, report);
+}
+
+bool endOfDayReportAccounts(const struct BankAccount *accounts, int count, const Money *limits, int limitCount,
+                            int threads, struct EndOfDayReport *report) {
+    memset(report, 0, sizeof(*report));
+    if (!validLimits(limits, limitCount)) {
+        return false;
+    }
+    runReport(NULL, NULL, accounts, count, limits, limitCount, threads, REPORT_KERNEL_SCALAR, report);
+    return true;
+}
+
+void printEndOfDayReport(const struct EndOfDayReport *report, const Money *limits) {
+    char text[MONEY_TEXT_SIZE];
+    char high[MONEY_TEXT_SIZE];
+    formatMoneyDisplay(report->totalBalance, text, sizeof(text));
+    printf("Accounts: %ld\n", report->accounts);
+    printf("Total balance: %s\n", text);
+    printf("Blocked cards: %ld\n", report->blockedCards);
+    for (int b = 0; b < report->bandCount; b++) {
+        if (b == 0 && report->bandCount == 1) {
+            printf("  all balances: %ld\n", report->bands[b]);
+        } else if (b == 0) {
+            formatMoneyDisplay(limits[0], text, sizeof(text));
+            printf("  below %s: %ld\n", text, report->bands[b]);
+        } else if (b == report->bandCount - 1) {
+            formatMoneyDisplay(limits[b - 1], text, sizeof(text));
+            printf("  %s and above: %ld\n", text, report->bands[b]);
+        } else {
+            formatMoneyDisplay(limits[b - 1], text, sizeof(text));
+            formatMoneyDisplay(limits[b], high, sizeof(high));
+            printf("  %s to below %s: %ld\n", text, high, report->bands[b]);
+        }
+    }
+}
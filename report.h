@@ -0,0 +1,48 @@
+#ifndef PROGRAMMING_ASSIGNMENT_REPORT_H
+#define PROGRAMMING_ASSIGNMENT_REPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "algorithm.h"
+#include "account_store.h"
+
+// End-of-day totals over the whole account table, computed in one pass: the sum of the balances,
+// the number of blocked cards and how many balances fall into each band. Over an AccountStore the
+// pass runs AVX2 or SSE4.2 kernels (picked at run time, scalar elsewhere) on the dense balance and
+// blocked arrays; large tables are split between threads.
+
+// Bands are given by their lower limits: with limits {0, 100000} (pence) the bands are
+// "below 0", "0 to 999.99" and "1000 and above".
+#define REPORT_MAX_BANDS 16
+
+struct EndOfDayReport {
+    long accounts;
+    Money totalBalance;
+    long blockedCards;
+    int bandCount;                      // limitCount + 1
+    long bands[REPORT_MAX_BANDS];       // bands[b]: balances in [limits[b-1], limits[b])
+};
+
+enum ReportKernel {
+    REPORT_KERNEL_AUTO,     // The best kernel this CPU supports
+    REPORT_KERNEL_SCALAR,
+    REPORT_KERNEL_SSE,      // SSE4.2 (64-bit compares)
+    REPORT_KERNEL_AVX2
+};
+
+// Report over store on up to `threads` threads. limits[limitCount] must be strictly ascending and
+// limitCount below REPORT_MAX_BANDS; returns false (and leaves report empty) otherwise.
+bool endOfDayReport(const struct AccountStore *store, const Money *limits, int limitCount, int threads,
+                    struct EndOfDayReport *report);
+// The same with a given kernel; a kernel the CPU does not support falls back to the next one down.
+bool endOfDayReportWith(const struct AccountStore *store, const Money *limits, int limitCount, int threads,
+                        enum ReportKernel kernel, struct EndOfDayReport *report);
+// The same report over a struct BankAccount array (scalar: the fields are 72 bytes apart).
+bool endOfDayReportAccounts(const struct BankAccount *accounts, int count, const Money *limits, int limitCount,
+                            int threads, struct EndOfDayReport *report);
+// Kernel that REPORT_KERNEL_AUTO picks on this CPU.
+enum ReportKernel bestReportKernel();
+// Print report with the bands labelled by limits.
+void printEndOfDayReport(const struct EndOfDayReport *report, const Money *limits);
+
+#endif // PROGRAMMING_ASSIGNMENT_REPORT_H
@@ -0,0 +1,370 @@
+//
+// Shared-nothing sharded engine: one worker per shard, SPSC queues between clients and workers.
+//
+#define _GNU_SOURCE     // pthread_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "shard_engine.h"
+#include "account_index.h"
+#include "journal.h"
+#include "transaction_log.h"
+
+// Empty passes over its queues after which an idle worker starts yielding the CPU.
+#define SHARD_IDLE_SPINS 64
+
+// Single-producer/single-consumer ring. Each index is written by one side only, and the two live
+// on separate cache lines so that the producer and the consumer do not share a line.
+struct SpscQueue {
+    alignas(64) _Atomic uint64_t head;  // Next message to read; written by the consumer
+    alignas(64) _Atomic uint64_t tail;  // Next slot to write; written by the producer
+    alignas(64) struct ShardMessage slots[SHARD_QUEUE_CAPACITY];
+};
+
+struct Shard {
+    struct ShardedEngine *engine;
+    int id;
+    struct BankAccount *accounts;   // This shard's copies
+    int *origins;                   // origins[i]: where accounts[i] was in the array the engine copied
+    int count;
+    struct AccountIndex index;      // The shard's own, not in the registry of account_index.h
+    bool indexed;                   // Linear search if the index could not be built
+    struct SpscQueue *requests;     // requests[client]: client -> worker
+    struct SpscQueue *answers;      // answers[client]: worker -> client
+    // One pass over the queues: up to SHARD_QUEUE_CAPACITY requests of every client, and for each
+    // the account it changed (or NULL) and its log record.
+    struct ShardMessage *pass;
+    struct BankAccount **changed;
+    struct TransactionRecord *records;
+    pthread_t thread;
+    bool started;
+    alignas(64) _Atomic uint64_t processed;
+};
+
+// What a client keeps per shard; only its own thread touches it.
+struct ShardClient {
+    alignas(64) uint64_t submitted[MAX_SHARDS];
+    uint64_t collected[MAX_SHARDS];
+    int nextShard;                  // Where shardCollect() starts, so no shard is favoured
+};
+
+struct ShardedEngine {
+    int shardCount;
+    int clientCount;
+    bool pinWorkers;
+    _Atomic bool stopping;
+    struct Shard shards[MAX_SHARDS];
+    struct ShardClient *clients;
+};
+
+static bool queuePush(struct SpscQueue *queue, const struct ShardMessage *message) {
+    uint64_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&queue->head, memory_order_acquire) == SHARD_QUEUE_CAPACITY) {
+        return false;
+    }
+    queue->slots[tail % SHARD_QUEUE_CAPACITY] = *message;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static bool queuePop(struct SpscQueue *queue, struct ShardMessage *message) {
+    uint64_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&queue->tail, memory_order_acquire)) {
+        return false;
+    }
+    *message = queue->slots[head % SHARD_QUEUE_CAPACITY];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+int shardOfAccount(const struct ShardedEngine *engine, int accountNumber) {
+    // Fibonacci hashing, so that ranges of card numbers spread over all shards.
+    return (int)((((uint32_t)accountNumber * 2654435761u) >> 16) % (uint32_t)engine->shardCount);
+}
+
+static struct BankAccount* shardAccount(struct Shard *shard, int accountNumber) {
+    if (shard->indexed) {
+        int position = accountIndexLookup(&shard->index, accountNumber);
+        return position >= 0 ? &shard->accounts[position] : NULL;
+    }
+    for (int i = 0; i < shard->count; i++) {
+        if (shard->accounts[i].accountNumber == accountNumber) {
+            return &shard->accounts[i];
+        }
+    }
+    return NULL;
+}
+
+// Carry out pass[i] on the shard's own accounts and turn it into its answer; changed[i] gets the
+// account if its balance changed, records[i] the log record (which also keeps the balance before).
+static void processRequest(struct Shard *shard, int i) {
+    struct ShardMessage *message = &shard->pass[i];
+    struct BankAccount *account = shardAccount(shard, message->accountNumber);
+    shard->changed[i] = NULL;
+    if (account == NULL) {
+        message->status = STATUS_UNKNOWN_ACCOUNT;
+        message->amount = 0;
+        return;
+    }
+    Money before = account->balance;
+    if (message->operation == TRANSACTION_WITHDRAWAL) {
+        message->status = debitAccount(account, message->amount, &before);
+    } else if (message->operation == TRANSACTION_DEPOSIT) {
+        message->status = creditAccount(account, message->amount, &before);
+    } else if (message->operation == TRANSACTION_CHECK_BALANCE) {
+        message->status = STATUS_OK;
+    } else {
+        message->status = STATUS_UNSUPPORTED_OPERATION;
+    }
+    message->amount = account->balance;
+    if (message->status == STATUS_OK) {
+        if (account->balance != before) {
+            shard->changed[i] = account;
+        }
+        struct TransactionRecord *record = &shard->records[i];
+        record->accountNumber = account->accountNumber;
+        record->operation = (uint16_t)message->operation;
+        record->balanceBefore = before;
+        record->balanceAfter = account->balance;
+    }
+}
+
+// Nothing is answered before it is in the journal, as with withdrawFunds()/depositFunds(): journal
+// the accounts the pass changed with one write (and one fsync), then queue its log records. If the
+// journal can not be written the changes are taken back (no other thread touches these accounts)
+// and answered STATUS_NOT_RECORDED.
+static void recordPass(struct Shard *shard, int count) {
+    int changedCount = 0;
+    const struct BankAccount **changed = (const struct BankAccount **)shard->changed;
+    for (int i = 0; i < count; i++) {
+        if (shard->changed[i] != NULL) {
+            changed[changedCount++] = shard->changed[i];  // Compacted in place; i >= changedCount
+        }
+    }
+    if (!journalAccounts(changed, changedCount)) {
+        // Newest first, so each account ends up with the balance it had before the pass.
+        for (int i = count - 1; i >= 0; i--) {
+            struct ShardMessage *message = &shard->pass[i];
+            if (message->status == STATUS_OK && message->operation != TRANSACTION_CHECK_BALANCE) {
+                struct BankAccount *account = shardAccount(shard, message->accountNumber);
+                account->balance = shard->records[i].balanceBefore;
+                message->status = STATUS_NOT_RECORDED;
+            }
+        }
+        // Every answer of the pass shows the balance as it is now.
+        for (int i = 0; i < count; i++) {
+            struct BankAccount *account = shardAccount(shard, shard->pass[i].accountNumber);
+            if (account != NULL) {
+                shard->pass[i].amount = account->balance;
+            }
+        }
+        return;
+    }
+    int logged = 0;
+    for (int i = 0; i < count; i++) {
+        if (shard->pass[i].status == STATUS_OK) {
+            shard->records[logged++] = shard->records[i];
+        }
+    }
+    if (!appendTransactionLogRecords(shard->records, logged)) {
+        printf("Error: Could not write to the log file.\n");
+    }
+}
+
+static void pinToCpu(int cpu) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % (int)cpus, &set);
+    // Best effort: a container may not allow it, and the worker runs unpinned then.
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void* shardWorker(void *arg) {
+    struct Shard *shard = arg;
+    struct ShardedEngine *engine = shard->engine;
+    if (engine->pinWorkers) {
+        pinToCpu(shard->id);
+    }
+    int idle = 0;
+    int taken[MAX_SHARD_CLIENTS];
+    while (true) {
+        int handled = 0;
+        for (int client = 0; client < engine->clientCount; client++) {
+            // Never more than a queue's worth at a time, so the other clients get their turn.
+            taken[client] = 0;
+            while (taken[client] < SHARD_QUEUE_CAPACITY && queuePop(&shard->requests[client], &shard->pass[handled])) {
+                processRequest(shard, handled);
+                taken[client]++;
+                handled++;
+            }
+        }
+        if (handled > 0) {
+            recordPass(shard, handled);
+            // Always room: a client has at most SHARD_QUEUE_CAPACITY requests outstanding.
+            int next = 0;
+            for (int client = 0; client < engine->clientCount; client++) {
+                for (int n = 0; n < taken[client]; n++) {
+                    queuePush(&shard->answers[client], &shard->pass[next++]);
+                }
+            }
+            atomic_fetch_add_explicit(&shard->processed, (uint64_t)handled, memory_order_relaxed);
+            idle = 0;
+        } else if (atomic_load(&engine->stopping)) {
+            break;
+        } else if (++idle > SHARD_IDLE_SPINS) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+struct ShardedEngine* startShardedEngine(const struct BankAccount *accounts, int count, int shards, int clients,
+                                         bool pinWorkers) {
+    if (shards < 1 || shards > MAX_SHARDS || clients < 1 || clients > MAX_SHARD_CLIENTS) {
+        return NULL;
+    }
+    struct ShardedEngine *engine = aligned_alloc(64, (sizeof(struct ShardedEngine) + 63) / 64 * 64);
+    if (engine == NULL) {
+        printf("Error: Out of memory starting the sharded engine.\n");
+        return NULL;
+    }
+    memset(engine, 0, sizeof(*engine));
+    engine->shardCount = shards;
+    engine->clientCount = clients;
+    engine->pinWorkers = pinWorkers;
+    atomic_store(&engine->stopping, false);
+    // Out of memory, stopShardedEngine() frees what was allocated (and starts no thread).
+    engine->clients = aligned_alloc(64, clients * sizeof(struct ShardClient));
+    if (engine->clients == NULL) {
+        printf("Error: Out of memory starting the sharded engine.\n");
+        stopShardedEngine(engine, NULL, 0);
+        return NULL;
+    }
+    memset(engine->clients, 0, clients * sizeof(struct ShardClient));
+
+    // Size the shards first, then copy each account into its own shard.
+    int sizes[MAX_SHARDS] = {0};
+    for (int i = 0; i < count; i++) {
+        sizes[shardOfAccount(engine, accounts[i].accountNumber)]++;
+    }
+    for (int s = 0; s < shards; s++) {
+        struct Shard *shard = &engine->shards[s];
+        shard->engine = engine;
+        shard->id = s;
+        shard->accounts = malloc((sizes[s] > 0 ? sizes[s] : 1) * sizeof(struct BankAccount));
+        shard->origins = malloc((sizes[s] > 0 ? sizes[s] : 1) * sizeof(int));
+        shard->pass = malloc(clients * SHARD_QUEUE_CAPACITY * sizeof(struct ShardMessage));
+        shard->changed = malloc(clients * SHARD_QUEUE_CAPACITY * sizeof(struct BankAccount *));
+        shard->records = calloc(clients * SHARD_QUEUE_CAPACITY, sizeof(struct TransactionRecord));
+        shard->requests = aligned_alloc(64, clients * sizeof(struct SpscQueue));
+        shard->answers = aligned_alloc(64, clients * sizeof(struct SpscQueue));
+        if (shard->accounts == NULL || shard->origins == NULL || shard->pass == NULL || shard->changed == NULL || shard->records == NULL ||
+            shard->requests == NULL || shard->answers == NULL) {
+            printf("Error: Out of memory starting the sharded engine.\n");
+            stopShardedEngine(engine, NULL, 0);
+            return NULL;
+        }
+        memset(shard->requests, 0, clients * sizeof(struct SpscQueue));
+        memset(shard->answers, 0, clients * sizeof(struct SpscQueue));
+    }
+    for (int i = 0; i < count; i++) {
+        struct Shard *shard = &engine->shards[shardOfAccount(engine, accounts[i].accountNumber)];
+        shard->origins[shard->count] = i;
+        shard->accounts[shard->count++] = accounts[i];
+    }
+    for (int s = 0; s < shards; s++) {
+        struct Shard *shard = &engine->shards[s];
+        // Built here, before the worker starts, so lookups never build or lock anything. The index
+        // is the shard's own: shards do not use up the registry entries of loaded tables.
+        shard->indexed = buildPrivateAccountIndex(&shard->index, shard->accounts, shard->count);
+    }
+    for (int s = 0; s < shards; s++) {
+        struct Shard *shard = &engine->shards[s];
+        shard->started = pthread_create(&shard->thread, NULL, shardWorker, shard) == 0;
+        if (!shard->started) {
+            printf("Error: Could not start the worker of shard %d.\n", s);
+            // No request has been submitted yet: stop the others and copy nothing back.
+            stopShardedEngine(engine, NULL, 0);
+            return NULL;
+        }
+    }
+    return engine;
+}
+
+bool shardSubmit(struct ShardedEngine *engine, int client, const struct ShardMessage *request) {
+    struct ShardClient *state = &engine->clients[client];
+    int shard = shardOfAccount(engine, request->accountNumber);
+    // Counting answers not yet collected too keeps the worker's answer queue from ever filling up.
+    if (state->submitted[shard] - state->collected[shard] == SHARD_QUEUE_CAPACITY ||
+        !queuePush(&engine->shards[shard].requests[client], request)) {
+        return false;
+    }
+    state->submitted[shard]++;
+    return true;
+}
+
+int shardCollect(struct ShardedEngine *engine, int client, struct ShardMessage *answers, int max) {
+    struct ShardClient *state = &engine->clients[client];
+    int collected = 0;
+    for (int i = 0; i < engine->shardCount && collected < max; i++) {
+        int shard = (state->nextShard + i) % engine->shardCount;
+        while (collected < max && queuePop(&engine->shards[shard].answers[client], &answers[collected])) {
+            state->collected[shard]++;
+            collected++;
+        }
+    }
+    state->nextShard = (state->nextShard + 1) % engine->shardCount;
+    return collected;
+}
+
+void shardedEngineStats(const struct ShardedEngine *engine, uint64_t *processed) {
+    for (int s = 0; s < engine->shardCount; s++) {
+        processed[s] = atomic_load_explicit(&engine->shards[s].processed, memory_order_relaxed);
+    }
+}
+
+void stopShardedEngine(struct ShardedEngine *engine, struct BankAccount *accounts, int count) {
+    // Workers only stop after a pass that found every queue empty.
+    atomic_store(&engine->stopping, true);
+    for (int s = 0; s < engine->shardCount; s++) {
+        if (engine->shards[s].started) {
+            pthread_join(engine->shards[s].thread, NULL);
+        }
+    }
+    for (int s = 0; s < engine->shardCount; s++) {
+        struct Shard *shard = &engine->shards[s];
+        // Each copy goes back to the position it came from, so accounts that share a number stay
+        // apart and no lookup is needed.
+        for (int i = 0; i < shard->count && accounts != NULL; i++) {
+            int origin = shard->origins[i];
+            struct BankAccount *account = origin < count && accounts[origin].accountNumber == shard->accounts[i].accountNumber
+                                          ? &accounts[origin] : NULL;
+            // Only balances change in a shard.
+            if (account != NULL && account->balance != shard->accounts[i].balance) {
+                account->balance = shard->accounts[i].balance;
+                markAccountDirty(account);
+            }
+        }
+        if (shard->indexed) {
+            freePrivateAccountIndex(&shard->index);
+        }
+        free(shard->accounts);
+        free(shard->origins);
+        free(shard->pass);
+        free(shard->changed);
+        free(shard->records);
+        free(shard->requests);
+        free(shard->answers);
+    }
+    free(engine->clients);
+    free(engine);
+}
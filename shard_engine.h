@@ -0,0 +1,58 @@
+#ifndef PROGRAMMING_ASSIGNMENT_SHARD_ENGINE_H
+#define PROGRAMMING_ASSIGNMENT_SHARD_ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "algorithm.h"
+
+// Shared-nothing engine: the accounts are split by account number across N shards, each its own
+// array owned by one worker thread (pinned to a CPU of its own where possible). No other thread
+// touches a shard's accounts. Clients send requests through single-producer/single-consumer queues,
+// one per client and shard, and the worker answers through a queue going the other way, so neither
+// the accounts nor the queues need a lock. The shards work on copies of the accounts, which
+// stopShardedEngine() writes back. Each shard has its own account index, outside the registry of
+// account_index.h.
+//
+// A worker takes up to a queue's worth of requests from every client, carries them out, journals
+// the accounts they changed with one write (see journalAccounts(); concurrent shards share the
+// fsync) and queues their log records before it answers any of them, so an answer means the same
+// as the return value of withdrawFunds()/depositFunds(). If the journal can not be written the
+// pass is taken back and its changes are answered STATUS_NOT_RECORDED.
+
+#define MAX_SHARDS 32
+#define MAX_SHARD_CLIENTS 64
+// Requests a client can have outstanding on one shard; a power of two.
+#define SHARD_QUEUE_CAPACITY 256
+
+// A request, and the answer to it in the same form.
+struct ShardMessage {
+    uint64_t tag;                   // Chosen by the client; comes back with the answer
+    int accountNumber;
+    enum TransactionOp operation;   // TRANSACTION_WITHDRAWAL, TRANSACTION_DEPOSIT or TRANSACTION_CHECK_BALANCE
+    Money amount;                   // Request: the amount. Answer: the balance after the operation
+    enum OperationStatus status;    // Answer only; STATUS_UNKNOWN_ACCOUNT or as withdrawFunds()/depositFunds()
+};
+
+struct ShardedEngine;
+
+// Copy accounts into `shards` shards and start their workers, with queues for `clients` clients.
+// Returns NULL if shards or clients is out of range, if out of memory, or if a worker thread can not be
+// started; whatever was allocated is freed.
+struct ShardedEngine* startShardedEngine(const struct BankAccount *accounts, int count, int shards, int clients,
+                                         bool pinWorkers);
+int shardOfAccount(const struct ShardedEngine *engine, int accountNumber);
+// Queue a request of client (0..clients-1; a client is used by one thread at a time). Returns false
+// if the client already has SHARD_QUEUE_CAPACITY requests waiting on that shard: collect answers
+// and try again.
+bool shardSubmit(struct ShardedEngine *engine, int client, const struct ShardMessage *request);
+// Move up to max answers for client into answers and return how many there were. The answers of
+// one shard come in the order the requests were submitted.
+int shardCollect(struct ShardedEngine *engine, int client, struct ShardMessage *answers, int max);
+// Requests each shard has processed so far, for shards 0..shards-1.
+void shardedEngineStats(const struct ShardedEngine *engine, uint64_t *processed);
+// Wait for the workers to finish every submitted request and stop them, copy the accounts that
+// changed back into accounts and mark them dirty, and free the engine. accounts must be the array
+// the engine was started from: each account goes back to the position it was copied from.
+void stopShardedEngine(struct ShardedEngine *engine, struct BankAccount *accounts, int count);
+
+#endif // PROGRAMMING_ASSIGNMENT_SHARD_ENGINE_H
@@ -0,0 +1,400 @@
+//
+// Versioned binary snapshots of the account table.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
+#include "snapshot.h"
+#include "parallel_loader.h"
+#include "account_index.h"
+
+_Static_assert(sizeof(struct SnapshotHeader) == 64, "snapshot header must be 64 bytes");
+
+// The running background save, if any: its thread writes backgroundCopy to backgroundFile.
+static pthread_t backgroundThread;
+static bool backgroundRunning;
+static bool backgroundFinished;     // Set by the thread (atomically) when it is done
+static bool backgroundSaved;
+static char backgroundFile[4096];
+static struct BankAccount *backgroundAccounts;
+static struct BankAccount *backgroundCopy;
+static int backgroundCount;
+static bool backgroundSnapshot;
+
+// Copy an account into its on-disk form: padding and the unused tail of the name are zeroed
+// so that identical accounts always produce identical bytes (and hashes).
+static void toRecord(const struct BankAccount *account, struct BankAccount *record) {
+    memset(record, 0, sizeof(*record));
+    record->accountNumber = account->accountNumber;
+    memcpy(record->accountHolder, account->accountHolder,
+           strnlen(account->accountHolder, sizeof(record->accountHolder) - 1));
+    record->balance = account->balance;
+    record->pinCode = account->pinCode;
+    record->blocked = account->blocked;
+}
+
+// FNV-1a over the record bytes.
+uint64_t snapshotRecordHash(const struct BankAccount *record) {
+    const unsigned char *bytes = (const unsigned char *)record;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < sizeof(*record); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool syncDirectoryOf(const char *filename) {
+    char directory[4096];
+    snprintf(directory, sizeof(directory), "%s", filename);
+    char *slash = strrchr(directory, '/');
+    if (slash == directory) {
+        slash[1] = '\0';
+    } else if (slash != NULL) {
+        *slash = '\0';
+    } else {
+        strcpy(directory, ".");
+    }
+    int fd = open(directory, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+bool replaceFileDurably(FILE *file, const char *tempName, const char *filename) {
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tempName, filename) != 0) {
+        remove(tempName);
+        return false;
+    }
+    // Without this the rename itself may not survive a crash.
+    syncDirectoryOf(filename);
+    return true;
+}
+
+bool saveAccountsSnapshot(const char *filename, const struct BankAccount *accounts, int accountCount) {
+    char tempName[4096];
+    snprintf(tempName, sizeof(tempName), "%s.tmp", filename);
+    FILE *file = fopen(tempName, "wb");
+    if (!file) {
+        printf("Error: Could not open %s for writing.\n", tempName);
+        return false;
+    }
+    struct SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, SNAPSHOT_MAGIC);
+    header.version = SNAPSHOT_VERSION;
+    header.recordSize = sizeof(struct BankAccount);
+    header.recordCount = (uint64_t)accountCount;
+    // Reserve the header; it is rewritten once the checksum is known.
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < accountCount; i++) {
+        struct BankAccount record;
+        toRecord(&accounts[i], &record);
+        header.checksum += snapshotRecordHash(&record);
+        ok = fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    // Replace the old file only once the new one is complete and on disk, so neither a crash
+    // nor a reader that has the old file mapped ever sees a truncated snapshot.
+    if (!ok) {
+        fclose(file);
+        remove(tempName);
+    }
+    if (!ok || !replaceFileDurably(file, tempName, filename)) {
+        printf("Error: Could not write %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+// Write the records at the positions in dirty over those in filename, in place (see
+// saveDirtyAccountsSnapshot). Returns dirtyCount, or -1 if the file can not be updated in place.
+static int writeDirtyRecords(const char *filename, const struct BankAccount *accounts, int accountCount,
+                             const int *dirty, int dirtyCount) {
+    const char *source = accountsSnapshotFile(accounts);
+    if (source == NULL || strcmp(source, filename) != 0) {
+        return -1;
+    }
+    int fd = open(filename, O_RDWR);
+    if (fd < 0) {
+        return -1;
+    }
+    struct SnapshotHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.recordSize != sizeof(struct BankAccount) ||
+        header.recordCount > (uint64_t)accountCount || (header.flags & SNAPSHOT_FLAG_UPDATING) != 0) {
+        close(fd);
+        return -1;
+    }
+    // First pass: check that each record being replaced belongs to the same account, and take
+    // its hash out of the checksum.
+    uint64_t checksum = header.checksum;
+    for (int i = 0; i < dirtyCount; i++) {
+        if ((uint64_t)dirty[i] >= header.recordCount) {
+            continue;  // Appended since the last save
+        }
+        struct BankAccount old;
+        off_t offset = (off_t)(sizeof(header) + (size_t)dirty[i] * sizeof(struct BankAccount));
+        if (pread(fd, &old, sizeof(old), offset) != (ssize_t)sizeof(old) ||
+            old.accountNumber != accounts[dirty[i]].accountNumber) {
+            close(fd);
+            return -1;
+        }
+        checksum -= snapshotRecordHash(&old);
+    }
+    // Mark the file as being updated before the first record changes, so that after a crash it is
+    // not taken for a snapshot whose checksum is wrong.
+    header.flags |= SNAPSHOT_FLAG_UPDATING;
+    bool ok = pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && fdatasync(fd) == 0;
+    // Second pass: write the changed records; the checksum is a sum, so it is updated per record.
+    for (int i = 0; ok && i < dirtyCount; i++) {
+        struct BankAccount record;
+        toRecord(&accounts[dirty[i]], &record);
+        checksum += snapshotRecordHash(&record);
+        off_t offset = (off_t)(sizeof(header) + (size_t)dirty[i] * sizeof(struct BankAccount));
+        ok = pwrite(fd, &record, sizeof(record), offset) == (ssize_t)sizeof(record);
+    }
+    // The records are on disk before the header that vouches for them.
+    ok = ok && fdatasync(fd) == 0;
+    header.recordCount = (uint64_t)accountCount;
+    header.checksum = checksum;
+    header.flags &= ~SNAPSHOT_FLAG_UPDATING;
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && fdatasync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok) {
+        printf("Error: Could not update %s\n", filename);
+        return -1;
+    }
+    return dirtyCount;
+}
+
+int saveDirtyAccountsSnapshot(const char *filename, struct BankAccount *accounts, int accountCount) {
+    // Accounts changed while this runs are listed again, for the next save.
+    int dirtyCount;
+    int *dirty = takeDirtyAccounts(accounts, &dirtyCount);
+    int written = writeDirtyRecords(filename, accounts, accountCount, dirty, dirtyCount);
+    if (written < 0) {
+        restoreDirtyAccounts(accounts, dirty, dirtyCount);
+    } else {
+        free(dirty);
+    }
+    return written;
+}
+
+bool isAccountsSnapshot(const char *filename) {
+    char magic[8];
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+    bool match = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return match;
+}
+
+struct BankAccount* openAccountsSnapshot(const char *filename, int *accountCount, bool verify) {
+    *accountCount = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open %s\n", filename);
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct SnapshotHeader)) {
+        printf("Error: %s is not an account snapshot.\n", filename);
+        close(fd);
+        return NULL;
+    }
+    // Private and writable: sessions update records in memory without touching the file.
+    char *data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: Could not map %s\n", filename);
+        return NULL;
+    }
+    const struct SnapshotHeader *header = (const struct SnapshotHeader *)data;
+    const char *problem = NULL;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        problem = "is not an account snapshot";
+    } else if ((header->version != SNAPSHOT_VERSION && header->version != 1) ||
+               header->recordSize != sizeof(struct BankAccount)) {
+        problem = "was written by an incompatible version";
+    } else if (header->recordCount > INT32_MAX ||
+               (size_t)info.st_size != sizeof(*header) + header->recordCount * sizeof(struct BankAccount)) {
+        problem = "has the wrong size";
+    }
+    struct BankAccount *accounts = (struct BankAccount *)(data + sizeof(*header));
+    bool interrupted = problem == NULL && (header->flags & SNAPSHOT_FLAG_UPDATING) != 0;
+    if (interrupted) {
+        printf("Warning: %s was being updated when it was last written; its journal restores the changed accounts.\n",
+               filename);
+    }
+    if (problem == NULL && verify && !interrupted) {
+        uint64_t checksum = 0;
+        for (uint64_t i = 0; i < header->recordCount; i++) {
+            checksum += snapshotRecordHash(&accounts[i]);
+        }
+        if (checksum != header->checksum) {
+            problem = "is corrupt (checksum mismatch)";
+        }
+    }
+    if (problem != NULL) {
+        printf("Error: %s %s.\n", filename, problem);
+        munmap(data, (size_t)info.st_size);
+        return NULL;
+    }
+    *accountCount = (int)header->recordCount;
+    uint32_t version = header->version;
+    if (!registerAccounts(accounts, *accountCount, 0)) {
+        // Unregistered records are released with free(): move them off the mapping.
+        struct BankAccount *copy = malloc((*accountCount > 0 ? (size_t)*accountCount : 1) * sizeof(struct BankAccount));
+        if (copy != NULL) {
+            memcpy(copy, accounts, (size_t)*accountCount * sizeof(struct BankAccount));
+        }
+        munmap(data, (size_t)info.st_size);
+        if (copy == NULL) {
+            printf("Error: Out of memory loading %s\n", filename);
+            return NULL;
+        }
+        accounts = copy;
+    }
+    if (version == 1) {
+        // Balances in pounds, as a double in the same place: convert them in the private mapping.
+        // The file no longer matches the records, so the next save rewrites it in full.
+        for (int i = 0; i < *accountCount; i++) {
+            double pounds;
+            memcpy(&pounds, &accounts[i].balance, sizeof(pounds));
+            if (!moneyFromDouble(pounds, &accounts[i].balance)) {
+                accounts[i].balance = 0;
+            }
+        }
+    } else if (!interrupted) {
+        // Otherwise the records and the checksum no longer agree, so the next save rewrites it in full.
+        setAccountsSnapshotFile(accounts, filename);
+    }
+    return accounts;
+}
+
+void closeAccountsSnapshot(struct BankAccount *accounts, int accountCount) {
+    if (accounts != NULL) {
+        munmap((char *)accounts - sizeof(struct SnapshotHeader),
+               sizeof(struct SnapshotHeader) + (size_t)accountCount * sizeof(struct BankAccount));
+    }
+}
+
+struct BankAccount* loadAccounts(const char *filename, int *accountCount, int threads) {
+    if (isAccountsSnapshot(filename)) {
+        struct BankAccount *accounts = openAccountsSnapshot(filename, accountCount, false);
+        return accounts ? accounts : malloc(sizeof(struct BankAccount));
+    }
+    return loadAccountsFromCSVParallel(filename, accountCount, threads);
+}
+
+bool saveAccounts(const char *filename, struct BankAccount *accounts, int accountCount) {
+    // A background save that finishes later would replace whatever is written here.
+    pollBackgroundSave(true);
+    // The changed accounts are taken before anything is written: one changed again meanwhile is
+    // listed anew and saved next time, even if this save already has its change.
+    int dirtyCount;
+    int *dirty = takeDirtyAccounts(accounts, &dirtyCount);
+    bool ok;
+    if (isAccountsSnapshot(filename)) {
+        // Two syscalls per changed record: past a point, one sequential rewrite is cheaper.
+        bool inPlace = dirtyCount <= accountCount / DIRTY_SAVE_MAX_FRACTION;
+        ok = inPlace && writeDirtyRecords(filename, accounts, accountCount, dirty, dirtyCount) >= 0;
+        if (!ok && saveAccountsSnapshot(filename, accounts, accountCount)) {
+            setAccountsSnapshotFile(accounts, filename);
+            ok = true;
+        }
+    } else {
+        // accounts.csv has variable-width lines, so it is always rewritten in full.
+        ok = saveAccountsToCSV(filename, accounts, accountCount);
+    }
+    // After a failed save the changed accounts are still the ones the file lacks.
+    if (ok) {
+        free(dirty);
+    } else {
+        restoreDirtyAccounts(accounts, dirty, dirtyCount);
+    }
+    return ok;
+}
+
+static void *backgroundSaveThread(void *arg) {
+    (void)arg;
+    backgroundSaved = backgroundSnapshot ? saveAccountsSnapshot(backgroundFile, backgroundCopy, backgroundCount)
+                                         : saveAccountsToCSV(backgroundFile, backgroundCopy, backgroundCount);
+    __atomic_store_n(&backgroundFinished, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+bool saveAccountsInBackground(const char *filename, struct BankAccount *accounts, int accountCount) {
+    if (backgroundRunning) {
+        return false;
+    }
+    // The thread writes a copy, so the accounts can keep changing while it runs. Every change
+    // listed before the copy is taken is in it; those made later are listed again.
+    int dirtyCount;
+    int *dirty = takeDirtyAccounts(accounts, &dirtyCount);
+    struct BankAccount *copy = malloc((accountCount > 0 ? (size_t)accountCount : 1) * sizeof(struct BankAccount));
+    if (copy == NULL) {
+        printf("Error: Could not start a background save of %s\n", filename);
+        restoreDirtyAccounts(accounts, dirty, dirtyCount);
+        return false;
+    }
+    for (int i = 0; i < accountCount; i++) {
+        copy[i] = accounts[i];
+        copy[i].balance = accountBalance(&accounts[i]);
+    }
+    snprintf(backgroundFile, sizeof(backgroundFile), "%s", filename);
+    backgroundAccounts = accounts;
+    backgroundCopy = copy;
+    backgroundCount = accountCount;
+    backgroundSnapshot = isAccountsSnapshot(filename);
+    backgroundFinished = false;
+    if (pthread_create(&backgroundThread, NULL, backgroundSaveThread, NULL) != 0) {
+        printf("Error: Could not start a background save of %s\n", filename);
+        free(copy);
+        backgroundCopy = NULL;
+        restoreDirtyAccounts(accounts, dirty, dirtyCount);
+        return false;
+    }
+    backgroundRunning = true;
+    free(dirty);
+    // Until the new file is in place the old one must not be updated in place (the rename would
+    // discard the update), so forget it for now.
+    setAccountsSnapshotFile(accounts, NULL);
+    return true;
+}
+
+enum BackgroundSaveState pollBackgroundSave(bool wait) {
+    if (!backgroundRunning) {
+        return BACKGROUND_SAVE_IDLE;
+    }
+    if (!wait && !__atomic_load_n(&backgroundFinished, __ATOMIC_ACQUIRE)) {
+        return BACKGROUND_SAVE_RUNNING;
+    }
+    pthread_join(backgroundThread, NULL);
+    backgroundRunning = false;
+    free(backgroundCopy);
+    backgroundCopy = NULL;
+    if (!backgroundSaved) {
+        // The snapshot file stays forgotten, so the next save rewrites it in full.
+        printf("Error: Background save of %s failed.\n", backgroundFile);
+        return BACKGROUND_SAVE_FAILED;
+    }
+    if (backgroundSnapshot) {
+        setAccountsSnapshotFile(backgroundAccounts, backgroundFile);
+    }
+    return BACKGROUND_SAVE_DONE;
+}
@@ -0,0 +1,90 @@
+#ifndef PROGRAMMING_ASSIGNMENT_SNAPSHOT_H
+#define PROGRAMMING_ASSIGNMENT_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "algorithm.h"
+
+// Binary account snapshot: a header followed by fixed-width records that have exactly the
+// in-memory layout of struct BankAccount, so a snapshot can be mapped and served without parsing.
+#define SNAPSHOT_MAGIC "ATMSNAP"
+// Version 2 stores balances as Money (minor units). Version 1 snapshots, with double balances in
+// pounds, are still opened: their balances are converted in the private mapping.
+#define SNAPSHOT_VERSION 2
+// saveAccounts() rewrites a snapshot in full once more than 1/16 of the accounts changed.
+#define DIRTY_SAVE_MAX_FRACTION 16
+
+struct SnapshotHeader {
+    char magic[8];          // SNAPSHOT_MAGIC, NUL terminated
+    uint32_t version;       // SNAPSHOT_VERSION
+    uint32_t recordSize;    // sizeof(struct BankAccount) of the writer
+    uint64_t recordCount;
+    uint64_t checksum;      // Sum of the per-record hashes, see snapshotRecordHash()
+    uint32_t flags;         // SNAPSHOT_FLAG_*; zero in files written before there were flags
+    uint8_t reserved[28];   // Pads the header to 64 bytes; always zero
+};
+
+// Set in the header while saveDirtyAccountsSnapshot() updates records in place. A file that still
+// has it after a crash holds a mix of old and new records and a stale checksum (see below).
+#define SNAPSHOT_FLAG_UPDATING 1u
+
+// Finish writing a file that was written as tempName: flush and fsync it, close it, rename it
+// over filename and fsync the directory. A crash at any point leaves either the old or the new
+// file in place, never a partial one. Removes tempName and returns false on any error.
+bool replaceFileDurably(FILE *file, const char *tempName, const char *filename);
+// fsync the directory that holds filename, so that a rename or unlink in it is durable.
+bool syncDirectoryOf(const char *filename);
+
+// Write accounts to filename as a snapshot (via a temporary file renamed into place).
+bool saveAccountsSnapshot(const char *filename, const struct BankAccount *accounts, int accountCount);
+// Write only the accounts changed since the last save (see markAccountDirty) into the snapshot
+// accounts was loaded from or last saved to, updating records in place with pwrite.
+// Returns the number of records written, or -1 if the file can not be updated in place.
+// Trade-off: this skips the temporary file and rename of a full save, so it is not atomic. The
+// header is marked SNAPSHOT_FLAG_UPDATING and synced, then the records are written and synced,
+// then the header gets the new checksum and loses the flag. A crash in between leaves every
+// changed record old, new or torn, but the records are only those of accounts changed since the
+// last save, which the journal still holds (it is only emptied after a successful save) and
+// replays in full over them. openAccountsSnapshot() therefore accepts such a file without checking
+// its checksum, and the next save rewrites it in full.
+int saveDirtyAccountsSnapshot(const char *filename, struct BankAccount *accounts, int accountCount);
+// Map a snapshot copy-on-write and return its records directly; O(1) unless verify is set,
+// in which case the checksum of every record is checked too. Returns NULL on any error. A file
+// whose in-place update was interrupted (SNAPSHOT_FLAG_UPDATING) is opened with a warning and
+// without the checksum check; replay its journal over it.
+// The records live in the mapping: release them with releaseAccounts(), not free().
+struct BankAccount* openAccountsSnapshot(const char *filename, int *accountCount, bool verify);
+void closeAccountsSnapshot(struct BankAccount *accounts, int accountCount);
+// True if filename starts with the snapshot magic.
+bool isAccountsSnapshot(const char *filename);
+// Hash of one record as it is stored in a snapshot.
+uint64_t snapshotRecordHash(const struct BankAccount *record);
+
+// Load accounts from either accounts.csv format or a snapshot, whichever filename holds.
+// A snapshot is opened in place (see openAccountsSnapshot); a CSV file is parsed on `threads` threads.
+struct BankAccount* loadAccounts(const char *filename, int *accountCount, int threads);
+// Save accounts in the format filename already has (CSV if it does not exist yet).
+// A snapshot that still matches the accounts only gets the changed records rewritten.
+// Waits for a background save of the same accounts to finish first. Returns false if the file
+// could not be written; the changed accounts then stay marked for the next save.
+bool saveAccounts(const char *filename, struct BankAccount *accounts, int accountCount);
+
+// Background saves: a thread writes a copy of the accounts taken at the time of the call in full,
+// through a temporary file, while the caller keeps serving sessions. The copy is as consistent as
+// the accounts were while it was taken: journalCheckpointInBackground() takes it with no change
+// half done. It costs one more table in memory until the save is collected. Only one runs at a time.
+enum BackgroundSaveState {
+    BACKGROUND_SAVE_IDLE,
+    BACKGROUND_SAVE_RUNNING,
+    BACKGROUND_SAVE_DONE,      // Reported once, by the first poll after the thread succeeded
+    BACKGROUND_SAVE_FAILED     // Reported once; the file still holds the previous save
+};
+
+// Start saving accounts to filename in the format it already has. Returns false if a save is
+// already running or the thread (or the copy) can not be started.
+bool saveAccountsInBackground(const char *filename, struct BankAccount *accounts, int accountCount);
+// Check on the background save, or wait for it to finish when wait is set.
+enum BackgroundSaveState pollBackgroundSave(bool wait);
+
+#endif // PROGRAMMING_ASSIGNMENT_SNAPSHOT_H
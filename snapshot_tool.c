@@ -0,0 +1,42 @@
+//
+// Converts between accounts.csv and the binary snapshot format.
+// Usage: Programming_Assignment_Convert csv2snap <in.csv> <out.snap>
+//        Programming_Assignment_Convert snap2csv <in.snap> <out.csv>
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "algorithm.h"
+#include "parallel_loader.h"
+#include "snapshot.h"
+#include "account_index.h"
+
+int main(int argc, char *argv[]) {
+    if (argc != 4 || (strcmp(argv[1], "csv2snap") != 0 && strcmp(argv[1], "snap2csv") != 0)) {
+        printf("Usage: %s csv2snap <in.csv> <out.snap>\n", argv[0]);
+        printf("       %s snap2csv <in.snap> <out.csv>\n", argv[0]);
+        return 1;
+    }
+    int accountCount;
+    if (strcmp(argv[1], "csv2snap") == 0) {
+        struct BankAccount *accounts = loadAccountsFromCSVParallel(argv[2], &accountCount, defaultLoadThreads());
+        if (!saveAccountsSnapshot(argv[3], accounts, accountCount)) {
+            return 1;
+        }
+        releaseAccounts(accounts);
+    } else {
+        // Always verify the checksum when converting.
+        struct BankAccount *accounts = openAccountsSnapshot(argv[2], &accountCount, true);
+        if (accounts == NULL) {
+            return 1;
+        }
+        bool saved = saveAccountsToCSV(argv[3], accounts, accountCount);
+        releaseAccounts(accounts);
+        if (!saved) {
+            printf("Error: Could not write %s\n", argv[3]);
+            return 1;
+        }
+    }
+    printf("Converted %d accounts from %s to %s\n", accountCount, argv[2], argv[3]);
+    return 0;
+}
@@ -0,0 +1,840 @@
+//
+// Binary transaction log, written asynchronously in batches.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "transaction_log.h"
+#include "log_index.h"
+
+_Static_assert(sizeof(struct TransactionLogHeader) == 16, "log header must be 16 bytes");
+_Static_assert(sizeof(struct TransactionRecord) == 40, "log records must be 40 bytes");
+
+// Lock-free multi-producer, single-consumer ring. A producer takes a ticket with one atomic
+// add; ticket t owns slot t % LOG_RING_CAPACITY for one lap. The slot's turn says whose it is:
+// t means free for the producer holding ticket t, t + 1 means that producer's record is in it
+// (the writer then hands it to ticket t + LOG_RING_CAPACITY). The writer takes records in
+// ticket order, so the log is in sequence order whatever order producers finish in.
+struct RingSlot {
+    _Atomic uint64_t turn;
+    struct TransactionRecord record;
+};
+static struct RingSlot ring[LOG_RING_CAPACITY];
+static _Atomic uint64_t queued;          // Tickets handed out
+static _Atomic uint64_t consumed;        // Records the writer has taken out of the ring
+static _Atomic int activeProducers;      // Producers between their running check and publishing
+static _Atomic bool running;
+static _Atomic bool stopping;            // Producers stay off the ring while the logger stops
+static _Atomic bool writerSleeping;
+static uint64_t sequenceBase;            // Ticket t gets sequence number sequenceBase + t + 1
+static uint64_t lastSequence;            // Sequence of the last record found in the file
+// Wake-ups, flushes and statistics; producers only take the lock to wake a sleeping writer.
+static uint64_t written;                 // Records written to the file
+static uint64_t flushTarget;             // Write at least up to here without waiting for flushRecords
+static uint64_t batchCount;
+static bool finishing;                   // Write what is left and exit
+static pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logPending = PTHREAD_COND_INITIALIZER;   // Wakes the writer
+static pthread_cond_t logWritten = PTHREAD_COND_INITIALIZER;   // Wakes flushers
+static pthread_t writerThread;
+// The writer's copy of the records it took out of the ring.
+static struct TransactionRecord batch[LOG_RING_CAPACITY];
+static int logFd = -1;
+static struct TransactionLogConfig config;
+// The last log started (a copy: config.filename belongs to the caller); direct appends go here.
+static char logFileName[4096] = TRANSACTION_LOG_FILE;
+static struct LogIndex *logIndex;
+// Size and start time of the segment being written; only the writer thread uses them.
+static off_t segmentBytes;
+static time_t segmentOpened;
+
+// Closed segments waiting for the compressor thread.
+static pthread_mutex_t compressLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compressPending = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t compressIdle = PTHREAD_COND_INITIALIZER;
+static char **compressQueue;
+static int compressCount;
+static int compressCapacity;
+static bool compressBusy;
+static bool compressStopping;
+static pthread_t compressorThread;
+
+static const char *operationNames[] = {
+        "Unknown", "Withdrawal", "Deposit", "Check Balance", "Change PIN", "Card Retained"
+};
+
+const char* transactionOpName(enum TransactionOp operation) {
+    if (operation < TRANSACTION_WITHDRAWAL || operation > TRANSACTION_CARD_RETAINED) {
+        return operationNames[0];
+    }
+    return operationNames[operation];
+}
+
+void formatTransactionRecord(const struct TransactionRecord *record, char *line, size_t size) {
+    char before[MONEY_TEXT_SIZE], after[MONEY_TEXT_SIZE];
+    formatMoney(record->balanceBefore, before, sizeof(before));
+    formatMoney(record->balanceAfter, after, sizeof(after));
+    snprintf(line, size, TRANSACTION_LOG_LINE, record->accountNumber,
+             transactionOpName((enum TransactionOp)record->operation), before, after);
+}
+
+static bool writeAll(int fd, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length > 0) {
+        ssize_t done = write(fd, bytes, length);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        bytes += done;
+        length -= (size_t)done;
+    }
+    return true;
+}
+
+// Open filename for appending, writing the header if it is new. Sets *last to the sequence of
+// its last record and cuts off a partly written record left by a crash. Returns -1 on error.
+static int openLogFile(const char *filename, uint64_t *last) {
+    *last = 0;
+    int fd = open(filename, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        printf("Error: Could not open log file %s\n", filename);
+        return -1;
+    }
+    struct stat info;
+    struct TransactionLogHeader header;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (info.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        strcpy(header.magic, TRANSACTION_LOG_MAGIC);
+        header.version = TRANSACTION_LOG_VERSION;
+        header.recordSize = sizeof(struct TransactionRecord);
+        if (!writeAll(fd, &header, sizeof(header))) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, TRANSACTION_LOG_MAGIC, sizeof(TRANSACTION_LOG_MAGIC)) != 0 ||
+        header.version != TRANSACTION_LOG_VERSION || header.recordSize != sizeof(struct TransactionRecord)) {
+        printf("Error: %s is not a transaction log of this version.\n", filename);
+        close(fd);
+        return -1;
+    }
+    off_t records = (info.st_size - (off_t)sizeof(header)) / (off_t)sizeof(struct TransactionRecord);
+    off_t end = (off_t)sizeof(header) + records * (off_t)sizeof(struct TransactionRecord);
+    if (end != info.st_size && ftruncate(fd, end) != 0) {
+        close(fd);
+        return -1;
+    }
+    struct TransactionRecord record;
+    if (records > 0 && pread(fd, &record, sizeof(record), end - (off_t)sizeof(record)) == (ssize_t)sizeof(record)) {
+        *last = record.sequence;
+    }
+    return fd;
+}
+
+static void fillRecord(struct TransactionRecord *record, uint64_t sequence, int accountNumber,
+                       enum TransactionOp operation, Money balanceBefore, Money balanceAfter) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    memset(record, 0, sizeof(*record));
+    record->sequence = sequence;
+    record->timestampNs = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+    record->accountNumber = accountNumber;
+    record->operation = (uint16_t)operation;
+    record->balanceBefore = balanceBefore;
+    record->balanceAfter = balanceAfter;
+}
+
+void transactionLogDefaults(struct TransactionLogConfig *defaults) {
+    defaults->filename = TRANSACTION_LOG_FILE;
+    defaults->flushRecords = LOG_DEFAULT_FLUSH_RECORDS;
+    defaults->flushIntervalMs = LOG_DEFAULT_FLUSH_INTERVAL_MS;
+    defaults->rotateBytes = LOG_DEFAULT_ROTATE_BYTES;
+    defaults->rotateSeconds = LOG_DEFAULT_ROTATE_SECONDS;
+    defaults->retainSegments = LOG_DEFAULT_RETAIN_SEGMENTS;
+    defaults->compress = true;
+    defaults->index = true;
+}
+
+// Queue a closed segment for compression and retention.
+static void queueSegment(const char *segment) {
+    pthread_mutex_lock(&compressLock);
+    if (compressCount == compressCapacity) {
+        int capacity = compressCapacity ? compressCapacity * 2 : 16;
+        char **grown = realloc(compressQueue, capacity * sizeof(char *));
+        if (grown != NULL) {
+            compressQueue = grown;
+            compressCapacity = capacity;
+        }
+    }
+    char *name = compressCount < compressCapacity ? strdup(segment) : NULL;
+    if (name == NULL) {
+        // The segment stays as it is, uncompressed; it is complete and readable as such.
+        printf("Error: Out of memory queueing %s for compression.\n", segment);
+    } else {
+        compressQueue[compressCount++] = name;
+        pthread_cond_signal(&compressPending);
+    }
+    pthread_mutex_unlock(&compressLock);
+}
+
+// Close the current segment: rename it after its first record and start a new log file.
+static void rotateLog() {
+    struct TransactionRecord first;
+    if (pread(logFd, &first, sizeof(first), sizeof(struct TransactionLogHeader)) != (ssize_t)sizeof(first)) {
+        segmentOpened = time(NULL);  // Nothing written yet: keep the segment
+        return;
+    }
+    char closed[4200];
+    snprintf(closed, sizeof(closed), "%s.%012llu", config.filename, (unsigned long long)first.sequence);
+    uint64_t last;
+    int fd = -1;
+    if (rename(config.filename, closed) == 0) {
+        fd = openLogFile(config.filename, &last);
+        if (fd < 0) {
+            rename(closed, config.filename);
+        }
+    }
+    if (fd < 0) {
+        printf("Error: Could not rotate the log file %s\n", config.filename);
+        segmentOpened = time(NULL);  // Try again later rather than after every batch
+        return;
+    }
+    close(logFd);
+    logFd = fd;
+    segmentBytes = sizeof(struct TransactionLogHeader);
+    segmentOpened = time(NULL);
+    if (logIndex != NULL) {
+        logIndexSegmentClosed(logIndex, closed, first.sequence);
+    }
+    queueSegment(closed);
+}
+
+// gzip segment into segment.gz and remove it.
+static void compressSegment(const char *segment) {
+    char compressed[4300], temp[4310];
+    snprintf(compressed, sizeof(compressed), "%s.gz", segment);
+    snprintf(temp, sizeof(temp), "%s.tmp", compressed);
+    FILE *in = fopen(segment, "rb");
+    if (in == NULL && errno == ENOENT) {
+        return;  // Already deleted by the retention limit while it waited in the queue
+    }
+    gzFile out = gzopen(temp, "wb6");
+    bool ok = in != NULL && out != NULL;
+    char buffer[1 << 16];
+    size_t length;
+    while (ok && (length = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        ok = gzwrite(out, buffer, (unsigned)length) == (int)length;
+    }
+    ok = ok && !ferror(in);
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (out != NULL) {
+        ok = gzclose(out) == Z_OK && ok;
+    }
+    if (!ok || rename(temp, compressed) != 0) {
+        printf("Error: Could not compress %s\n", segment);
+        remove(temp);
+        return;
+    }
+    if (logIndex != NULL) {
+        logIndexSegmentCompressed(logIndex, segment, compressed);
+    }
+    remove(segment);
+}
+
+static char** listSegments(const char *filename, int *segmentCount, bool *complete);
+
+// Delete the oldest closed segments beyond config.retainSegments.
+static void applyRetention() {
+    if (config.retainSegments <= 0) {
+        return;
+    }
+    int count;
+    bool complete;
+    char **segments = listSegments(config.filename, &count, &complete);
+    if (!complete) {
+        // Which segments are the oldest is not known: delete none this time.
+        freeLogSegments(segments, count);
+        return;
+    }
+    struct stat info;
+    int closed = count > 0 && strcmp(segments[count - 1], config.filename) == 0 ? count - 1 : count;
+    for (int i = 0; i < closed - config.retainSegments; i++) {
+        remove(segments[i]);
+        if (logIndex != NULL) {
+            logIndexSegmentDeleted(logIndex, segments[i]);
+        }
+        // A segment that was being compressed when the program stopped may exist in both forms.
+        char compressed[4300];
+        snprintf(compressed, sizeof(compressed), "%s.gz", segments[i]);
+        if (stat(compressed, &info) == 0) {
+            remove(compressed);
+        }
+    }
+    freeLogSegments(segments, count);
+}
+
+static void* compressorMain(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&compressLock);
+    while (true) {
+        while (compressCount == 0 && !compressStopping) {
+            pthread_cond_wait(&compressPending, &compressLock);
+        }
+        if (compressCount == 0) {
+            break;
+        }
+        char *segment = compressQueue[0];
+        memmove(compressQueue, compressQueue + 1, (size_t)(--compressCount) * sizeof(char *));
+        compressBusy = true;
+        pthread_mutex_unlock(&compressLock);
+        if (config.compress) {
+            compressSegment(segment);
+        }
+        applyRetention();
+        free(segment);
+        pthread_mutex_lock(&compressLock);
+        compressBusy = false;
+        pthread_cond_broadcast(&compressIdle);
+    }
+    pthread_mutex_unlock(&compressLock);
+    return NULL;
+}
+
+void waitForLogCompression() {
+    pthread_mutex_lock(&compressLock);
+    while (compressCount > 0 || compressBusy) {
+        pthread_cond_wait(&compressIdle, &compressLock);
+    }
+    pthread_mutex_unlock(&compressLock);
+}
+
+static void wakeWriter() {
+    if (atomic_load(&writerSleeping)) {
+        pthread_mutex_lock(&logLock);
+        pthread_cond_signal(&logPending);
+        pthread_mutex_unlock(&logLock);
+    }
+}
+
+// Write batch[0..count) to the log, rolling over to a new segment where one fills up.
+// Rotation happens only right before a write, so a new segment never stays empty.
+static void writeBatch(size_t count) {
+    if (count > 0 && config.rotateSeconds > 0 && time(NULL) - segmentOpened >= config.rotateSeconds) {
+        rotateLog();
+    }
+    size_t start = 0;
+    while (start < count) {
+        size_t run = count - start;
+        if (config.rotateBytes > 0) {
+            off_t room = (config.rotateBytes - segmentBytes) / (off_t)sizeof(struct TransactionRecord);
+            if (room < 1) {
+                rotateLog();
+                room = (config.rotateBytes - segmentBytes) / (off_t)sizeof(struct TransactionRecord);
+                room = room < 1 ? 1 : room;
+            }
+            if ((off_t)run > room) {
+                run = (size_t)room;
+            }
+        }
+        if (!writeAll(logFd, &batch[start], run * sizeof(struct TransactionRecord))) {
+            printf("Error: Could not write to the log file.\n");
+        }
+        if (logIndex != NULL) {
+            logIndexAppend(logIndex, &batch[start], run);
+        }
+        segmentBytes += (off_t)(run * sizeof(struct TransactionRecord));
+        start += run;
+    }
+}
+
+static void* writerMain(void *arg) {
+    (void)arg;
+    while (true) {
+        // Sleep until enough records are waiting, a flush is requested, or the interval is up.
+        // writerSleeping is set before the records are counted, so a producer that publishes
+        // after the count sees it and wakes us.
+        pthread_mutex_lock(&logLock);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += config.flushIntervalMs / 1000;
+        deadline.tv_nsec += (long)(config.flushIntervalMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        atomic_store(&writerSleeping, true);
+        while (!finishing && atomic_load(&queued) - atomic_load(&consumed) < (uint64_t)config.flushRecords &&
+               flushTarget <= atomic_load(&consumed)) {
+            if (config.flushIntervalMs <= 0) {
+                pthread_cond_wait(&logPending, &logLock);
+            } else if (pthread_cond_timedwait(&logPending, &logLock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        atomic_store(&writerSleeping, false);
+        bool finish = finishing;
+        pthread_mutex_unlock(&logLock);
+
+        // Take the published records out of the ring in ticket order, freeing their slots at once.
+        uint64_t start = atomic_load(&consumed);
+        uint64_t end = start;
+        while (end - start < LOG_RING_CAPACITY) {
+            struct RingSlot *slot = &ring[end % LOG_RING_CAPACITY];
+            if (atomic_load_explicit(&slot->turn, memory_order_acquire) != end + 1) {
+                break;  // Not published yet
+            }
+            batch[end - start] = slot->record;
+            atomic_store_explicit(&slot->turn, end + LOG_RING_CAPACITY, memory_order_release);
+            end++;
+        }
+        atomic_store(&consumed, end);
+        if (end == start) {
+            if (finish && atomic_load(&queued) == end) {
+                break;
+            }
+            // A producer took a ticket but has not published yet.
+            sched_yield();
+            continue;
+        }
+        writeBatch((size_t)(end - start));
+        pthread_mutex_lock(&logLock);
+        written = end;
+        batchCount++;
+        pthread_cond_broadcast(&logWritten);
+        pthread_mutex_unlock(&logLock);
+    }
+    return NULL;
+}
+
+static void stopCompressor() {
+    pthread_mutex_lock(&compressLock);
+    compressStopping = true;
+    pthread_cond_signal(&compressPending);
+    pthread_mutex_unlock(&compressLock);
+    pthread_join(compressorThread, NULL);
+}
+
+// Sequence of the last record in the newest closed segment of filename, for a log file that is
+// empty because it was just rotated (or a crash followed the rotation); 0 if there is none.
+static uint64_t lastSegmentSequence(const char *filename, char **segments, int count) {
+    uint64_t last = 0;
+    if (count > 1 && strcmp(segments[count - 1], filename) == 0) {
+        long recordCount = 0;
+        struct TransactionRecord *records = readTransactionLog(segments[count - 2], &recordCount);
+        if (recordCount > 0) {
+            last = records[recordCount - 1].sequence;
+        }
+        free(records);
+    }
+    return last;
+}
+
+bool startTransactionLog(const struct TransactionLogConfig *settings) {
+    if (running) {
+        stopTransactionLog();
+    }
+    config = *settings;
+    if (config.flushRecords < 1) {
+        config.flushRecords = 1;
+    }
+    if (config.flushRecords > LOG_RING_CAPACITY) {
+        config.flushRecords = LOG_RING_CAPACITY;
+    }
+    snprintf(logFileName, sizeof(logFileName), "%s", config.filename);
+    config.filename = logFileName;
+    logFd = openLogFile(config.filename, &lastSequence);
+    if (logFd < 0) {
+        return false;
+    }
+    // Without its index the log still works; history lookups just are not available.
+    logIndex = config.index ? openLogIndex(config.filename) : NULL;
+    segmentBytes = lseek(logFd, 0, SEEK_END);
+    int count;
+    char **segments = listLogSegments(config.filename, &count);
+    if (lastSequence == 0) {
+        lastSequence = lastSegmentSequence(config.filename, segments, count);
+    }
+    segmentOpened = time(NULL);
+    sequenceBase = lastSequence;
+    for (uint64_t i = 0; i < LOG_RING_CAPACITY; i++) {
+        atomic_store(&ring[i].turn, i);
+    }
+    atomic_store(&queued, 0);
+    atomic_store(&consumed, 0);
+    written = flushTarget = batchCount = 0;
+    finishing = compressStopping = false;
+    atomic_store(&stopping, false);
+    if (pthread_create(&compressorThread, NULL, compressorMain, NULL) != 0) {
+        printf("Error: Could not start the log compressor.\n");
+        freeLogSegments(segments, count);
+        closeLogIndex(logIndex);
+        logIndex = NULL;
+        close(logFd);
+        logFd = -1;
+        return false;
+    }
+    if (pthread_create(&writerThread, NULL, writerMain, NULL) != 0) {
+        printf("Error: Could not start the log writer.\n");
+        freeLogSegments(segments, count);
+        stopCompressor();
+        closeLogIndex(logIndex);
+        logIndex = NULL;
+        close(logFd);
+        logFd = -1;
+        return false;
+    }
+    running = true;
+    // Segments closed but not yet compressed when the program last stopped.
+    for (int i = 0; i < count; i++) {
+        size_t length = strlen(segments[i]);
+        if (strcmp(segments[i], config.filename) != 0 && (length < 3 || strcmp(segments[i] + length - 3, ".gz") != 0)) {
+            queueSegment(segments[i]);
+        }
+    }
+    freeLogSegments(segments, count);
+    return true;
+}
+
+void stopTransactionLog() {
+    if (!atomic_load(&running) || atomic_exchange(&stopping, true)) {
+        return;
+    }
+    // From here on producers stay off the ring; let those already past the check publish.
+    while (atomic_load(&activeProducers) > 0) {
+        sched_yield();
+    }
+    pthread_mutex_lock(&logLock);
+    finishing = true;
+    pthread_cond_signal(&logPending);
+    pthread_mutex_unlock(&logLock);
+    pthread_join(writerThread, NULL);
+    close(logFd);
+    logFd = -1;
+    // Closed segments still queued are compressed before returning. The compressor reports to
+    // the index, so it is closed after that.
+    stopCompressor();
+    closeLogIndex(logIndex);
+    logIndex = NULL;
+    atomic_store(&running, false);
+    atomic_store(&stopping, false);
+}
+
+struct LogIndex* transactionLogIndex() {
+    return logIndex;
+}
+
+bool transactionLogRunning() {
+    return running;
+}
+
+void flushTransactionLog() {
+    pthread_mutex_lock(&logLock);
+    uint64_t target = atomic_load(&queued);
+    if (target > flushTarget) {
+        flushTarget = target;
+    }
+    pthread_cond_signal(&logPending);
+    while (atomic_load(&running) && written < target) {
+        pthread_cond_wait(&logWritten, &logLock);
+    }
+    pthread_mutex_unlock(&logLock);
+}
+
+// Open the log file for a direct append (logger not running): the file of the last log started,
+// so records follow the rest of that log. Sets *last like openLogFile(), also after a rotation.
+static int openDirectLogFile(uint64_t *last) {
+    int fd = openLogFile(logFileName, last);
+    if (fd >= 0 && *last == 0) {
+        int count;
+        char **segments = listLogSegments(logFileName, &count);
+        *last = lastSegmentSequence(logFileName, segments, count);
+        freeLogSegments(segments, count);
+    }
+    return fd;
+}
+
+// Append one record straight to the log file, as the log did before the writer thread.
+static bool appendDirectly(int accountNumber, enum TransactionOp operation, Money balanceBefore, Money balanceAfter) {
+    pthread_mutex_lock(&logLock);
+    uint64_t last;
+    int fd = openDirectLogFile(&last);
+    bool ok = fd >= 0;
+    if (ok) {
+        struct TransactionRecord record;
+        fillRecord(&record, last + 1, accountNumber, operation, balanceBefore, balanceAfter);
+        ok = writeAll(fd, &record, sizeof(record));
+        close(fd);
+    }
+    pthread_mutex_unlock(&logLock);
+    return ok;
+}
+
+bool appendTransactionLog(int accountNumber, enum TransactionOp operation, Money balanceBefore, Money balanceAfter) {
+    atomic_fetch_add(&activeProducers, 1);
+    if (!atomic_load(&running) || atomic_load(&stopping)) {
+        atomic_fetch_sub(&activeProducers, 1);
+        // While the logger stops, wait for it so that records stay in sequence order.
+        while (atomic_load(&stopping)) {
+            sched_yield();
+        }
+        return appendDirectly(accountNumber, operation, balanceBefore, balanceAfter);
+    }
+    uint64_t ticket = atomic_fetch_add(&queued, 1);
+    struct RingSlot *slot = &ring[ticket % LOG_RING_CAPACITY];
+    // Only when the writer is a full ring behind: wait for it rather than lose the record.
+    while (atomic_load_explicit(&slot->turn, memory_order_acquire) != ticket) {
+        wakeWriter();
+        sched_yield();
+    }
+    fillRecord(&slot->record, sequenceBase + ticket + 1, accountNumber, operation, balanceBefore, balanceAfter);
+    atomic_store_explicit(&slot->turn, ticket + 1, memory_order_release);
+    if (ticket + 1 - atomic_load(&consumed) >= (uint64_t)config.flushRecords) {
+        wakeWriter();
+    }
+    atomic_fetch_sub(&activeProducers, 1);
+    return true;
+}
+
+// Write count records (numbered from the end of the log) to the log file in one write.
+static bool appendRecordsDirectly(struct TransactionRecord *records, int count) {
+    pthread_mutex_lock(&logLock);
+    uint64_t last;
+    int fd = openDirectLogFile(&last);
+    bool ok = fd >= 0;
+    if (ok) {
+        for (int i = 0; i < count; i++) {
+            records[i].sequence = last + 1 + (uint64_t)i;
+        }
+        ok = writeAll(fd, records, (size_t)count * sizeof(struct TransactionRecord));
+        close(fd);
+    }
+    pthread_mutex_unlock(&logLock);
+    return ok;
+}
+
+bool appendTransactionLogRecords(struct TransactionRecord *records, int count) {
+    if (count <= 0) {
+        return true;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < count; i++) {
+        records[i].timestampNs = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+        records[i].reserved = 0;
+    }
+    atomic_fetch_add(&activeProducers, 1);
+    if (!atomic_load(&running) || atomic_load(&stopping)) {
+        atomic_fetch_sub(&activeProducers, 1);
+        while (atomic_load(&stopping)) {
+            sched_yield();
+        }
+        return appendRecordsDirectly(records, count);
+    }
+    // One fetch_add reserves consecutive tickets, so the records keep consecutive sequence numbers.
+    uint64_t first = atomic_fetch_add(&queued, (uint64_t)count);
+    for (int i = 0; i < count; i++) {
+        uint64_t ticket = first + (uint64_t)i;
+        struct RingSlot *slot = &ring[ticket % LOG_RING_CAPACITY];
+        while (atomic_load_explicit(&slot->turn, memory_order_acquire) != ticket) {
+            wakeWriter();
+            sched_yield();
+        }
+        records[i].sequence = sequenceBase + ticket + 1;
+        slot->record = records[i];
+        atomic_store_explicit(&slot->turn, ticket + 1, memory_order_release);
+    }
+    if (first + (uint64_t)count - atomic_load(&consumed) >= (uint64_t)config.flushRecords) {
+        wakeWriter();
+    }
+    atomic_fetch_sub(&activeProducers, 1);
+    return true;
+}
+
+void transactionLogStats(uint64_t *records, uint64_t *batches) {
+    pthread_mutex_lock(&logLock);
+    *records = atomic_load(&queued);
+    *batches = batchCount;
+    pthread_mutex_unlock(&logLock);
+}
+
+// Compare segment names by pointer, for qsort.
+static int compareNames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// listLogSegments(); *complete is false if memory ran out part way. The list then holds only the
+// segments read from the directory up to there, which need not be the oldest ones.
+static char** listSegments(const char *filename, int *segmentCount, bool *complete) {
+    *complete = false;
+    char directory[4096];
+    snprintf(directory, sizeof(directory), "%s", filename);
+    char *slash = strrchr(directory, '/');
+    const char *base = filename;
+    if (slash != NULL) {
+        *slash = '\0';
+        base = filename + (slash - directory) + 1;
+    } else {
+        strcpy(directory, ".");
+    }
+    size_t baseLength = strlen(base);
+    int count = 0, capacity = 16;
+    char **segments = malloc(capacity * sizeof(char *));
+    if (segments == NULL) {
+        *segmentCount = 0;
+        return NULL;
+    }
+    // Out of memory part way, the segments found so far are returned.
+    bool full = false;
+    DIR *dir = opendir(directory);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        // "<base>.<12 digits>" or "<base>.<12 digits>.gz"
+        const char *name = entry->d_name;
+        size_t length = strlen(name);
+        if (strncmp(name, base, baseLength) != 0 || name[baseLength] != '.' ||
+            (length != baseLength + 13 && (length != baseLength + 16 || strcmp(name + length - 3, ".gz") != 0))) {
+            continue;
+        }
+        bool digits = true;
+        for (size_t i = baseLength + 1; i < baseLength + 13; i++) {
+            digits = digits && name[i] >= '0' && name[i] <= '9';
+        }
+        if (!digits) {
+            continue;
+        }
+        // One slot is always left for the current file.
+        if (count + 1 >= capacity) {
+            char **grown = realloc(segments, 2 * capacity * sizeof(char *));
+            if (grown == NULL) {
+                full = true;
+                break;
+            }
+            segments = grown;
+            capacity *= 2;
+        }
+        char path[4400];
+        snprintf(path, sizeof(path), "%s%s%s", slash != NULL ? directory : "", slash != NULL ? "/" : "", name);
+        segments[count] = strdup(path);
+        if (segments[count] == NULL) {
+            full = true;
+            break;
+        }
+        count++;
+    }
+    if (full) {
+        printf("Error: Out of memory listing the segments of %s\n", filename);
+    }
+    *complete = !full;
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    qsort(segments, count, sizeof(char *), compareNames);
+    // A segment whose compression was interrupted may exist in both forms; keep the plain one,
+    // which sorts first and is known to be complete.
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        size_t length = strlen(segments[i]);
+        if (i + 1 < count && strncmp(segments[i], segments[i + 1], length) == 0) {
+            free(segments[i + 1]);
+            segments[i + 1] = segments[i];
+            continue;
+        }
+        segments[unique++] = segments[i];
+    }
+    count = unique;
+    struct stat info;
+    if (stat(filename, &info) == 0) {
+        segments[count] = strdup(filename);
+        if (segments[count] != NULL) {
+            count++;
+        } else {
+            *complete = false;
+        }
+    }
+    *segmentCount = count;
+    return segments;
+}
+
+char** listLogSegments(const char *filename, int *segmentCount) {
+    bool complete;
+    return listSegments(filename, segmentCount, &complete);
+}
+
+void freeLogSegments(char **segments, int segmentCount) {
+    for (int i = 0; i < segmentCount; i++) {
+        free(segments[i]);
+    }
+    free(segments);
+}
+
+// Records readTransactionLog() asks gzread for at a time (well below its INT_MAX byte limit).
+#define LOG_READ_CHUNK_RECORDS ((size_t)1 << 16)
+
+struct TransactionRecord* readTransactionLog(const char *filename, long *recordCount) {
+    *recordCount = 0;
+    // gzread reads uncompressed files as they are, so this handles every kind of segment.
+    gzFile file = gzopen(filename, "rb");
+    if (!file) {
+        printf("Error: Could not open %s\n", filename);
+        return NULL;
+    }
+    struct TransactionLogHeader header;
+    if (gzread(file, &header, sizeof(header)) != (int)sizeof(header) ||
+        memcmp(header.magic, TRANSACTION_LOG_MAGIC, sizeof(TRANSACTION_LOG_MAGIC)) != 0 ||
+        header.version != TRANSACTION_LOG_VERSION || header.recordSize != sizeof(struct TransactionRecord)) {
+        printf("Error: %s is not a transaction log of this version.\n", filename);
+        gzclose(file);
+        return NULL;
+    }
+    // gzread takes and returns int sizes, so a segment past 2 GiB is read a bounded chunk at a time.
+    size_t count = 0, capacity = 1024;
+    struct TransactionRecord *records = malloc(capacity * sizeof(struct TransactionRecord));
+    while (records != NULL) {
+        if (count == capacity) {
+            capacity *= 2;
+            struct TransactionRecord *grown = realloc(records, capacity * sizeof(struct TransactionRecord));
+            if (grown == NULL) {
+                printf("Error: Out of memory reading %s\n", filename);
+                free(records);
+                records = NULL;
+                count = 0;
+                break;
+            }
+            records = grown;
+        }
+        size_t wanted = capacity - count < LOG_READ_CHUNK_RECORDS ? capacity - count : LOG_READ_CHUNK_RECORDS;
+        int bytes = gzread(file, records + count, (unsigned)(wanted * sizeof(struct TransactionRecord)));
+        if (bytes <= 0) {
+            break;
+        }
+        // A record cut short by a crash at the end is left out.
+        count += (size_t)bytes / sizeof(struct TransactionRecord);
+        if ((size_t)bytes != wanted * sizeof(struct TransactionRecord)) {
+            break;
+        }
+    }
+    gzclose(file);
+    *recordCount = (long)count;
+    return records;
+}
@@ -0,0 +1,102 @@
+#ifndef PROGRAMMING_ASSIGNMENT_TRANSACTION_LOG_H
+#define PROGRAMMING_ASSIGNMENT_TRANSACTION_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "algorithm.h"
+
+// Binary transaction log: a header followed by fixed-size records. logTransaction() queues
+// records in a lock-free ring buffer in memory and a writer thread appends them to the log file in
+// batches, so a transaction never waits for the disk or for other threads that are logging. Until startTransactionLog() is called (and after
+// stopTransactionLog()), every record is written synchronously, to the file of the last log
+// started (TRANSACTION_LOG_FILE before any) and numbered after its last record. Those appends
+// never rotate the file; the index picks them up when the log is next started. The log tool turns
+// the records back into the old text lines (TRANSACTION_LOG_LINE).
+//
+// The writer rolls the log over to a new segment once it reaches a size or age limit: the file
+// is renamed to "<log>.<first sequence, 12 digits>" and a new one is started. A compressor thread
+// gzips closed segments ("<log>.<sequence>.gz") and deletes the oldest beyond the retention limit.
+
+#define TRANSACTION_LOG_FILE "log.bin"
+#define TRANSACTION_LOG_MAGIC "ATMLOG"
+#define TRANSACTION_LOG_VERSION 1
+// One line of the text log; the arguments are accountNumber, operation name and the balances
+// before and after as strings.
+#define TRANSACTION_LOG_LINE "Account %d - %s: Original Balance = £%s, New Balance = £%s\n"
+// Records the ring buffer holds; a producer only waits when the writer is this far behind.
+// A power of two, so that ticket % capacity stays consistent when the ticket counter wraps.
+#define LOG_RING_CAPACITY 4096
+#define LOG_DEFAULT_FLUSH_RECORDS 256
+#define LOG_DEFAULT_FLUSH_INTERVAL_MS 1000
+#define LOG_DEFAULT_ROTATE_BYTES (64L << 20)
+#define LOG_DEFAULT_ROTATE_SECONDS (24 * 60 * 60)
+#define LOG_DEFAULT_RETAIN_SEGMENTS 30
+
+struct TransactionLogHeader {
+    char magic[8];          // TRANSACTION_LOG_MAGIC, NUL padded
+    uint32_t version;       // TRANSACTION_LOG_VERSION
+    uint32_t recordSize;    // sizeof(struct TransactionRecord) of the writer
+};
+
+struct TransactionRecord {
+    uint64_t sequence;      // 1, 2, ... continuing across runs that append to the same log
+    int64_t timestampNs;    // CLOCK_MONOTONIC when the record was queued
+    int32_t accountNumber;
+    uint16_t operation;     // enum TransactionOp
+    uint16_t reserved;      // Always zero
+    int64_t balanceBefore;  // Money (minor units)
+    int64_t balanceAfter;
+};
+
+struct TransactionLogConfig {
+    const char *filename;
+    int flushRecords;      // Write as soon as this many records are waiting (1 writes each record right away)
+    int flushIntervalMs;   // Write whatever is waiting at least this often; 0 waits for flushRecords
+    long rotateBytes;      // Start a new segment once the log is this large; 0 = no size limit
+    int rotateSeconds;     // ... or once it has been written to for this long; 0 = no age limit
+    int retainSegments;    // Closed segments kept; older ones are deleted. 0 keeps all
+    bool compress;         // gzip closed segments
+    bool index;            // Maintain the per-account index "<log>.idx" (see log_index.h)
+};
+
+struct LogIndex;
+
+// Fill config with the defaults above.
+void transactionLogDefaults(struct TransactionLogConfig *config);
+// Open the log file and start the writer thread. Returns false if the file can not be opened
+// or is not a transaction log.
+bool startTransactionLog(const struct TransactionLogConfig *config);
+// Write everything still queued, then stop the writer and close the file.
+void stopTransactionLog();
+bool transactionLogRunning();
+// Wait until every record queued so far is written to the file.
+void flushTransactionLog();
+// Queue one record, or write it to the log file right away if the logger is not running.
+bool appendTransactionLog(int accountNumber, enum TransactionOp operation, Money balanceBefore, Money balanceAfter);
+// Queue count records at once, with consecutive sequence numbers, or write them in one go if the
+// logger is not running. The caller fills in accountNumber, operation and the balances; sequence
+// and timestampNs are filled in here.
+bool appendTransactionLogRecords(struct TransactionRecord *records, int count);
+// Records queued and batches written since startTransactionLog().
+void transactionLogStats(uint64_t *records, uint64_t *batches);
+// Wait until every closed segment is compressed and the retention limit applied.
+void waitForLogCompression();
+// Index of the running log, covering every record written so far; NULL if it is not running
+// or was started without an index.
+struct LogIndex* transactionLogIndex();
+
+// Closed segments of the log at filename, oldest first, followed by filename itself if it
+// exists. Free the names and the array with freeLogSegments(). If memory runs out part way the
+// segments found so far are returned (NULL and a count of 0 if none).
+char** listLogSegments(const char *filename, int *segmentCount);
+void freeLogSegments(char **segments, int segmentCount);
+// Read every complete record of a log file or segment (compressed or not) into a new array
+// (free() it). Returns NULL if the file can not be read or is not a transaction log.
+struct TransactionRecord* readTransactionLog(const char *filename, long *recordCount);
+// Name of an operation as it appears in the text log, e.g. "Withdrawal".
+const char* transactionOpName(enum TransactionOp operation);
+// Write record as a line of the text log.
+void formatTransactionRecord(const struct TransactionRecord *record, char *line, size_t size);
+
+#endif // PROGRAMMING_ASSIGNMENT_TRANSACTION_LOG_H
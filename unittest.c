@@ -3,19 +3,41 @@
 //
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include "algorithm.h"
+#include "csv_parser.h"
+#include "account_map.h"
+#include "parallel_loader.h"
+#include "snapshot.h"
+#include "account_index.h"
+#include "journal.h"
+#include "transaction_log.h"
+#include "log_index.h"
+#include "replay.h"
+#include "batch.h"
+#include "account_lock.h"
+#include "shard_engine.h"
+#include "account_store.h"
+#include "report.h"
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Test PIN verification
 void test_checkPin() {
-    struct BankAccount account = {123, "Test User", 100.0, 1234, false};
+    struct BankAccount account = {123, "Test User", POUNDS(100), 1234, false};
     assert(checkPin(&account, 1234) == 1);
     assert(checkPin(&account, 0000) == 0);
 }
 
 // Test blocked status check
 void test_checkBlocked() {
-    struct BankAccount account = {123, "Test User", 100.0, 1234, false};
+    struct BankAccount account = {123, "Test User", POUNDS(100), 1234, false};
     assert(checkBlocked(&account) == 0);
     account.blocked = true;
     assert(checkBlocked(&account) == 1);
@@ -23,64 +45,104 @@ void test_checkBlocked() {
 
 // Test withdrawal function
 void test_withdraw() {
-    struct BankAccount account = {123, "Test User", 100.0, 1234, false};
+    struct BankAccount account = {123, "Test User", POUNDS(100), 1234, false};
 
     // Negative amount should fail.
-    const char* result = withdraw(&account, -10);
+    const char* result = withdraw(&account, POUNDS(-10));
     assert(strcmp(result, "Invalid withdrawal amount!") == 0);
 
     // Withdrawal amount that is not a multiple of 5 should fail.
-    result = withdraw(&account, 7);
+    result = withdraw(&account, POUNDS(7));
     assert(strcmp(result, "Amount must be a multiple of 5, 10 or 20!") == 0);
 
-    result = withdraw(&account, 42);
+    result = withdraw(&account, POUNDS(42));
     assert(strcmp(result, "Amount must be a multiple of 5, 10 or 20!") == 0);
 
     // Attempting to withdraw more than the balance.
-    result = withdraw(&account, 110);
+    result = withdraw(&account, POUNDS(110));
     assert(strcmp(result, "Insufficient funds!") == 0);
 
     // Valid withdrawal.
-    result = withdraw(&account, 50);
+    result = withdraw(&account, POUNDS(50));
     // Check that the message indicates success.
     assert(strstr(result, "Withdrawal successful!") != 0);
     // Verify that the account balance has been updated.
-    assert(account.balance == 50.0);
+    assert(account.balance == POUNDS(50));
 
-    result = withdraw(&account, 50);
+    result = withdraw(&account, POUNDS(50));
     // Check that the message indicates success.
     assert(strstr(result, "Withdrawal successful!") != 0);
     // Verify that the account balance has been updated.
-    assert(account.balance == 0.0);
+    assert(account.balance == 0);
 
-    result = withdraw(&account, 20);
+    result = withdraw(&account, POUNDS(20));
     // Check that the message indicates success.
     assert(strstr(result, "Insufficient funds!") != 0);
     // Verify that the account balance has been updated.
-    assert(account.balance == 0.0);
+    assert(account.balance == 0);
 }
 
 // Test deposit function
 void test_deposit() {
-    struct BankAccount account = {123, "Test User", 100.0, 1234, false};
+    struct BankAccount account = {123, "Test User", POUNDS(100), 1234, false};
 
     // Negative deposit should fail.
-    const char* result = deposit(&account, -10);
+    const char* result = deposit(&account, POUNDS(-10));
     assert(strcmp(result, "Invalid deposit amount!") == 0);
 
     // Valid deposit.
-    result = deposit(&account, 50);
+    result = deposit(&account, POUNDS(50));
     assert(strstr(result, "Deposit successful!") != 0);
-    assert(account.balance == 150.0);
+    assert(account.balance == POUNDS(150));
 
-    result = deposit(&account, 1000);
+    result = deposit(&account, POUNDS(1000));
     assert(strstr(result, "Deposit successful!") != 0);
-    assert(account.balance == 1150.0);
+    assert(account.balance == POUNDS(1150));
+}
+
+// Test exact parsing and formatting of money
+void test_money() {
+    const char *texts[] = {"1234.60", "0.05", "-0.5", "+12", "5.", ".25", "0.125", "0.1249", "1.5e3", " 7.10"};
+    Money expected[] = {123460, 5, -50, 1200, 500, 25, 13, 12, 150000, 710};
+    for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        Money amount;
+        assert(parseMoneyString(texts[i], &amount) && amount == expected[i]);
+    }
+    const char *invalid[] = {"", ".", "12abc", "inf", "nan", "1e30", "£5"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        Money amount;
+        assert(!parseMoneyString(invalid[i], &amount));
+    }
+    // Adding a tenth of a pound ten times gives exactly a pound.
+    Money total = 0;
+    for (int i = 0; i < 10; i++) {
+        total += 10;
+    }
+    assert(total == POUNDS(1));
+    char text[MONEY_TEXT_SIZE];
+    formatMoney(123460, text, sizeof(text));
+    assert(strcmp(text, "1234.60") == 0);
+    formatMoney(-50, text, sizeof(text));
+    assert(strcmp(text, "-0.50") == 0);
+    formatMoney(INT64_MIN, text, sizeof(text));
+    assert(strcmp(text, "-92233720368547758.08") == 0);
+    assert(formatMoney(123460, text, 5) == 7 && strcmp(text, "1234") == 0);  // Cut short like snprintf
+    Money displayed[] = {0, 5, 99999, 100000, 123456789, -50, INT64_MIN};
+    const char *display[] = {"£0.00", "£0.05", "£999.99", "£1,000.00", "£1,234,567.89", "-£0.50",
+                             "-£92,233,720,368,547,758.08"};
+    for (size_t i = 0; i < sizeof(displayed) / sizeof(displayed[0]); i++) {
+        assert(formatMoneyDisplay(displayed[i], text, sizeof(text)) == strlen(display[i]));
+        assert(strcmp(text, display[i]) == 0);
+    }
+    // Pence are not a multiple of 5 pounds.
+    struct BankAccount account = {123, "Test User", POUNDS(100), 1234, false};
+    assert(strcmp(withdraw(&account, 550), "Amount must be a multiple of 5, 10 or 20!") == 0);
+    assert(account.balance == POUNDS(100));
 }
 
 // Test changing PIN
 void test_changePin() {
-    struct BankAccount account = {123, "Test User", 100.0, 1234, false};
+    struct BankAccount account = {123, "Test User", POUNDS(100), 1234, false};
 
     // Mismatched new PINs.
     const char* result = changePin(&account, 1111, 2222);
@@ -101,17 +163,58 @@ void test_changePin() {
 
 // Test balance display
 void test_showBalance() {
-    struct BankAccount account = {123, "Test User", 100.0, 1234, false};
+    struct BankAccount account = {123, "Test User", POUNDS(100), 1234, false};
     const char* result = showBalance(&account);
     // Check that the string contains the correct formatted balance.
     assert(strstr(result, "£100.00") != 0);
+    account.balance = 123460;
+    assert(strcmp(showBalance(&account), "Your current balance is: £1,234.60") == 0);
+}
+
+// Test the status-code operations and the messages they write into caller buffers
+void test_operationStatus() {
+    struct BankAccount first = {1, "First", POUNDS(100), 1111, false};
+    struct BankAccount second = {2, "Second", POUNDS(20), 2222, false};
+    char message1[100];
+    char message2[100];
+
+    assert(withdrawFunds(&first, POUNDS(-5), message1, sizeof(message1)) == STATUS_INVALID_WITHDRAWAL);
+    assert(strcmp(message1, "Invalid withdrawal amount!") == 0);
+    assert(withdrawFunds(&first, POUNDS(7), NULL, 0) == STATUS_NOT_MULTIPLE_OF_5);
+    assert(withdrawFunds(&second, POUNDS(50), message1, sizeof(message1)) == STATUS_INSUFFICIENT_FUNDS);
+    assert(strcmp(message1, operationStatusText(STATUS_INSUFFICIENT_FUNDS)) == 0);
+    assert(depositFunds(&first, 0, NULL, 0) == STATUS_INVALID_DEPOSIT);
+    assert(updatePin(&first, 1234, 4321, NULL, 0) == STATUS_PINS_DIFFER);
+    assert(updatePin(&first, 12, 12, NULL, 0) == STATUS_INVALID_PIN);
+    assert(first.balance == POUNDS(100) && first.pinCode == 1111);
+
+    // Each result stays in its own buffer.
+    assert(withdrawFunds(&first, POUNDS(40), message1, sizeof(message1)) == STATUS_OK);
+    assert(depositFunds(&second, POUNDS(5), message2, sizeof(message2)) == STATUS_OK);
+    assert(strcmp(message1, "Withdrawal successful! New balance: £60.00") == 0);
+    assert(strcmp(message2, "Deposit successful! New balance: £25.00") == 0);
+    assert(updatePin(&second, 4321, 4321, message2, sizeof(message2)) == STATUS_OK);
+    assert(strcmp(message2, "PIN successfully changed!") == 0);
+    assert(second.pinCode == 4321);
+
+    // No message wanted, or too short a buffer: the operation still happens.
+    assert(depositFunds(&first, POUNDS(1), NULL, 0) == STATUS_OK);
+    assert(first.balance == POUNDS(61));
+    char small[12];
+    assert(withdrawFunds(&first, POUNDS(5), small, sizeof(small)) == STATUS_OK);
+    assert(strcmp(small, "Withdrawal ") == 0);
+    assert(first.balance == POUNDS(56));
+    assert(withdrawFunds(&first, POUNDS(-1), small, sizeof(small)) == STATUS_INVALID_WITHDRAWAL);
+    assert(strcmp(small, "Invalid wit") == 0);
+    balanceText(&first, message1, sizeof(message1));
+    assert(strcmp(message1, "Your current balance is: £56.00") == 0);
 }
 
 // Test finding an account
 void test_findAccount() {
     struct BankAccount accounts[2] = {
-            {1, "Kirill", 100.0, 1111, false},
-            {2, "Madiyar", 200.0, 2222, false}
+            {1, "Kirill", POUNDS(100), 1111, false},
+            {2, "Madiyar", POUNDS(200), 2222, false}
     };
 
     struct BankAccount* acc = findAccount(accounts, 2, 1);
@@ -122,14 +225,1736 @@ void test_findAccount() {
     assert(acc == NULL);
 }
 
+// Test loading accounts from a CSV file with more than a handful of rows
+void test_loadAccountsFromCSV() {
+    const char *filename = "test_accounts.csv";
+    FILE *file = fopen(filename, "w");
+    assert(file != NULL);
+    fprintf(file, "AccountNumber,AccountHolder,Balance,PinCode,Blocked\n");
+    for (int i = 1; i <= 100; i++) {
+        fprintf(file, "%d,Holder %d,%d.50,%d,%d\n", i, i, i, 1000 + i, i == 7);
+    }
+    fprintf(file, "this is not an account\n");  // Malformed line, reported and skipped
+    fprintf(file, "101,Last Holder,1.25,4321,0\n");
+    fclose(file);
+
+    int count;
+    struct BankAccount *accounts = loadAccountsFromCSV(filename, &count);
+    assert(count == 101);
+    assert(accounts[0].accountNumber == 1);
+    assert(strcmp(accounts[99].accountHolder, "Holder 100") == 0);
+    assert(accounts[99].balance == 10050);
+    assert(accounts[6].blocked);
+    assert(accounts[100].accountNumber == 101);
+    assert(accounts[100].pinCode == 4321);
+    releaseAccounts(accounts);
+    remove(filename);
+}
+
+// Test that the fast CSV parser accepts exactly the rows sscanf accepts
+void test_csvParserMatchesScanf() {
+    const char *lines[] = {
+            "1,Kirill Tumoian,1234.60,1234,0",
+            "2,Andrew Bradley,848.50,5678,1\r",
+            " 3, Leading Space,  12.5, 42, 7 trailing,junk",
+            "+4,Plus,-0.01,-1,+0",
+            "5,Exponent,1.5e3,1111,0",
+            "6,Hex,0x10,1111,0",
+            "7,Infinity,inf,1111,0",
+            "8,Dot Only,.,1111,0",
+            "9,Trailing Dot,5.,1111,0",
+            "10,Leading Dot,.25,1111,0",
+            "11,Many Digits,0.1234567890123456789,1111,0",
+            "12,,1.00,1111,0",
+            "13,Name That Is Exactly Forty Nine Characters Long!!,1.00,1111,0",
+            "14,Name That Is Exactly Fifty Characters Long, really,1.00,1111,0",
+            "15,Missing Fields,1.00",
+            "16,Bad Number,12abc,1111,0",
+            "17 ,Space Before Comma,1.00,1111,0",
+            "x,Not A Number,1.00,1111,0",
+            "18,Empty Blocked,1.00,1111,",
+            "19,Spaces Blocked,1.00,1111,   ",
+            "20,Big Balance,123456789012345678.99,1111,0",
+    };
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        struct BankAccount fast = {0}, reference = {0};
+        bool fastOk = csvParseAccountLine(lines[i], strlen(lines[i]), &fast);
+        bool referenceOk = csvParseAccountLineScanf(lines[i], &reference);
+        assert(fastOk == referenceOk);
+        if (fastOk) {
+            assert(fast.accountNumber == reference.accountNumber);
+            assert(strcmp(fast.accountHolder, reference.accountHolder) == 0);
+            assert(fast.balance == reference.balance);
+            assert(fast.pinCode == reference.pinCode);
+            assert(fast.blocked == reference.blocked);
+        }
+    }
+}
+
+// Test that the SIMD structural index finds the same commas and newlines as the scalar loop
+void test_csvStructuralIndex() {
+    char buf[1000];
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (i % 7 == 0) ? ',' : (i % 31 == 0) ? '\n' : (char)('a' + i % 26);
+    }
+    uint32_t simd[1000], scalar[1000];
+    for (size_t length = 0; length <= sizeof(buf); length += 37) {
+        size_t simdCount = csvStructuralIndex(buf, length, simd);
+        size_t scalarCount = csvStructuralIndexScalar(buf, length, scalar);
+        assert(simdCount == scalarCount);
+        assert(memcmp(simd, scalar, scalarCount * sizeof(uint32_t)) == 0);
+    }
+}
+
+// Test mapping accounts.csv in place and materialising records on modification
+void test_mapAccountsFromCSV() {
+    const char *filename = "test_accounts.csv";
+    FILE *file = fopen(filename, "w");
+    assert(file != NULL);
+    fprintf(file, "AccountNumber,AccountHolder,Balance,PinCode,Blocked\n");
+    fprintf(file, "1,Kirill Tumoian,1234.60,1234,0\n");
+    fprintf(file, "broken line\n");
+    fprintf(file, "2,Andrew Bradley,848.50,5678,1");  // No trailing newline
+    fclose(file);
+
+    struct AccountMap *map = mapAccountsFromCSV(filename);
+    assert(map != NULL);
+    assert(map->count == 2);
+    assert(accountMapFind(map, 3) == -1);
+    int i = accountMapFind(map, 2);
+    assert(i == 1);
+    struct BankAccount account;
+    accountMapRead(map, i, &account);
+    assert(strcmp(account.accountHolder, "Andrew Bradley") == 0);
+    assert(account.balance == 84850);
+    assert(account.blocked);
+    assert(map->modified[0] == NULL);
+    struct BankAccount *writable = accountMapModify(map, 0);
+    assert(writable != NULL && map->modified[0] == writable);
+    deposit(writable, POUNDS(10));
+    accountMapRead(map, 0, &account);
+    assert(account.balance == 124460);
+    assert(strcmp(account.accountHolder, "Kirill Tumoian") == 0);
+    unmapAccounts(map);
+    remove(filename);
+}
+
+// Test that the parallel loader returns the same accounts, in the same order, as the serial one
+void test_loadAccountsFromCSVParallel() {
+    const char *filename = "test_accounts.csv";
+    FILE *file = fopen(filename, "w");
+    assert(file != NULL);
+    fprintf(file, "AccountNumber,AccountHolder,Balance,PinCode,Blocked\n");
+    // Large enough to be split into several chunks.
+    for (int i = 1; i <= 20000; i++) {
+        if (i % 5000 == 0) {
+            fprintf(file, "malformed %d\n", i);
+        } else {
+            fprintf(file, "%d,Holder %d,%d.25,%d,%d\n", i, i, i, 1000 + i % 9000, i % 3 == 0);
+        }
+    }
+    fclose(file);
+
+    int serialCount;
+    struct BankAccount *serial = loadAccountsFromCSV(filename, &serialCount);
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        int count;
+        struct BankAccount *parallel = loadAccountsFromCSVParallel(filename, &count, threads);
+        assert(count == serialCount);
+        assert(count == 19996);
+        for (int i = 0; i < count; i++) {
+            assert(parallel[i].accountNumber == serial[i].accountNumber);
+            assert(strcmp(parallel[i].accountHolder, serial[i].accountHolder) == 0);
+            assert(parallel[i].balance == serial[i].balance);
+            assert(parallel[i].pinCode == serial[i].pinCode);
+            assert(parallel[i].blocked == serial[i].blocked);
+        }
+        releaseAccounts(parallel);
+    }
+    releaseAccounts(serial);
+    remove(filename);
+}
+
+// Test writing, opening and validating a binary snapshot
+void test_accountsSnapshot() {
+    const char *filename = "test_accounts.snap";
+    struct BankAccount accounts[3] = {
+            {1, "Kirill", POUNDS(100), 1111, false},
+            {2, "Madiyar", 20050, 2222, true},
+            {7, "Andrew", 25, 3333, false}
+    };
+    assert(saveAccountsSnapshot(filename, accounts, 3));
+    assert(isAccountsSnapshot(filename));
+
+    int count;
+    struct BankAccount *loaded = openAccountsSnapshot(filename, &count, true);
+    assert(loaded != NULL);
+    assert(count == 3);
+    assert(loaded[1].accountNumber == 2);
+    assert(strcmp(loaded[1].accountHolder, "Madiyar") == 0);
+    assert(loaded[1].balance == 20050);
+    assert(loaded[1].blocked);
+    assert(findAccount(loaded, count, 7)->pinCode == 3333);
+    // The mapping is private: changes do not reach the file until it is saved.
+    deposit(&loaded[0], POUNDS(50));
+    releaseAccounts(loaded);
+    loaded = loadAccounts(filename, &count, 1);
+    assert(count == 3 && loaded[0].balance == POUNDS(100));
+    releaseAccounts(loaded);
+
+    // Flip one byte of a record: the checksum must catch it.
+    FILE *file = fopen(filename, "r+b");
+    fseek(file, sizeof(struct SnapshotHeader) + 5, SEEK_SET);
+    fputc('X', file);
+    fclose(file);
+    assert(openAccountsSnapshot(filename, &count, false) != NULL);
+    assert(openAccountsSnapshot(filename, &count, true) == NULL);
+    remove(filename);
+}
+
+// Test that findAccount goes through the hash index for loaded arrays and that addAccount keeps it in sync
+void test_accountIndex() {
+    const char *filename = "test_accounts.csv";
+    FILE *file = fopen(filename, "w");
+    assert(file != NULL);
+    fprintf(file, "AccountNumber,AccountHolder,Balance,PinCode,Blocked\n");
+    for (int i = 0; i < 1000; i++) {
+        fprintf(file, "%d,Holder %d,1.00,1234,0\n", 7 * i + 3, i);
+    }
+    fprintf(file, "10,Duplicate Of Ten,2.00,1234,0\n");  // 7 * 1 + 3 is already taken
+    fclose(file);
+
+    int count;
+    struct BankAccount *accounts = loadAccountsFromCSV(filename, &count);
+    assert(count == 1001);
+    assert(accountIndexFor(accounts, count) != NULL);
+    assert(accountIndexFor(accounts, count)->strategy == INDEX_HASH);  // Numbers 7 apart are too sparse
+    assert(accountIndexFor(accounts, count - 1) == NULL);  // Only the exact array/count is indexed
+    for (int i = 0; i < 1000; i++) {
+        struct BankAccount *account = findAccount(accounts, count, 7 * i + 3);
+        assert(account == &accounts[i]);
+        assert(findAccount(accounts, count, 7 * i + 4) == NULL);
+    }
+    // Like the linear scan, the first account with a duplicate number wins.
+    assert(strcmp(findAccount(accounts, count, 10)->accountHolder, "Holder 1") == 0);
+
+    // Adding accounts grows the array and the table; every account must stay reachable.
+    for (int i = 0; i < 5000; i++) {
+        struct BankAccount account = {100000 + i, "New Holder", 0, 1111, false};
+        assert(addAccount(&accounts, &count, &account) != NULL);
+    }
+    assert(count == 6001);
+    assert(accountIndexFor(accounts, count) != NULL);
+    assert(findAccount(accounts, count, 104999) == &accounts[6000]);
+    assert(findAccount(accounts, count, 3) == &accounts[0]);
+    assert(findAccount(accounts, count, 105000) == NULL);
+    releaseAccounts(accounts);
+
+    // A mapped snapshot moves to the heap when an account is added.
+    struct BankAccount small[2] = {
+            {1, "Kirill", POUNDS(100), 1111, false},
+            {2, "Madiyar", POUNDS(200), 2222, false}
+    };
+    saveAccountsSnapshot("test_accounts.snap", small, 2);
+    accounts = openAccountsSnapshot("test_accounts.snap", &count, true);
+    struct BankAccount extra = {3, "Andrew", POUNDS(300), 3333, false};
+    assert(findAccount(accounts, count, 2)->balance == POUNDS(200));
+    assert(addAccount(&accounts, &count, &extra) != NULL);
+    assert(count == 3);
+    assert(findAccount(accounts, count, 3)->balance == POUNDS(300));
+    assert(findAccount(accounts, count, 1)->balance == POUNDS(100));
+    releaseAccounts(accounts);
+    remove("test_accounts.snap");
+    remove(filename);
+}
+
+// Test the direct table used when account numbers are dense, and the switch to hashing
+void test_directAccountIndex() {
+    int count = 0;
+    struct BankAccount *accounts = malloc(sizeof(struct BankAccount));
+    registerAccounts(accounts, 0, 1);
+    for (int i = 0; i < 100; i++) {
+        // 1..200 with every other number missing: half full, still dense.
+        struct BankAccount account = {1 + 2 * i, "Holder", 0, 1234, false};
+        assert(addAccount(&accounts, &count, &account) != NULL);
+    }
+    releaseAccounts(accounts);
+
+    const char *filename = "test_accounts.csv";
+    FILE *file = fopen(filename, "w");
+    fprintf(file, "AccountNumber,AccountHolder,Balance,PinCode,Blocked\n");
+    for (int i = 1; i <= 100; i++) {
+        fprintf(file, "%d,Holder %d,1.00,1234,0\n", 2 * i, i);
+    }
+    fclose(file);
+    accounts = loadAccountsFromCSV(filename, &count);
+    struct AccountIndex *index = accountIndexFor(accounts, count);
+    assert(index->strategy == INDEX_DIRECT);
+    assert(index->directBase == 2 && index->directSize == 199);
+    assert(findAccount(accounts, count, 2) == &accounts[0]);
+    assert(findAccount(accounts, count, 200) == &accounts[99]);
+    assert(findAccount(accounts, count, 3) == NULL);
+    assert(findAccount(accounts, count, 1) == NULL);
+    assert(findAccount(accounts, count, 201) == NULL);
+    assert(findAccount(accounts, count, -5) == NULL);
+
+    // Appending increasing numbers keeps the table direct; it grows by doubling.
+    for (int i = 201; i <= 300; i++) {
+        struct BankAccount account = {i, "New Holder", 0, 1111, false};
+        addAccount(&accounts, &count, &account);
+    }
+    index = accountIndexFor(accounts, count);
+    assert(index->strategy == INDEX_DIRECT);
+    assert(index->directSize >= 299);
+    assert(findAccount(accounts, count, 300) == &accounts[199]);
+    assert(findAccount(accounts, count, 250)->accountNumber == 250);
+
+    // One far-away number makes the range sparse: the index switches to hashing.
+    struct BankAccount far = {1000000, "Far Away", 0, 1111, false};
+    addAccount(&accounts, &count, &far);
+    index = accountIndexFor(accounts, count);
+    assert(index->strategy == INDEX_HASH);
+    assert(findAccount(accounts, count, 1000000) == &accounts[200]);
+    assert(findAccount(accounts, count, 2) == &accounts[0]);
+    assert(findAccount(accounts, count, 299) == &accounts[198]);
+    releaseAccounts(accounts);
+    remove(filename);
+}
+
+// Test that a table loaded once every registry entry is taken still works, without an index
+void test_accountRegistryFull() {
+    struct BankAccount *tables[MAX_INDEXED_TABLES + 1];
+    int registered = 0;
+    for (int i = 0; i <= MAX_INDEXED_TABLES; i++) {
+        tables[i] = calloc(1, sizeof(struct BankAccount));
+        tables[i]->accountNumber = 42;
+        if (registerAccounts(tables[i], 1, 1)) {
+            registered++;
+        } else {
+            break;
+        }
+    }
+    // Other tests may still hold entries; either way the last one did not fit.
+    assert(registered <= MAX_INDEXED_TABLES);
+    struct BankAccount *extra = tables[registered];
+    assert(accountIndexFor(extra, 1) == NULL);
+    assert(findAccount(extra, 1, 42) == extra);
+    markAccountDirty(extra);
+    int dirtyCount;
+    assert(dirtyAccounts(extra, &dirtyCount) == NULL && dirtyCount == 0);
+
+    // A snapshot loaded now is copied off its mapping, so releasing it frees it.
+    const char *filename = "test_registry_full.snap";
+    assert(saveAccountsSnapshot(filename, extra, 1));
+    int count;
+    struct BankAccount *loaded = loadAccounts(filename, &count, 1);
+    assert(loaded != NULL && count == 1 && findAccount(loaded, count, 42) == loaded);
+    releaseAccounts(loaded);
+    remove(filename);
+
+    releaseAccounts(extra);
+    for (int i = 0; i < registered; i++) {
+        releaseAccounts(tables[i]);
+    }
+}
+
+// Test that snapshots and journals written with double balances are still read
+void test_legacyBalances() {
+    const char *filename = "test_legacy.snap";
+    struct BankAccount records[2] = {{1, "Kirill", 0, 1111, false}, {2, "Madiyar", 0, 2222, true}};
+    double pounds[2] = {1234.6, 0.1};
+    struct SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, SNAPSHOT_MAGIC);
+    header.version = 1;
+    header.recordSize = sizeof(struct BankAccount);
+    header.recordCount = 2;
+    for (int i = 0; i < 2; i++) {
+        memcpy(&records[i].balance, &pounds[i], sizeof(double));
+        header.checksum += snapshotRecordHash(&records[i]);
+    }
+    FILE *file = fopen(filename, "wb");
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(records, sizeof(records), 1, file);
+    fclose(file);
+    int count;
+    struct BankAccount *accounts = openAccountsSnapshot(filename, &count, true);
+    assert(accounts != NULL && count == 2);
+    assert(accounts[0].balance == 123460 && accounts[1].balance == 10 && accounts[1].blocked);
+    // Saved back in full, as the current version.
+    saveAccounts(filename, accounts, count);
+    releaseAccounts(accounts);
+    accounts = openAccountsSnapshot(filename, &count, true);
+    assert(accounts != NULL && accounts[0].balance == 123460);
+    releaseAccounts(accounts);
+    remove(filename);
+
+    const char *journalFile = "test_legacy.journal";
+    struct JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.sequence = 1;
+    record.accountNumber = 2;
+    record.pinCode = 2222;
+    double balance = 75.5;
+    memcpy(&record.balance, &balance, sizeof(balance));
+    // The checksum is FNV-1a over the bytes before it, as the journal computes it.
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(struct JournalRecord, checksum); i++) {
+        hash = (hash ^ ((unsigned char *)&record)[i]) * 16777619u;
+    }
+    record.checksum = hash;
+    file = fopen(journalFile, "wb");
+    fwrite(&record, sizeof(record), 1, file);
+    fclose(file);
+    struct BankAccount table[2] = {{1, "Kirill", POUNDS(1), 1111, false}, {2, "Madiyar", POUNDS(2), 2222, false}};
+    assert(journalReplay(journalFile, table, 2) == 1);
+    assert(table[1].balance == 7550);
+    remove(journalFile);
+}
+
+// Test that saving a snapshot only rewrites the accounts that changed
+void test_saveDirtyAccounts() {
+    const char *filename = "test_accounts.snap";
+    struct BankAccount initial[100];
+    for (int i = 0; i < 100; i++) {
+        struct BankAccount account = {i + 1, "Holder", POUNDS(10 * i), 1000 + i, false};
+        initial[i] = account;
+    }
+    assert(saveAccountsSnapshot(filename, initial, 100));
+
+    int count;
+    struct BankAccount *accounts = loadAccounts(filename, &count, 1);
+    int dirtyCount;
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(count == 100 && dirtyCount == 0);
+    deposit(findAccount(accounts, count, 5), POUNDS(20));
+    withdraw(findAccount(accounts, count, 50), POUNDS(10));
+    deposit(findAccount(accounts, count, 5), POUNDS(5));   // Same account again: still one record
+    changePin(findAccount(accounts, count, 99), 4321, 4321);
+    blockAccount(findAccount(accounts, count, 1));
+    withdraw(findAccount(accounts, count, 2), POUNDS(1000));  // Insufficient funds: nothing changes
+    const int *dirty = dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == 4);
+    assert(dirty[0] == 4 && dirty[1] == 49 && dirty[2] == 98 && dirty[3] == 0);
+    struct BankAccount added = {101, "New Holder", POUNDS(1), 1111, false};
+    assert(addAccount(&accounts, &count, &added) != NULL);
+    assert(saveDirtyAccountsSnapshot(filename, accounts, count) == 5);
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == 0);
+    assert(saveDirtyAccountsSnapshot(filename, accounts, count) == 0);
+    releaseAccounts(accounts);
+
+    // The checksum was updated record by record, so the file still verifies.
+    accounts = openAccountsSnapshot(filename, &count, true);
+    assert(accounts != NULL && count == 101);
+    assert(accounts[4].balance == POUNDS(65));
+    assert(accounts[49].balance == POUNDS(480));
+    assert(accounts[98].pinCode == 4321);
+    assert(accounts[0].blocked);
+    assert(accounts[1].balance == POUNDS(10));
+    assert(strcmp(accounts[100].accountHolder, "New Holder") == 0);
+    releaseAccounts(accounts);
+
+    // A snapshot the accounts did not come from is not updated in place.
+    accounts = loadAccounts(filename, &count, 1);
+    assert(saveDirtyAccountsSnapshot("other.snap", accounts, count) == -1);
+    // A failed save reports it and keeps the changed accounts for the next one.
+    deposit(findAccount(accounts, count, 7), POUNDS(5));
+    assert(!saveAccounts("no_such_directory/accounts.csv", accounts, count));
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == 1);
+    assert(saveAccounts(filename, accounts, count));
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == 0);
+    releaseAccounts(accounts);
+
+    // A crash during an in-place update: the header is still marked and a record is torn.
+    FILE *file = fopen(filename, "r+b");
+    struct SnapshotHeader header;
+    assert(fread(&header, sizeof(header), 1, file) == 1 && header.flags == 0);
+    header.flags |= SNAPSHOT_FLAG_UPDATING;
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fseek(file, sizeof(header) + 9 * sizeof(struct BankAccount) + offsetof(struct BankAccount, balance), SEEK_SET);
+    fputc(0x7f, file);
+    fclose(file);
+    // Opened despite the checksum (the journal repairs the record), and never updated in place again.
+    accounts = openAccountsSnapshot(filename, &count, true);
+    assert(accounts != NULL && count == 101);
+    assert(accountsSnapshotFile(accounts) == NULL);
+    accounts[9].balance = POUNDS(90);   // What replaying the journal would do
+    markAccountDirty(&accounts[9]);
+    assert(saveDirtyAccountsSnapshot(filename, accounts, count) == -1);
+    assert(saveAccounts(filename, accounts, count));
+    releaseAccounts(accounts);
+    accounts = openAccountsSnapshot(filename, &count, true);
+    assert(accounts != NULL && accounts[9].balance == POUNDS(90) && accountsSnapshotFile(accounts) != NULL);
+    releaseAccounts(accounts);
+    remove(filename);
+}
+
+struct JournalWorker {
+    struct BankAccount *accounts;
+    int count;
+    int accountNumber;
+};
+
+static void* journalWorker(void *arg) {
+    struct JournalWorker *worker = arg;
+    for (int i = 0; i < 50; i++) {
+        depositFunds(findAccount(worker->accounts, worker->count, worker->accountNumber), POUNDS(1), NULL, 0);
+    }
+    return NULL;
+}
+
+// Test journaling, crash recovery by replay, group commit and checkpoints
+struct SaveMarkerArgs {
+    struct BankAccount *accounts;
+    int count;
+    const char *tempFile;
+    bool saved;
+};
+
+// Wait until the save writes its temporary file, then mark every other account.
+static void *markDuringSave(void *arg) {
+    struct SaveMarkerArgs *args = arg;
+    while (access(args->tempFile, F_OK) != 0 && !__atomic_load_n(&args->saved, __ATOMIC_ACQUIRE)) {
+        usleep(100);
+    }
+    for (int i = 0; i < args->count; i += 2) {
+        markAccountDirty(&args->accounts[i]);
+    }
+    return NULL;
+}
+
+// Test that an account changed while a save is running stays marked for the next save, also
+// when it was marked already before the save
+void test_markDuringSave() {
+    const char *filename = "test_mark_during_save.csv";
+    int count = 200000;
+    struct BankAccount *accounts = malloc(count * sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        struct BankAccount account = {i + 1, "Holder", POUNDS(1), 1111, false};
+        accounts[i] = account;
+    }
+    registerAccounts(accounts, count, count);
+    for (int i = 0; i < count; i++) {
+        markAccountDirty(&accounts[i]);
+    }
+    struct SaveMarkerArgs args = {accounts, count, "test_mark_during_save.csv.tmp", false};
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, markDuringSave, &args) == 0);
+    assert(saveAccounts(filename, accounts, count));
+    __atomic_store_n(&args.saved, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    int dirtyCount;
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == count / 2);
+    releaseAccounts(accounts);
+    remove(filename);
+}
+
+void test_journal() {
+    const char *accountsFile = "test_journal.snap";
+    const char *journalFile = "test_journal.snap.journal";
+    remove(journalFile);
+    struct BankAccount initial[4] = {
+            {1, "Kirill", POUNDS(100), 1111, false},
+            {2, "Madiyar", POUNDS(200), 2222, false},
+            {3, "Andrew", POUNDS(300), 3333, false},
+            {4, "Someone", POUNDS(400), 4444, false}
+    };
+    saveAccountsSnapshot(accountsFile, initial, 4);
+
+    // A session that "crashes": changes are journaled but the accounts are never saved.
+    int count;
+    struct BankAccount *accounts = loadAccounts(accountsFile, &count, 1);
+    assert(journalOpen(journalFile));
+    withdraw(findAccount(accounts, count, 1), POUNDS(50));
+    deposit(findAccount(accounts, count, 2), POUNDS(25));
+    changePin(findAccount(accounts, count, 3), 9999, 9999);
+    blockAccount(findAccount(accounts, count, 4));
+    withdraw(findAccount(accounts, count, 1), POUNDS(500));  // Rejected: not journaled
+    uint64_t records, syncs;
+    journalStats(&records, &syncs);
+    assert(records == 4 && syncs == 4);
+    journalClose();
+    releaseAccounts(accounts);
+
+    // Restart: the snapshot is unchanged, replaying the journal restores the session.
+    accounts = loadAccounts(accountsFile, &count, 1);
+    assert(findAccount(accounts, count, 1)->balance == POUNDS(100));
+    // Simulate a torn write at the end of the journal.
+    FILE *file = fopen(journalFile, "ab");
+    fwrite("torn", 1, 4, file);
+    fclose(file);
+    assert(journalReplay(journalFile, accounts, count) == 4);
+    assert(findAccount(accounts, count, 1)->balance == POUNDS(50));
+    assert(findAccount(accounts, count, 2)->balance == POUNDS(225));
+    assert(findAccount(accounts, count, 3)->pinCode == 9999);
+    assert(findAccount(accounts, count, 4)->blocked);
+    struct stat info;
+    stat(journalFile, &info);
+    assert(info.st_size == 4 * sizeof(struct JournalRecord));  // The torn tail was cut off
+
+    // Concurrent operations share fsyncs.
+    assert(journalOpen(journalFile));
+    pthread_t threads[4];
+    struct JournalWorker workers[4];
+    for (int t = 0; t < 4; t++) {
+        workers[t].accounts = accounts;
+        workers[t].count = count;
+        workers[t].accountNumber = t + 1;
+        pthread_create(&threads[t], NULL, journalWorker, &workers[t]);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    journalStats(&records, &syncs);
+    assert(records == 200 && syncs <= records);
+    assert(findAccount(accounts, count, 2)->balance == POUNDS(275));
+
+    // A checkpoint whose save fails keeps the journal, and the journal still restores everything.
+    mkdir("test_journal.snap.tmp", 0755);    // The save's temporary file can not be created
+    assert(!journalCheckpoint(accountsFile, accounts, count));
+    rmdir("test_journal.snap.tmp");
+    stat(journalFile, &info);
+    assert(info.st_size == 204 * sizeof(struct JournalRecord));
+    int recoveredCount;
+    struct BankAccount *recovered = loadAccounts(accountsFile, &recoveredCount, 1);
+    assert(findAccount(recovered, recoveredCount, 2)->balance == POUNDS(200));
+    assert(journalReplay(journalFile, recovered, recoveredCount) == 204);
+    assert(findAccount(recovered, recoveredCount, 2)->balance == POUNDS(275));
+    assert(findAccount(recovered, recoveredCount, 4)->blocked);
+    releaseAccounts(recovered);
+
+    // A checkpoint saves the accounts and empties the journal.
+    assert(journalCheckpoint(accountsFile, accounts, count));
+    stat(journalFile, &info);
+    assert(info.st_size == 0);
+    journalClose();
+    releaseAccounts(accounts);
+    accounts = loadAccounts(accountsFile, &count, 1);
+    assert(journalReplay(journalFile, accounts, count) == 0);
+    assert(findAccount(accounts, count, 4)->balance == POUNDS(450));
+    assert(findAccount(accounts, count, 1)->balance == POUNDS(100));
+    releaseAccounts(accounts);
+    remove(accountsFile);
+    remove(journalFile);
+}
+
+// Test batches: per-operation results, one journal write and fsync, log records in batch order
+void test_batch() {
+    const char *logFile = "test_batch.bin";
+    const char *journalFile = "test_batch.journal";
+    remove(logFile);
+    remove(journalFile);
+    int count = 3;
+    struct BankAccount *accounts = malloc(count * sizeof(struct BankAccount));
+    struct BankAccount initial[3] = {
+            {1, "Kirill", POUNDS(100), 1111, false},
+            {2, "Madiyar", POUNDS(200), 2222, false},
+            {3, "Andrew", POUNDS(300), 3333, false}
+    };
+    memcpy(accounts, initial, sizeof(initial));
+    registerAccounts(accounts, count, count);
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = logFile;
+    config.index = false;
+    assert(startTransactionLog(&config));
+    assert(journalOpen(journalFile));
+
+    struct BatchOperation operations[] = {
+            {2, TRANSACTION_WITHDRAWAL, POUNDS(50)},
+            {1, TRANSACTION_DEPOSIT, POUNDS(20)},
+            {2, TRANSACTION_WITHDRAWAL, POUNDS(200)},     // Only 150 left by now
+            {9, TRANSACTION_DEPOSIT, POUNDS(10)},
+            {1, TRANSACTION_WITHDRAWAL, POUNDS(120)},     // After the deposit above
+            {3, TRANSACTION_CHECK_BALANCE, 0},
+            {2, TRANSACTION_DEPOSIT, 0},
+            {3, TRANSACTION_WITHDRAWAL, 1234},
+            {2, TRANSACTION_DEPOSIT, 5}
+    };
+    int total = (int)(sizeof(operations) / sizeof(operations[0]));
+    enum OperationStatus results[9];
+    assert(applyTransactionBatch(accounts, count, operations, total, results) == 4);
+    enum OperationStatus expected[9] = {STATUS_OK, STATUS_OK, STATUS_INSUFFICIENT_FUNDS, STATUS_UNKNOWN_ACCOUNT,
+                                        STATUS_OK, STATUS_UNSUPPORTED_OPERATION, STATUS_INVALID_DEPOSIT,
+                                        STATUS_NOT_MULTIPLE_OF_5, STATUS_OK};
+    assert(memcmp(results, expected, sizeof(expected)) == 0);
+    assert(findAccount(accounts, count, 1)->balance == 0);
+    assert(findAccount(accounts, count, 2)->balance == POUNDS(150) + 5);
+    assert(findAccount(accounts, count, 3)->balance == POUNDS(300));
+
+    // Two accounts changed: two journal records, one fsync.
+    uint64_t records, syncs;
+    journalStats(&records, &syncs);
+    assert(records == 2 && syncs == 1);
+    int dirtyCount;
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == 2);
+    journalClose();
+
+    // The log holds the operations that succeeded, in batch order, with consecutive sequence numbers.
+    stopTransactionLog();
+    long logged;
+    struct TransactionRecord *log = readTransactionLog(logFile, &logged);
+    assert(log != NULL && logged == 4);
+    int order[4] = {0, 1, 4, 8};
+    for (int i = 0; i < 4; i++) {
+        assert(log[i].sequence == (uint64_t)i + 1);
+        assert(log[i].accountNumber == operations[order[i]].accountNumber);
+        assert(log[i].operation == operations[order[i]].operation);
+    }
+    assert(log[2].balanceBefore == POUNDS(120) && log[2].balanceAfter == 0);
+    free(log);
+
+    // Replaying the journal over the initial accounts gives the same balances.
+    memcpy(accounts, initial, sizeof(initial));
+    assert(journalReplay(journalFile, accounts, count) == 2);
+    assert(findAccount(accounts, count, 1)->balance == 0);
+    assert(findAccount(accounts, count, 2)->balance == POUNDS(150) + 5);
+    releaseAccounts(accounts);
+    remove(logFile);
+    remove(journalFile);
+}
+
+struct LockingWorker {
+    struct BankAccount *accounts;
+    int count;
+    int id;
+};
+
+// Every thread moves money around the same few accounts; each operation keeps the total unchanged
+// only if no update is lost.
+static void* lockingWorker(void *arg) {
+    struct LockingWorker *worker = arg;
+    for (int i = 0; i < 2000; i++) {
+        struct BankAccount *from = findAccount(worker->accounts, worker->count, 1 + (worker->id + i) % worker->count);
+        struct BankAccount *to = findAccount(worker->accounts, worker->count, 1 + (worker->id + 2 * i + 1) % worker->count);
+        if (i % 50 == 0) {
+            struct BatchOperation operations[2] = {
+                    {from->accountNumber, TRANSACTION_WITHDRAWAL, POUNDS(5)},
+                    {to->accountNumber, TRANSACTION_DEPOSIT, POUNDS(5)}
+            };
+            enum OperationStatus results[2];
+            assert(applyTransactionBatch(worker->accounts, worker->count, operations, 2, results) == 2);
+        } else {
+            assert(withdrawFunds(from, POUNDS(5), NULL, 0) == STATUS_OK);
+            char message[100];
+            assert(depositFunds(to, POUNDS(5), message, sizeof(message)) == STATUS_OK);
+        }
+    }
+    return NULL;
+}
+
+// Test the thread-safe engine mode: concurrent sessions and batches on shared accounts
+void test_accountLocking() {
+    assert(accountLockingEnabled() == false);
+    assert(accountLockStripe(1) != accountLockStripe(2));
+    int count = 5;
+    struct BankAccount *accounts = calloc(count, sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        accounts[i].accountNumber = i + 1;
+        accounts[i].balance = POUNDS(1000000);
+    }
+    registerAccounts(accounts, count, count);
+    const char *logFile = "test_locking.bin";
+    remove(logFile);
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = logFile;
+    config.index = false;
+    assert(startTransactionLog(&config));
+    setAccountLocking(true);
+    pthread_t threads[8];
+    struct LockingWorker workers[8];
+    for (int t = 0; t < 8; t++) {
+        workers[t].accounts = accounts;
+        workers[t].count = count;
+        workers[t].id = t;
+        pthread_create(&threads[t], NULL, lockingWorker, &workers[t]);
+    }
+    for (int t = 0; t < 8; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    setAccountLocking(false);
+    stopTransactionLog();
+    remove(logFile);
+    Money total = 0;
+    for (int i = 0; i < count; i++) {
+        total += accounts[i].balance;
+    }
+    assert(total == POUNDS(5000000));
+    // Each changed account is listed once.
+    int dirtyCount;
+    const int *dirty = dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == count);
+    for (int i = 0; i < dirtyCount; i++) {
+        for (int j = i + 1; j < dirtyCount; j++) {
+            assert(dirty[i] != dirty[j]);
+        }
+    }
+    releaseAccounts(accounts);
+}
+
+struct AtomicWorker {
+    struct BankAccount *accounts;
+    int withdrawn;      // Successful £5 withdrawals
+    int deposited;      // £5 deposits
+};
+
+// Withdraw from one hot account until it runs dry, topping it up now and then.
+static void* atomicWorker(void *arg) {
+    struct AtomicWorker *worker = arg;
+    struct BankAccount *hot = findAccount(worker->accounts, 1, 1);
+    for (int i = 0; i < 3000; i++) {
+        if (i % 100 == 0) {
+            struct BatchOperation operations[2] = {
+                    {1, TRANSACTION_WITHDRAWAL, POUNDS(5)},
+                    {1, TRANSACTION_DEPOSIT, POUNDS(5)}
+            };
+            enum OperationStatus results[2];
+            applyTransactionBatch(worker->accounts, 1, operations, 2, results);
+            assert(results[1] == STATUS_OK);
+            worker->withdrawn += results[0] == STATUS_OK;
+            worker->deposited++;
+        } else if (i % 3 == 0) {
+            assert(depositFunds(hot, POUNDS(5), NULL, 0) == STATUS_OK);
+            worker->deposited++;
+        } else {
+            enum OperationStatus status = withdrawFunds(hot, POUNDS(5), NULL, 0);
+            assert(status == STATUS_OK || status == STATUS_INSUFFICIENT_FUNDS);
+            worker->withdrawn += status == STATUS_OK;
+        }
+        assert(accountBalance(hot) >= 0);
+    }
+    return NULL;
+}
+
+// Test lock-free balance updates: no update is lost and the hot account is never overdrawn
+void test_atomicBalances() {
+    struct BankAccount *accounts = calloc(1, sizeof(struct BankAccount));
+    accounts[0].accountNumber = 1;
+    accounts[0].balance = POUNDS(100);
+    registerAccounts(accounts, 1, 1);
+    const char *logFile = "test_atomic.bin";
+    remove(logFile);
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = logFile;
+    config.index = false;
+    assert(startTransactionLog(&config));
+    setAtomicBalances(true);
+    Money before;
+    assert(debitAccount(&accounts[0], POUNDS(105), &before) == STATUS_INSUFFICIENT_FUNDS);
+    assert(debitAccount(&accounts[0], POUNDS(7), &before) == STATUS_NOT_MULTIPLE_OF_5);
+    assert(creditAccount(&accounts[0], 0, &before) == STATUS_INVALID_DEPOSIT);
+    char message[100];
+    balanceText(&accounts[0], message, sizeof(message));
+    assert(strcmp(message, "Your current balance is: £100.00") == 0);
+
+    pthread_t threads[8];
+    struct AtomicWorker workers[8];
+    for (int t = 0; t < 8; t++) {
+        workers[t].accounts = accounts;
+        workers[t].withdrawn = workers[t].deposited = 0;
+        pthread_create(&threads[t], NULL, atomicWorker, &workers[t]);
+    }
+    Money expected = POUNDS(100);
+    for (int t = 0; t < 8; t++) {
+        pthread_join(threads[t], NULL);
+        expected += POUNDS(5) * (workers[t].deposited - workers[t].withdrawn);
+    }
+    setAtomicBalances(false);
+    stopTransactionLog();
+    remove(logFile);
+    assert(accounts[0].balance == expected);
+    releaseAccounts(accounts);
+}
+
+// Deposit into and withdraw from one hot account that starts empty while the journal fails;
+// operations that are not recorded must leave no trace, and the account is never overdrawn.
+static void* failingJournalWorker(void *arg) {
+    struct AtomicWorker *worker = arg;
+    struct BankAccount *hot = findAccount(worker->accounts, 1, 1);
+    for (int i = 0; i < 2000; i++) {
+        enum OperationStatus status;
+        if (i % 50 == 0) {
+            struct BatchOperation operations[3] = {
+                    {1, TRANSACTION_DEPOSIT, POUNDS(10)},
+                    {1, TRANSACTION_WITHDRAWAL, POUNDS(5)},
+                    {1, TRANSACTION_WITHDRAWAL, POUNDS(5)}
+            };
+            enum OperationStatus results[3];
+            applyTransactionBatch(worker->accounts, 1, operations, 3, results);
+            assert(results[0] == STATUS_OK || results[0] == STATUS_NOT_RECORDED);
+            if (results[0] == STATUS_OK) {
+                worker->deposited += 2;
+                worker->withdrawn += (results[1] == STATUS_OK) + (results[2] == STATUS_OK);
+            }
+        } else if (i % 2 == 0) {
+            status = depositFunds(hot, POUNDS(5), NULL, 0);
+            assert(status == STATUS_OK || status == STATUS_NOT_RECORDED);
+            worker->deposited += status == STATUS_OK;
+        } else {
+            status = withdrawFunds(hot, POUNDS(5), NULL, 0);
+            assert(status == STATUS_OK || status == STATUS_INSUFFICIENT_FUNDS || status == STATUS_NOT_RECORDED);
+            worker->withdrawn += status == STATUS_OK;
+        }
+        assert(accountBalance(hot) >= 0);
+    }
+    return NULL;
+}
+
+// Test lock-free updates against a journal that fails part way: a deposit that can not be recorded
+// is never published, so taking a withdrawal back can not overdraw the account either.
+void test_atomicFailingJournal() {
+    struct BankAccount *accounts = calloc(1, sizeof(struct BankAccount));
+    accounts[0].accountNumber = 1;
+    registerAccounts(accounts, 1, 1);
+    const char *logFile = "test_atomic_journal.bin";
+    const char *journalFile = "test_atomic.journal";
+    remove(logFile);
+    remove(journalFile);
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = logFile;
+    config.index = false;
+    assert(startTransactionLog(&config));
+    assert(journalOpen(journalFile));
+    // Grow the journal past anything the log writes, then cap file sizes a few hundred records
+    // further: from there on every journal write fails (and is taken back), the log's do not.
+    struct BankAccount other = {2, "Other", 0, 1234, false};
+    const struct BankAccount *filler[1000];
+    for (int i = 0; i < 1000; i++) {
+        filler[i] = &other;
+    }
+    assert(journalAccounts(filler, 1000));
+    struct stat info;
+    assert(stat(journalFile, &info) == 0);
+    struct rlimit oldLimit, limit;
+    getrlimit(RLIMIT_FSIZE, &oldLimit);
+    limit = oldLimit;
+    limit.rlim_cur = (rlim_t)info.st_size + 300 * sizeof(struct JournalRecord);
+    signal(SIGXFSZ, SIG_IGN);
+    assert(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+    setAtomicBalances(true);
+
+    pthread_t threads[8];
+    struct AtomicWorker workers[8];
+    for (int t = 0; t < 8; t++) {
+        workers[t].accounts = accounts;
+        workers[t].withdrawn = workers[t].deposited = 0;
+        pthread_create(&threads[t], NULL, failingJournalWorker, &workers[t]);
+    }
+    Money expected = 0;
+    int deposited = 0;
+    for (int t = 0; t < 8; t++) {
+        pthread_join(threads[t], NULL);
+        expected += POUNDS(5) * (workers[t].deposited - workers[t].withdrawn);
+        deposited += workers[t].deposited;
+    }
+    setAtomicBalances(false);
+    setrlimit(RLIMIT_FSIZE, &oldLimit);
+    signal(SIGXFSZ, SIG_DFL);
+    journalClose();
+    stopTransactionLog();
+    assert(deposited > 0 && deposited < 8 * 1000);   // Some were recorded, the rest were not
+    assert(accounts[0].balance == expected);
+    remove(logFile);
+    remove(journalFile);
+    releaseAccounts(accounts);
+}
+
+struct ShardClientWorker {
+    struct ShardedEngine *engine;
+    int client;
+    int accounts;
+    Money deposited;
+};
+
+// Collect what has been answered so far for the worker and check it.
+static int collectDeposits(struct ShardClientWorker *worker) {
+    struct ShardMessage answers[64];
+    int n = shardCollect(worker->engine, worker->client, answers, 64);
+    if (n == 0) {
+        sched_yield();
+    }
+    for (int i = 0; i < n; i++) {
+        assert(answers[i].status == STATUS_OK);
+        worker->deposited += POUNDS(1);
+    }
+    return n;
+}
+
+// Deposit £1 into every account ten times, collecting answers whenever a queue is full.
+static void* shardClientWorker(void *arg) {
+    struct ShardClientWorker *worker = arg;
+    int outstanding = 0;
+    for (int i = 0; i < 10 * worker->accounts; i++) {
+        struct ShardMessage request = {(uint64_t)i, 1 + i % worker->accounts, TRANSACTION_DEPOSIT, POUNDS(1), STATUS_OK};
+        while (!shardSubmit(worker->engine, worker->client, &request)) {
+            outstanding -= collectDeposits(worker);
+        }
+        outstanding++;
+    }
+    while (outstanding > 0) {
+        outstanding -= collectDeposits(worker);
+    }
+    return NULL;
+}
+
+// Test the sharded engine: routing, answers, write-back, and concurrent clients
+void test_shardedEngine() {
+    int count = 100;
+    struct BankAccount *accounts = calloc(count, sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        accounts[i].accountNumber = i + 1;
+        accounts[i].balance = POUNDS(100);
+        accounts[i].pinCode = 1000 + i;
+    }
+    registerAccounts(accounts, count, count);
+    assert(startShardedEngine(accounts, count, MAX_SHARDS + 1, 1, false) == NULL);
+    // The workers journal and log what they do before answering.
+    const char *logFile = "test_shard.bin";
+    const char *journalFile = "test_shard.journal";
+    remove(logFile);
+    remove(journalFile);
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = logFile;
+    config.index = false;
+    assert(startTransactionLog(&config));
+    assert(journalOpen(journalFile));
+    struct ShardedEngine *engine = startShardedEngine(accounts, count, 4, 3, false);
+    assert(engine != NULL);
+    bool used[4] = {false};
+    for (int i = 1; i <= count; i++) {
+        int shard = shardOfAccount(engine, i);
+        assert(shard >= 0 && shard < 4);
+        used[shard] = true;
+    }
+    assert(used[0] && used[1] && used[2] && used[3]);
+
+    // Client 0: one of each kind of answer.
+    struct ShardMessage requests[6] = {
+            {1, 7, TRANSACTION_WITHDRAWAL, POUNDS(40), STATUS_OK},
+            {2, 7, TRANSACTION_WITHDRAWAL, POUNDS(70), STATUS_OK},     // Only 60 left
+            {3, 8, TRANSACTION_DEPOSIT, POUNDS(5), STATUS_OK},
+            {4, 9, TRANSACTION_CHECK_BALANCE, 0, STATUS_OK},
+            {5, 5000, TRANSACTION_DEPOSIT, POUNDS(5), STATUS_OK},
+            {6, 9, TRANSACTION_WITHDRAWAL, POUNDS(3), STATUS_OK}
+    };
+    for (int i = 0; i < 6; i++) {
+        assert(shardSubmit(engine, 0, &requests[i]));
+    }
+    struct ShardMessage answers[6];
+    int received = 0;
+    while (received < 6) {
+        received += shardCollect(engine, 0, answers + received, 6 - received);
+    }
+    enum OperationStatus expected[7] = {STATUS_OK, STATUS_OK, STATUS_INSUFFICIENT_FUNDS, STATUS_OK, STATUS_OK,
+                                        STATUS_UNKNOWN_ACCOUNT, STATUS_NOT_MULTIPLE_OF_5};
+    Money balances[7] = {0, POUNDS(60), POUNDS(60), POUNDS(105), POUNDS(100), 0, POUNDS(100)};
+    uint64_t lastTag[4] = {0};
+    for (int i = 0; i < 6; i++) {
+        assert(answers[i].status == expected[answers[i].tag]);
+        assert(answers[i].amount == balances[answers[i].tag]);
+        // Answers of one shard come back in order.
+        int shard = shardOfAccount(engine, answers[i].accountNumber);
+        assert(answers[i].tag > lastTag[shard]);
+        lastTag[shard] = answers[i].tag;
+    }
+    // The flat array is untouched until the engine stops.
+    assert(findAccount(accounts, count, 7)->balance == POUNDS(100));
+
+    // Clients 1 and 2 on their own threads.
+    pthread_t threads[2];
+    struct ShardClientWorker workers[2];
+    for (int t = 0; t < 2; t++) {
+        workers[t].engine = engine;
+        workers[t].client = t + 1;
+        workers[t].accounts = count;
+        workers[t].deposited = 0;
+        pthread_create(&threads[t], NULL, shardClientWorker, &workers[t]);
+    }
+    for (int t = 0; t < 2; t++) {
+        pthread_join(threads[t], NULL);
+        assert(workers[t].deposited == POUNDS(10 * count));
+    }
+    uint64_t processed[4];
+    shardedEngineStats(engine, processed);
+    assert(processed[0] + processed[1] + processed[2] + processed[3] == 6 + 2 * 10 * (uint64_t)count);
+
+    stopShardedEngine(engine, accounts, count);
+    journalClose();
+    stopTransactionLog();
+    // Every successful request is logged, and replaying the journal gives the same balances.
+    long recordCount;
+    struct TransactionRecord *records = readTransactionLog(logFile, &recordCount);
+    assert(recordCount == 3 + 2 * 10 * count);
+    free(records);
+    struct BankAccount *replayed = calloc(count, sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        replayed[i].accountNumber = i + 1;
+        replayed[i].balance = POUNDS(100);
+    }
+    assert(journalReplay(journalFile, replayed, count) > 0);
+    for (int i = 0; i < count; i++) {
+        assert(replayed[i].balance == findAccount(accounts, count, i + 1)->balance);
+    }
+    free(replayed);
+    remove(logFile);
+    remove(journalFile);
+    assert(findAccount(accounts, count, 7)->balance == POUNDS(80));
+    assert(findAccount(accounts, count, 8)->balance == POUNDS(125));
+    assert(findAccount(accounts, count, 1)->balance == POUNDS(120));
+    assert(findAccount(accounts, count, 9)->pinCode == 1008);
+    int dirtyCount;
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == count);
+    releaseAccounts(accounts);
+
+    // Accounts that share a number go back to where they came from: requests reach the first one,
+    // and the second keeps its balance.
+    struct BankAccount twins[2] = {{77, "First", POUNDS(10), 1111, false}, {77, "Second", POUNDS(20), 2222, false}};
+    engine = startShardedEngine(twins, 2, 2, 1, false);
+    assert(engine != NULL);
+    struct ShardMessage twinDeposit = {1, 77, TRANSACTION_DEPOSIT, POUNDS(5), STATUS_OK};
+    assert(shardSubmit(engine, 0, &twinDeposit));
+    while (shardCollect(engine, 0, answers, 1) == 0) {
+    }
+    assert(answers[0].status == STATUS_OK && answers[0].amount == POUNDS(15));
+    stopShardedEngine(engine, twins, 2);
+    assert(twins[0].balance == POUNDS(15) && twins[1].balance == POUNDS(20));
+}
+
+// Test the hot/cold split account store
+void test_accountStore() {
+    struct BankAccount accounts[3] = {
+            {4001, "Ada Lovelace", POUNDS(120), 1111, false},
+            {9000017, "Charles Babbage", 4250, 2222, true},
+            {4001, "Duplicate", POUNDS(1), 3333, false}
+    };
+    struct AccountStore *store = createAccountStore(accounts, 3);
+    assert(store != NULL && store->count == 3);
+    // Like findAccount(), the first account with a number wins.
+    assert(storeFindAccount(store, 4001) == 0);
+    assert(storeFindAccount(store, 9000017) == 1);
+    assert(storeFindAccount(store, 4002) == -1);
+    assert(storeBalance(store, 1) == 4250);
+    assert(storePin(store, 0) == 1111);
+    assert(storeBlocked(store, 1) && !storeBlocked(store, 0));
+    assert(strcmp(storeHolder(store, 1), "Charles Babbage") == 0);
+
+    storeSetBalance(store, 0, POUNDS(80));
+    storeSetPin(store, 0, 4444);
+    storeSetBlocked(store, 0, true);
+    assert(storeBalance(store, 0) == POUNDS(80) && storePin(store, 0) == 4444 && storeBlocked(store, 0));
+    // Shorter names are written in place, longer ones appended to the arena.
+    size_t arena = store->namesSize;
+    assert(storeSetHolder(store, 0, "Ada King"));
+    assert(store->namesSize == arena);
+    assert(storeSetHolder(store, 0, "Augusta Ada King, Countess of Lovelace, Analyst of the Engine"));
+    assert(strlen(storeHolder(store, 0)) == sizeof(accounts[0].accountHolder) - 1);
+    assert(strcmp(storeHolder(store, 1), "Charles Babbage") == 0);
+
+    // Round trip through struct BankAccount, including renumbering.
+    struct BankAccount account;
+    storeGetAccount(store, 1, &account);
+    assert(account.accountNumber == 9000017 && account.balance == 4250 && account.blocked);
+    assert(strcmp(account.accountHolder, "Charles Babbage") == 0);
+    account.accountNumber = 5000;
+    account.balance = POUNDS(7);
+    strcpy(account.accountHolder, "C. Babbage");
+    assert(storePutAccount(store, 1, &account));
+    assert(storeFindAccount(store, 9000017) == -1 && storeFindAccount(store, 5000) == 1);
+    assert(storeBalance(store, 1) == POUNDS(7) && strcmp(storeHolder(store, 1), "C. Babbage") == 0);
+
+    // Growing past the initial capacity keeps every account findable.
+    for (int i = 0; i < 1000; i++) {
+        struct BankAccount added = {100000 + i * 7, "", i, 1000 + i, i % 2 == 0};
+        snprintf(added.accountHolder, sizeof(added.accountHolder), "Holder %d", i);
+        assert(storeAddAccount(store, &added) == 3 + i);
+    }
+    for (int i = 0; i < 1000; i++) {
+        int position = storeFindAccount(store, 100000 + i * 7);
+        assert(position == 3 + i && storeBalance(store, position) == i && storeBlocked(store, position) == (i % 2 == 0));
+        char holder[50];
+        snprintf(holder, sizeof(holder), "Holder %d", i);
+        assert(strcmp(storeHolder(store, position), holder) == 0);
+    }
+    int count;
+    struct BankAccount *copy = storeToAccounts(store, &count);
+    assert(count == 1003);
+    assert(copy[0].balance == POUNDS(80) && copy[0].pinCode == 4444 && copy[0].blocked);
+    assert(copy[1].accountNumber == 5000 && copy[2].accountNumber == 4001);
+    assert(strcmp(copy[1002].accountHolder, "Holder 999") == 0);
+
+    // Refreshing from the live array picks up changed fields, renumbered and appended accounts.
+    copy[0].balance = POUNDS(81);
+    copy[1].accountNumber = 5001;
+    strcpy(copy[2].accountHolder, "Someone Else Entirely");
+    copy = realloc(copy, 1004 * sizeof(struct BankAccount));
+    copy[1003] = (struct BankAccount){6000, "New Holder", POUNDS(3), 5555, false};
+    assert(refreshAccountStore(store, copy, 1004));
+    assert(store->count == 1004 && storeBalance(store, 0) == POUNDS(81));
+    assert(storeFindAccount(store, 5000) == -1 && storeFindAccount(store, 5001) == 1);
+    assert(strcmp(storeHolder(store, 2), "Someone Else Entirely") == 0);
+    assert(storeFindAccount(store, 6000) == 1003 && strcmp(storeHolder(store, 1003), "New Holder") == 0);
+    // A shorter array starts the store over.
+    assert(refreshAccountStore(store, copy, 2));
+    assert(store->count == 2 && storeFindAccount(store, 6000) == -1 && storeFindAccount(store, 4001) == 0);
+    free(copy);
+    freeAccountStore(store);
+}
+
+// Test the end-of-day aggregates: every kernel, odd sizes, band edges and several threads
+void test_endOfDayReport() {
+    Money limits[3] = {0, POUNDS(100), POUNDS(1000)};
+    int count = 600037;     // Enough for several threads, not a multiple of any block size
+    struct BankAccount *accounts = calloc(count, sizeof(struct BankAccount));
+    struct EndOfDayReport expected;
+    memset(&expected, 0, sizeof(expected));
+    expected.accounts = count;
+    expected.bandCount = 4;
+    for (int i = 0; i < count; i++) {
+        accounts[i].accountNumber = i + 1;
+        // Every band and both sides of every limit occur.
+        Money values[7] = {-1, 0, POUNDS(100) - 1, POUNDS(100), POUNDS(1000) - 1, POUNDS(1000), POUNDS(250000)};
+        accounts[i].balance = values[i % 7] + (i % 7 == 6 ? i : 0);
+        accounts[i].blocked = i % 3 == 0;
+        int band = 0;
+        while (band < 3 && accounts[i].balance >= limits[band]) {
+            band++;
+        }
+        expected.bands[band]++;
+        expected.totalBalance += accounts[i].balance;
+        expected.blockedCards += accounts[i].blocked;
+    }
+    struct AccountStore *store = createAccountStore(accounts, count);
+    enum ReportKernel kernels[4] = {REPORT_KERNEL_AUTO, REPORT_KERNEL_SCALAR, REPORT_KERNEL_SSE, REPORT_KERNEL_AVX2};
+    struct EndOfDayReport report;
+    for (int k = 0; k < 4; k++) {
+        for (int threads = 1; threads <= 4; threads += 3) {
+            assert(endOfDayReportWith(store, limits, 3, threads, kernels[k], &report));
+            assert(memcmp(&report, &expected, sizeof(report)) == 0);
+        }
+    }
+    assert(endOfDayReportAccounts(accounts, count, limits, 3, 4, &report));
+    assert(memcmp(&report, &expected, sizeof(report)) == 0);
+
+    // Short tables only take the scalar tails; no limits means one band.
+    assert(endOfDayReport(store, NULL, 0, 1, &report));
+    assert(report.bandCount == 1 && report.bands[0] == count && report.totalBalance == expected.totalBalance);
+    freeAccountStore(store);
+    store = createAccountStore(accounts, 5);
+    assert(endOfDayReport(store, limits, 3, 8, &report));
+    assert(report.accounts == 5 && report.blockedCards == 2);
+    assert(report.bands[0] == 1 && report.bands[1] == 2 && report.bands[2] == 2 && report.bands[3] == 0);
+    assert(report.totalBalance == -1 + 0 + POUNDS(100) - 1 + POUNDS(100) + POUNDS(1000) - 1);
+
+    // Limits must be strictly ascending and leave room for the bands.
+    Money unordered[2] = {POUNDS(10), POUNDS(10)};
+    Money many[REPORT_MAX_BANDS];
+    for (int b = 0; b < REPORT_MAX_BANDS; b++) {
+        many[b] = b;
+    }
+    assert(!endOfDayReport(store, unordered, 2, 1, &report));
+    assert(!endOfDayReport(store, many, REPORT_MAX_BANDS, 1, &report));
+    assert(endOfDayReport(store, many, REPORT_MAX_BANDS - 1, 1, &report));
+    freeAccountStore(store);
+    free(accounts);
+}
+
+struct CheckpointThreadArgs {
+    const char *accountsFile;
+    struct BankAccount *accounts;
+    int accountCount;
+    bool ok;
+    bool done;
+};
+
+static void *backgroundCheckpointThread(void *arg) {
+    struct CheckpointThreadArgs *args = arg;
+    args->ok = journalCheckpointInBackground(args->accountsFile, args->accounts, args->accountCount);
+    __atomic_store_n(&args->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Test crash-safe saves and saves made in the background
+void test_backgroundSave() {
+    const char *csvFile = "test_background.csv";
+    const char *snapFile = "test_background.snap";
+    const char *journalFile = "test_background.snap.journal";
+    struct BankAccount initial[3] = {
+            {1, "Kirill", POUNDS(100), 1111, false},
+            {2, "Madiyar", POUNDS(200), 2222, false},
+            {3, "Andrew", POUNDS(300), 3333, false}
+    };
+    // Saves go through a temporary file; a failed save leaves nothing behind.
+    assert(saveAccountsToCSV(csvFile, initial, 3));
+    assert(access("test_background.csv.tmp", F_OK) != 0);
+    assert(!saveAccountsToCSV("no_such_directory/accounts.csv", initial, 3));
+
+    // The thread saves the accounts as they were when it started.
+    saveAccountsSnapshot(snapFile, initial, 3);
+    int count;
+    struct BankAccount *accounts = loadAccounts(snapFile, &count, 1);
+    deposit(findAccount(accounts, count, 1), POUNDS(50));
+    assert(pollBackgroundSave(false) == BACKGROUND_SAVE_IDLE);
+    assert(saveAccountsInBackground(snapFile, accounts, count));
+    deposit(findAccount(accounts, count, 2), POUNDS(50));
+    assert(!saveAccountsInBackground(snapFile, accounts, count));  // One at a time
+    assert(pollBackgroundSave(true) == BACKGROUND_SAVE_DONE);
+    assert(pollBackgroundSave(false) == BACKGROUND_SAVE_IDLE);
+    assert(accountsSnapshotFile(accounts) != NULL && strcmp(accountsSnapshotFile(accounts), snapFile) == 0);
+    int savedCount;
+    struct BankAccount *saved = loadAccounts(snapFile, &savedCount, 1);
+    assert(findAccount(saved, savedCount, 1)->balance == POUNDS(150));
+    assert(findAccount(saved, savedCount, 2)->balance == POUNDS(200));
+    releaseAccounts(saved);
+    // The change made during the save is still tracked and saved in place next time.
+    int dirtyCount;
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == 1);
+    assert(saveDirtyAccountsSnapshot(snapFile, accounts, count) == 1);
+
+    // A background checkpoint rotates the journal; whether or not the save finished, the
+    // accounts file plus both journals give the latest state.
+    remove(journalFile);
+    assert(journalOpen(journalFile));
+    withdraw(findAccount(accounts, count, 3), POUNDS(100));
+    assert(journalCheckpointInBackground(snapFile, accounts, count));
+    deposit(findAccount(accounts, count, 3), POUNDS(10));
+    assert(access("test_background.snap.journal.1", F_OK) == 0);
+    saved = loadAccounts(snapFile, &savedCount, 1);
+    assert(journalReplay(journalFile, saved, savedCount) == 2);
+    assert(findAccount(saved, savedCount, 3)->balance == POUNDS(210));
+    releaseAccounts(saved);
+    // A full checkpoint waits for the background one and removes both journals' records.
+    assert(journalCheckpoint(snapFile, accounts, count));
+    // A background checkpoint waits for a change that is not journaled yet, so one that is then
+    // taken back is never saved.
+    struct BankAccount *first = findAccount(accounts, count, 1);
+    bool begun = journalBeginChange();
+    assert(begun);
+    first->balance += POUNDS(1000);
+    struct CheckpointThreadArgs args = {snapFile, accounts, count, false, false};
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, backgroundCheckpointThread, &args) == 0);
+    usleep(100000);
+    assert(!__atomic_load_n(&args.done, __ATOMIC_ACQUIRE));
+    first->balance -= POUNDS(1000);
+    journalEndChange(begun);
+    pthread_join(thread, NULL);
+    assert(args.ok);
+    assert(pollBackgroundSave(true) == BACKGROUND_SAVE_DONE);
+    saved = loadAccounts(snapFile, &savedCount, 1);
+    assert(findAccount(saved, savedCount, 1)->balance == POUNDS(150));
+    releaseAccounts(saved);
+    assert(journalCheckpoint(snapFile, accounts, count));
+    journalClose();
+    assert(access("test_background.snap.journal.1", F_OK) != 0);
+    saved = loadAccounts(snapFile, &savedCount, 1);
+    assert(journalReplay(journalFile, saved, savedCount) == 0);
+    assert(findAccount(saved, savedCount, 3)->balance == POUNDS(210));
+    assert(findAccount(saved, savedCount, 2)->balance == POUNDS(250));
+    releaseAccounts(saved);
+    releaseAccounts(accounts);
+    remove(csvFile);
+    remove(snapFile);
+    remove(journalFile);
+}
+
+static long countLogRecords(const char *filename) {
+    long count;
+    free(readTransactionLog(filename, &count));
+    return count;
+}
+
+// Test the buffered binary transaction log
+void test_transactionLog() {
+    const char *filename = "test_log.bin";
+    remove(filename);
+    remove("test_log.bin.idx");
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = filename;
+    config.flushIntervalMs = 0;  // Only on size or when flushed
+    assert(!transactionLogRunning());
+    assert(startTransactionLog(&config));
+    logTransaction(1, TRANSACTION_WITHDRAWAL, POUNDS(100), POUNDS(50));
+    flushTransactionLog();
+    long count;
+    struct TransactionRecord *records = readTransactionLog(filename, &count);
+    assert(count == 1 && records[0].sequence == 1 && records[0].accountNumber == 1);
+    assert(records[0].operation == TRANSACTION_WITHDRAWAL);
+    assert(records[0].balanceBefore == 10000 && records[0].balanceAfter == 5000);
+    char line[256];
+    formatTransactionRecord(&records[0], line, sizeof(line));
+    assert(strcmp(line, "Account 1 - Withdrawal: Original Balance = £100.00, New Balance = £50.00\n") == 0);
+    free(records);
+    // More records than the ring holds: producers wait for the writer, nothing is lost,
+    // and the records are written in batches.
+    for (int i = 0; i < 3 * LOG_RING_CAPACITY; i++) {
+        logTransaction(i, TRANSACTION_CHECK_BALANCE, 10 * i, 10 * i);
+    }
+    uint64_t entries, batches;
+    transactionLogStats(&entries, &batches);
+    assert(entries == 3 * LOG_RING_CAPACITY + 1);
+    stopTransactionLog();  // Writes what is still queued
+    assert(!transactionLogRunning());
+    transactionLogStats(&entries, &batches);
+    assert(batches < entries / 16);
+    records = readTransactionLog(filename, &count);
+    assert(count == 3 * LOG_RING_CAPACITY + 1);
+    for (long i = 1; i < count; i++) {
+        assert(records[i].sequence == (uint64_t)i + 1 && records[i].timestampNs >= records[i - 1].timestampNs);
+        assert(records[i].balanceAfter == 10 * (i - 1));
+    }
+    free(records);
+    // A record cut short by a crash is dropped; the next run continues the sequence after it.
+    FILE *file = fopen(filename, "ab");
+    fwrite("torn", 1, 4, file);
+    fclose(file);
+    config.flushIntervalMs = 10;  // The interval policy writes without a flush or a full batch
+    assert(startTransactionLog(&config));
+    logTransaction(2, TRANSACTION_DEPOSIT, -50, POUNDS(2));
+    for (int i = 0; i < 200 && countLogRecords(filename) == 3 * LOG_RING_CAPACITY + 1; i++) {
+        usleep(10000);
+    }
+    records = readTransactionLog(filename, &count);
+    assert(count == 3 * LOG_RING_CAPACITY + 2);
+    assert(records[count - 1].sequence == (uint64_t)count);
+    formatTransactionRecord(&records[count - 1], line, sizeof(line));
+    assert(strcmp(line, "Account 2 - Deposit: Original Balance = £-0.50, New Balance = £2.00\n") == 0);
+    free(records);
+    stopTransactionLog();
+    // Once stopped, records are written directly, but still to this log and in its sequence.
+    assert(appendTransactionLog(3, TRANSACTION_WITHDRAWAL, POUNDS(5), 0));
+    records = readTransactionLog(filename, &count);
+    assert(count == 3 * LOG_RING_CAPACITY + 3);
+    assert(records[count - 1].sequence == (uint64_t)count && records[count - 1].accountNumber == 3);
+    free(records);
+    remove(filename);
+    remove("test_log.bin.idx");
+}
+
+static void* logProducer(void *arg) {
+    int account = *(int *)arg;
+    for (int i = 0; i < 5000; i++) {
+        logTransaction(account, TRANSACTION_DEPOSIT, POUNDS(i), POUNDS(i + 1));
+    }
+    return NULL;
+}
+
+// Test many threads logging at once: no record is lost or duplicated, sequence numbers have no
+// gaps, and each thread's records appear in the order it logged them
+void test_logProducers() {
+    const char *filename = "test_producers.bin";
+    remove(filename);
+    remove("test_producers.bin.idx");
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = filename;
+    config.flushRecords = 1;  // Wake the writer as often as possible
+    config.index = false;
+    assert(startTransactionLog(&config));
+    pthread_t threads[8];
+    int accounts[8];
+    for (int t = 0; t < 8; t++) {
+        accounts[t] = t;
+        pthread_create(&threads[t], NULL, logProducer, &accounts[t]);
+    }
+    for (int t = 0; t < 8; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    stopTransactionLog();
+    long count;
+    struct TransactionRecord *records = readTransactionLog(filename, &count);
+    assert(count == 8 * 5000);
+    long next[8] = {0};
+    for (long i = 0; i < count; i++) {
+        assert(records[i].sequence == (uint64_t)i + 1);
+        int account = records[i].accountNumber;
+        assert(account >= 0 && account < 8);
+        assert(records[i].balanceAfter == 100 * (next[account] + 1));
+        next[account]++;
+    }
+    free(records);
+    remove(filename);
+}
+
+// Test rotation of the transaction log into compressed segments and their retention
+void test_logRotation() {
+    const char *filename = "test_rotate.bin";
+    remove("test_rotate.bin.idx");
+    int count;
+    char **segments = listLogSegments(filename, &count);
+    for (int i = 0; i < count; i++) {
+        remove(segments[i]);
+    }
+    freeLogSegments(segments, count);
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = filename;
+    config.flushRecords = 50;
+    config.rotateBytes = sizeof(struct TransactionLogHeader) + 100 * sizeof(struct TransactionRecord);
+    config.retainSegments = 3;
+    assert(startTransactionLog(&config));
+    for (int i = 0; i < 1000; i++) {
+        logTransaction(i % 7, TRANSACTION_DEPOSIT, POUNDS(i), POUNDS(i + 1));
+    }
+    flushTransactionLog();
+    waitForLogCompression();
+    // The index drops the entries of the segments retention deleted, and its file with them.
+    struct LogIndex *index = transactionLogIndex();
+    assert(index != NULL && index->segments[0].firstSequence > 1);
+    assert(index->liveEntries == 1000 - (index->segments[0].firstSequence - 1));
+    assert(index->fileEntries <= 2 * index->liveEntries);
+    long historyCount;
+    struct TransactionRecord *history = logIndexHistory(index, 3, &historyCount);
+    assert(historyCount > 0 && historyCount < 143);
+    assert(history[0].sequence >= index->segments[0].firstSequence);
+    assert(history[historyCount - 1].sequence == 998);
+    free(history);
+    stopTransactionLog();  // Also finishes compressing
+    segments = listLogSegments(filename, &count);
+    // At most three closed segments are kept, all compressed, followed by the active log.
+    assert(count >= 2 && count <= 4);
+    assert(strcmp(segments[count - 1], filename) == 0);
+    uint64_t expected = 0;
+    for (int s = 0; s < count; s++) {
+        if (s < count - 1) {
+            assert(strstr(segments[s], ".gz") != NULL);
+        }
+        long recordCount;
+        struct TransactionRecord *records = readTransactionLog(segments[s], &recordCount);
+        assert(records != NULL);
+        for (long i = 0; i < recordCount; i++) {
+            // Sequences are contiguous from the oldest retained segment to the active log.
+            assert(expected == 0 || records[i].sequence == expected + 1);
+            expected = records[i].sequence;
+        }
+        free(records);
+    }
+    assert(expected == 1000);
+    // Without compression, closed segments stay as they are.
+    config.compress = false;
+    config.retainSegments = 0;
+    assert(startTransactionLog(&config));
+    for (int i = 0; i < 300; i++) {
+        logTransaction(1, TRANSACTION_WITHDRAWAL, POUNDS(2), POUNDS(1));
+    }
+    flushTransactionLog();
+    waitForLogCompression();
+    stopTransactionLog();
+    freeLogSegments(segments, count);
+    segments = listLogSegments(filename, &count);
+    assert(count >= 5 && strstr(segments[count - 2], ".gz") == NULL);
+    long recordCount;
+    struct TransactionRecord *records = readTransactionLog(segments[count - 1], &recordCount);
+    assert(recordCount > 0 && records[recordCount - 1].sequence == 1300);  // Continued across runs
+    free(records);
+    for (int i = 0; i < count; i++) {
+        remove(segments[i]);
+    }
+    freeLogSegments(segments, count);
+    remove("test_rotate.bin.idx");
+}
+
+// Check the history of account 3 in test_index.bin: one record for each i % 7 == 3, i < 1000.
+static void checkHistory(struct LogIndex *index) {
+    long count;
+    struct TransactionRecord *records = logIndexHistory(index, 3, &count);
+    assert(count == 143);
+    for (long i = 0; i < count; i++) {
+        assert(records[i].accountNumber == 3 && records[i].balanceAfter == 100 * (7 * i + 3) + 100);
+    }
+    free(records);
+    records = logIndexHistory(index, 99, &count);
+    assert(count == 0);
+    free(records);
+}
+
+// Test the per-account index over the transaction log
+void test_logIndex() {
+    const char *filename = "test_index.bin";
+    int count;
+    char **segments = listLogSegments(filename, &count);
+    for (int i = 0; i < count; i++) {
+        remove(segments[i]);
+    }
+    freeLogSegments(segments, count);
+    remove("test_index.bin.idx");
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = filename;
+    config.rotateBytes = sizeof(struct TransactionLogHeader) + 100 * sizeof(struct TransactionRecord);
+    config.retainSegments = 0;
+    assert(startTransactionLog(&config));
+    for (int i = 0; i < 1000; i++) {
+        logTransaction(i % 7, TRANSACTION_DEPOSIT, POUNDS(i), POUNDS(i + 1));
+    }
+    // Lookups while the log is running see everything written so far, across
+    // compressed, uncompressed and active segments.
+    flushTransactionLog();
+    checkHistory(transactionLogIndex());
+    stopTransactionLog();
+
+    // Reopened from the file.
+    struct LogIndex *index = openLogIndex(filename);
+    checkHistory(index);
+    closeLogIndex(index);
+    // An index that lags behind the log (a crash before it was written) is caught up.
+    assert(truncate("test_index.bin.idx", sizeof(struct TransactionLogHeader) + 10 * sizeof(struct LogIndexEntry)) == 0);
+    index = openLogIndex(filename);
+    checkHistory(index);
+    closeLogIndex(index);
+    // Rebuilt from scratch.
+    remove("test_index.bin.idx");
+    assert(rebuildLogIndex(filename));
+    index = openLogIndex(filename);
+    checkHistory(index);
+    closeLogIndex(index);
+    // An index that ran out of memory answers no lookups and is rebuilt in full when closed.
+    index = openLogIndex(filename);
+    index->broken = true;
+    long brokenCount;
+    assert(logIndexHistory(index, 3, &brokenCount) == NULL && brokenCount == 0);
+    assert(truncate("test_index.bin.idx", sizeof(struct TransactionLogHeader)) == 0);
+    closeLogIndex(index);
+    struct stat info;
+    assert(stat("test_index.bin.idx", &info) == 0);
+    assert(info.st_size == (off_t)(sizeof(struct TransactionLogHeader) + 1000 * sizeof(struct LogIndexEntry)));
+
+    segments = listLogSegments(filename, &count);
+    for (int i = 0; i < count; i++) {
+        remove(segments[i]);
+    }
+    freeLogSegments(segments, count);
+    remove("test_index.bin.idx");
+}
+
+static struct BankAccount* makeReplayAccounts(int count) {
+    struct BankAccount *accounts = calloc(count, sizeof(struct BankAccount));
+    for (int i = 0; i < count; i++) {
+        accounts[i].accountNumber = i + 1;
+        accounts[i].pinCode = 1234;
+    }
+    registerAccounts(accounts, count, count);
+    return accounts;
+}
+
+// Test replaying the log over accounts: balances follow the log across segments, records whose
+// original balance does not match are flagged, and unknown accounts are skipped
+void test_replay() {
+    const char *filename = "test_replay.bin";
+    int count;
+    char **segments = listLogSegments(filename, &count);
+    for (int i = 0; i < count; i++) {
+        remove(segments[i]);
+    }
+    freeLogSegments(segments, count);
+    struct TransactionLogConfig config;
+    transactionLogDefaults(&config);
+    config.filename = filename;
+    config.rotateBytes = sizeof(struct TransactionLogHeader) + 100 * sizeof(struct TransactionRecord);
+    config.retainSegments = 0;
+    config.index = false;
+    assert(startTransactionLog(&config));
+    // 20 deposits of 10 into each of 50 accounts, interleaved.
+    for (int i = 0; i < 1000; i++) {
+        logTransaction(1 + i % 50, TRANSACTION_DEPOSIT, POUNDS(10 * (i / 50)), POUNDS(10 * (i / 50 + 1)));
+    }
+    logTransaction(7, TRANSACTION_WITHDRAWAL, POUNDS(999), POUNDS(100));  // The account held 200
+    logTransaction(3, TRANSACTION_CARD_RETAINED, 0, 0);
+    logTransaction(500, TRANSACTION_CHECK_BALANCE, POUNDS(1), POUNDS(1));
+    stopTransactionLog();
+
+    struct BankAccount *accounts = makeReplayAccounts(50);
+    struct ReplayResult result;
+    assert(replayTransactionLog(filename, 0, accounts, 50, 4, &result));
+    assert(result.records == 1002 && result.unknownAccounts == 1 && result.missingRecords == 0);
+    assert(result.lastSequence == 1003);
+    assert(result.mismatchCount == 1);
+    assert(result.mismatches[0].sequence == 1001 && result.mismatches[0].accountNumber == 7);
+    assert(result.mismatches[0].replayedBalance == 20000 && result.mismatches[0].loggedBalance == 99900);
+    for (int i = 0; i < 50; i++) {
+        assert(accounts[i].balance == (i + 1 == 7 ? POUNDS(100) : POUNDS(200)));
+        assert(accounts[i].blocked == (i + 1 == 3));
+    }
+    int dirtyCount;
+    dirtyAccounts(accounts, &dirtyCount);
+    assert(dirtyCount == 50);
+    freeReplayResult(&result);
+    releaseAccounts(accounts);
+
+    // Starting part way through: the first record of each account after that point disagrees
+    // with the (empty) starting balances.
+    accounts = makeReplayAccounts(50);
+    assert(replayTransactionLog(filename, 501, accounts, 50, 3, &result));
+    assert(result.records == 502 && result.mismatchCount == 51);
+    for (long i = 1; i < result.mismatchCount; i++) {
+        assert(result.mismatches[i].sequence > result.mismatches[i - 1].sequence);
+    }
+    freeReplayResult(&result);
+    releaseAccounts(accounts);
+
+    // A deleted segment shows up as missing records.
+    segments = listLogSegments(filename, &count);
+    assert(count > 3);
+    remove(segments[1]);
+    accounts = makeReplayAccounts(50);
+    assert(replayTransactionLog(filename, 0, accounts, 50, 1, &result));
+    assert(result.missingRecords == 100);
+    freeReplayResult(&result);
+    releaseAccounts(accounts);
+    for (int i = 0; i < count; i++) {
+        remove(segments[i]);
+    }
+    freeLogSegments(segments, count);
+}
+
 int main() {
     test_checkPin();
     test_checkBlocked();
     test_withdraw();
     test_deposit();
+    test_money();
     test_changePin();
     test_showBalance();
+    test_operationStatus();
     test_findAccount();
+    test_loadAccountsFromCSV();
+    test_csvParserMatchesScanf();
+    test_csvStructuralIndex();
+    test_mapAccountsFromCSV();
+    test_loadAccountsFromCSVParallel();
+    test_accountsSnapshot();
+    test_accountIndex();
+    test_directAccountIndex();
+    test_accountRegistryFull();
+    test_legacyBalances();
+    test_saveDirtyAccounts();
+    test_markDuringSave();
+    test_journal();
+    test_batch();
+    test_accountLocking();
+    test_atomicBalances();
+    test_atomicFailingJournal();
+    test_shardedEngine();
+    test_accountStore();
+    test_endOfDayReport();
+    test_backgroundSave();
+    test_transactionLog();
+    test_logProducers();
+    test_logRotation();
+    test_logIndex();
+    test_replay();
 
     printf("All unit tests passed successfully! ;)\n");
     return 0;